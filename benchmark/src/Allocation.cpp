@@ -0,0 +1,74 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+#include "Allocation.hpp"
+
+using namespace benchmark;
+
+namespace {
+std::atomic<u64> allocation_count{0};
+
+void count_allocation() {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+}
+} // namespace
+
+#if defined __GLIBC__
+// jansson allocates with malloc(), so counting operator new is not enough;
+// the glibc entry points are wrapped instead (operator new calls malloc())
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) {
+  count_allocation();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  count_allocation();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+  count_allocation();
+  return __libc_realloc(pointer, size);
+}
+}
+#else
+// other C libraries: only C++ allocations are counted
+void *operator new(size_t size) {
+  count_allocation();
+  void *result = std::malloc(size ? size : 1);
+  if (result == nullptr) {
+    std::abort();
+  }
+  return result;
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+#endif
+
+u64 Allocation::count() {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+u64 Allocation::get_peak_rss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) < 0) {
+    return 0;
+  }
+#if defined __APPLE__
+  // reported in bytes rather than kilobytes
+  return u64(usage.ru_maxrss) / 1024;
+#else
+  return u64(usage.ru_maxrss);
+#endif
+}
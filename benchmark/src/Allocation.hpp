@@ -0,0 +1,21 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_BENCHMARK_ALLOCATION_HPP
+#define CLOUDAPI_BENCHMARK_ALLOCATION_HPP
+
+#include <sdk/types.h>
+
+namespace benchmark {
+
+class Allocation {
+public:
+  // calls to malloc(), calloc(), realloc() and operator new so far
+  static u64 count();
+
+  // the peak resident set size of the process in kilobytes
+  static u64 get_peak_rss();
+};
+
+} // namespace benchmark
+
+#endif // CLOUDAPI_BENCHMARK_ALLOCATION_HPP
@@ -0,0 +1,353 @@
+
+#include <chrono>
+
+#include <json/JsonDocument.hpp>
+#include <test/Test.hpp>
+
+#include "Allocation.hpp"
+#include "LoadGenerator.hpp"
+#include "cloud.hpp"
+
+using namespace var;
+using namespace printer;
+using namespace json;
+using namespace cloud;
+
+/*
+ * Times converting synthetic documents between plain JSON and the
+ * Firestore format. Nothing is sent over the network.
+ *
+ * Run with --performance. Each row reports the time per field (every
+ * member and array element counts as a field) and the allocations per
+ * document.
+ *
+ * Run with --stress to load the clients from several threads against an
+ * in-process Emulator. Each row reports the p50 and p99 latency and the
+ * operations per second, with and without simulated server latency. The
+ * requests lease connections from the cloud's ConnectionPool, so threads
+ * wait for a connection as they would on the network, but TLS and the
+ * network itself are not part of the numbers.
+ */
+class Benchmark : public test::Test {
+public:
+  Benchmark(var::StringView name) : test::Test(name) {}
+
+  bool execute_class_performance_case() {
+    for (const auto &shape : shape_list) {
+      TEST_ASSERT_RESULT(shape_case(shape));
+    }
+    printer().key("peakRss", get_peak_rss());
+    return true;
+  }
+
+  bool execute_class_stress_case() {
+    Emulator emulator;
+    Cloud cloud("emulator");
+    cloud.set_emulator(&emulator);
+    TEST_ASSERT(cloud.login("load@example.com", "password").is_success());
+    printer().key(
+      "maxConnectionsPerHost",
+      NumberString(cloud.connection_pool().max_connections_per_host()));
+
+    for (const auto latency : {chrono::MicroTime(0), 2_milliseconds}) {
+      emulator.set_latency(latency);
+      Printer::Object po(
+        printer(),
+        String().format("latency%luus", (unsigned long)latency.microseconds()));
+      TEST_ASSERT_RESULT(load_case(cloud));
+    }
+    return true;
+  }
+
+private:
+  static constexpr u32 load_thread_count = 8;
+  static constexpr u32 load_iteration_count = 100;
+
+  struct Shape {
+    const char *name;
+    u32 field_count;
+    // maps inside maps
+    u32 depth;
+    // 0 for no arrays
+    u32 array_length;
+    u32 iterations;
+  };
+
+  static constexpr Shape shape_list[] = {
+    {"flatSmall", 8, 0, 0, 2000},
+    {"flatLarge", 256, 0, 0, 100},
+    {"nested", 16, 4, 0, 50},
+    {"arrays", 16, 0, 32, 200},
+    {"mixed", 32, 2, 8, 100}};
+
+  struct Result {
+    u64 nanoseconds;
+    u64 allocation_count;
+  };
+
+  bool shape_case(const Shape &shape) {
+    Printer::Object po(printer(), shape.name);
+
+    JsonObject document;
+    const u32 field_count = add_fields(document, shape, 0);
+    const auto json = JsonDocument()
+                        .set_flags(JsonDocument::Flags::compact)
+                        .to_string(document);
+    const auto cloud_map = CloudMap::from_json(document);
+    const auto encoded = CloudMapEncoder::encode(document);
+
+    // the stream converters must agree with each other
+    TEST_ASSERT(CloudMapDecoder::decode(encoded).string_view() == json);
+
+    printer()
+      .key("fields", NumberString(field_count))
+      .key("jsonSize", NumberString(json.length()));
+
+    report(
+      "fromJson",
+      shape,
+      field_count,
+      measure(shape.iterations, [&]() { CloudMap::from_json(document); }));
+
+    report(
+      "toJson",
+      shape,
+      field_count,
+      measure(shape.iterations, [&]() { CloudMap(cloud_map).to_json(); }));
+
+    report(
+      "jsonDocument",
+      shape,
+      field_count,
+      measure(shape.iterations, [&]() {
+        JsonDocument()
+          .set_flags(JsonDocument::Flags::compact)
+          .to_string(document);
+      }));
+
+    report(
+      "encoder",
+      shape,
+      field_count,
+      measure(shape.iterations, [&]() { CloudMapEncoder::encode(document); }));
+
+    report(
+      "decoder",
+      shape,
+      field_count,
+      measure(shape.iterations, [&]() {
+        CloudMapDecoder::decode(encoded.string_view());
+      }));
+
+    printer().key("peakRss", get_peak_rss());
+
+    return true;
+  }
+
+  bool load_case(const Cloud &cloud) {
+    const LoadGenerator generator(load_thread_count, load_iteration_count);
+    const auto document = JsonObject()
+                            .insert("name", JsonString("load"))
+                            .insert("count", JsonInteger(10))
+                            .insert("isActive", JsonTrue());
+    const String payload(StringView(
+      "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"));
+
+    report_load(
+      "databasePatch",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        return Database(cloud, "load")
+          .patch_object(
+            get_load_path("items", thread_index, iteration),
+            document)
+          .is_success();
+      }));
+
+    report_load(
+      "databaseGet",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        Database database(cloud, "load");
+        const auto value = database.get_value(
+          get_load_path("items", thread_index, iteration));
+        return database.is_success() && value.is_object();
+      }));
+
+    report_load(
+      "storeCreate",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        Store store(cloud, "load");
+        const auto id = store.create_document(
+          "items",
+          document,
+          get_load_id(thread_index, iteration));
+        return store.is_success() && !id.is_empty();
+      }));
+
+    report_load(
+      "storeGet",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        Store store(cloud, "load");
+        const auto value = store.get_document(
+          get_load_path("items", thread_index, iteration));
+        return store.is_success() && value.at("name").is_string();
+      }));
+
+    report_load(
+      "storePatch",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        return Store(cloud, "load")
+          .patch_document(
+            get_load_path("items", thread_index, iteration),
+            JsonObject().insert("count", JsonInteger(iteration)))
+          .is_success();
+      }));
+
+    report_load(
+      "storeQuery",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        MCU_UNUSED_ARGUMENT(thread_index);
+        u32 count = 0;
+        Query query("items");
+        query.where("count", Query::Operator::equal, JsonInteger(iteration))
+          .set_limit(load_thread_count);
+        Store store(cloud, "load");
+        store.run_query(query, [&](StringView, const JsonValue &) {
+          count++;
+          return 0;
+        });
+        return store.is_success() && count == load_thread_count;
+      }));
+
+    report_load(
+      "storageCreate",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        return Storage(cloud, "load")
+          .create_object(
+            get_load_path("objects", thread_index, iteration),
+            fs::ViewFile(View(payload)))
+          .is_success();
+      }));
+
+    report_load(
+      "storageGet",
+      generator.run([&](u32 thread_index, u32 iteration) {
+        fs::DataFile destination;
+        Storage storage(cloud, "load");
+        storage.get_object(
+          get_load_path("objects", thread_index, iteration),
+          destination);
+        return storage.is_success()
+               && destination.data().size() == payload.length();
+      }));
+
+    return true;
+  }
+
+  static String get_load_id(u32 thread_index, u32 iteration) {
+    return String().format("t%ui%u", thread_index, iteration);
+  }
+
+  static String
+  get_load_path(StringView root, u32 thread_index, u32 iteration) {
+    return String(root) + "/" + get_load_id(thread_index, iteration);
+  }
+
+  void report_load(StringView name, const LoadGenerator::Result &result) {
+    printer().key(
+      name,
+      String().format(
+        "p50:%.1fus p99:%.1fus %.0fops/s errors:%u",
+        result.p50_nanoseconds / 1000.0,
+        result.p99_nanoseconds / 1000.0,
+        result.operations_per_second,
+        result.error_count));
+  }
+
+  static String get_peak_rss() {
+    return String().format(
+      "%lluKB",
+      static_cast<unsigned long long>(Allocation::get_peak_rss()));
+  }
+
+  template <typename Function>
+  static Result measure(u32 iterations, Function function) {
+    const u64 start_count = Allocation::count();
+    const auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < iterations; i++) {
+      function();
+    }
+    const auto stop = std::chrono::steady_clock::now();
+    return Result{
+      u64(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+          .count()),
+      Allocation::count() - start_count};
+  }
+
+  void report(
+    var::StringView name,
+    const Shape &shape,
+    u32 field_count,
+    const Result &result) {
+    printer().key(
+      name,
+      String().format(
+        "%.1fns/field %.1fallocations/document",
+        double(result.nanoseconds) / (double(shape.iterations) * field_count),
+        double(result.allocation_count) / shape.iterations));
+  }
+
+  // returns the number of values added, including nested ones
+  static u32 add_fields(JsonObject &object, const Shape &shape, u32 depth) {
+    u32 result = 0;
+    for (u32 i = 0; i < shape.field_count; i++) {
+      const auto key = String().format("field%u", i);
+      result++;
+      switch (i % 8) {
+      case 0:
+        object.insert(key, JsonString("value"));
+        break;
+      case 1:
+        object.insert(key, JsonInteger(i * 1000));
+        break;
+      case 2:
+        // exact in a float so the text round trips
+        object.insert(key, JsonReal(i + 0.5f));
+        break;
+      case 3:
+        if (shape.array_length) {
+          JsonArray array;
+          for (u32 j = 0; j < shape.array_length; j++) {
+            array.append(JsonInteger(j));
+          }
+          object.insert(key, array);
+          result += shape.array_length;
+        } else {
+          object.insert(key, JsonTrue());
+        }
+        break;
+      case 4:
+        object.insert(key, JsonFalse());
+        break;
+      case 5:
+        object.insert(key, JsonNull());
+        break;
+      case 6:
+        object.insert(
+          key,
+          JsonString("a longer string value with \"quotes\" and a\nnewline"));
+        break;
+      default:
+        if (depth < shape.depth) {
+          JsonObject child;
+          result += add_fields(child, shape, depth + 1);
+          object.insert(key, child);
+        } else {
+          object.insert(key, JsonInteger(-1));
+        }
+        break;
+      }
+    }
+    return result;
+  }
+};
@@ -0,0 +1,114 @@
+
+#ifndef LOAD_GENERATOR_HPP
+#define LOAD_GENERATOR_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <thread/Thread.hpp>
+#include <var/Vector.hpp>
+
+/*
+ * Calls an operation iteration_count times on each of thread_count threads
+ * and collects the latency of every call. The operation creates its own
+ * clients so nothing is shared between threads except the cloud.
+ */
+class LoadGenerator {
+public:
+  // returns false if the operation failed
+  using Operation = std::function<bool(u32 thread_index, u32 iteration)>;
+
+  struct Result {
+    u64 p50_nanoseconds;
+    u64 p99_nanoseconds;
+    double operations_per_second;
+    u32 error_count;
+  };
+
+  LoadGenerator(u32 thread_count, u32 iteration_count)
+    : m_thread_count(thread_count), m_iteration_count(iteration_count) {}
+
+  Result run(const Operation &operation) const {
+    std::vector<Worker> worker_list(m_thread_count);
+    var::Vector<std::unique_ptr<thread::Thread>> thread_list;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < m_thread_count; i++) {
+      auto &worker = worker_list.at(i);
+      worker.operation = &operation;
+      worker.thread_index = i;
+      worker.iteration_count = m_iteration_count;
+      thread_list.push_back(std::make_unique<thread::Thread>(
+        thread::Thread::Attributes()
+          .set_detach_state(thread::Thread::DetachState::joinable)
+          .set_stack_size(65536),
+        thread::Thread::Construct().set_argument(&worker).set_function(
+          work_function)));
+    }
+
+    for (auto &thread : thread_list) {
+      thread->join();
+    }
+    const auto stop = std::chrono::steady_clock::now();
+
+    var::Vector<u64> latency_list;
+    u32 error_count = 0;
+    for (const auto &worker : worker_list) {
+      for (const auto latency : worker.latency_list) {
+        latency_list.push_back(latency);
+      }
+      error_count += worker.error_count;
+    }
+    std::sort(latency_list.begin(), latency_list.end());
+
+    const double seconds
+      = std::chrono::duration<double>(stop - start).count();
+    return Result{
+      get_percentile(latency_list, 50),
+      get_percentile(latency_list, 99),
+      seconds > 0.0 ? latency_list.count() / seconds : 0.0,
+      error_count};
+  }
+
+private:
+  struct Worker {
+    const Operation *operation = nullptr;
+    u32 thread_index = 0;
+    u32 iteration_count = 0;
+    var::Vector<u64> latency_list;
+    u32 error_count = 0;
+  };
+
+  u32 m_thread_count;
+  u32 m_iteration_count;
+
+  static void *work_function(void *args) {
+    auto *worker = reinterpret_cast<Worker *>(args);
+    for (u32 i = 0; i < worker->iteration_count; i++) {
+      const auto start = std::chrono::steady_clock::now();
+      const bool is_success = (*worker->operation)(worker->thread_index, i);
+      const auto stop = std::chrono::steady_clock::now();
+      worker->latency_list.push_back(u64(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+          .count()));
+      if (!is_success) {
+        // errors are per thread, clear it so the next call runs
+        worker->error_count++;
+        API_RESET_ERROR();
+      }
+    }
+    return nullptr;
+  }
+
+  static u64 get_percentile(const var::Vector<u64> &sorted, u32 percentile) {
+    if (sorted.count() == 0) {
+      return 0;
+    }
+    return sorted.at((sorted.count() - 1) * percentile / 100);
+  }
+};
+
+#endif // LOAD_GENERATOR_HPP
@@ -7,9 +7,27 @@ namespace cloud{}
 
 #include "cloud/Cloud.hpp"
 #include "cloud/Database.hpp"
+#include "cloud/DatabaseMirror.hpp"
+#include "cloud/DocumentSchema.hpp"
 #include "cloud/Store.hpp"
 #include "cloud/Storage.hpp"
+#include "cloud/StorageSync.hpp"
 #include "cloud/CloudAccess.hpp"
+#include "cloud/Base64.hpp"
+#include "cloud/Checksum.hpp"
+#include "cloud/CloudMapStream.hpp"
+#include "cloud/ConnectionPool.hpp"
+#include "cloud/EventStream.hpp"
+#include "cloud/JsonStream.hpp"
+#include "cloud/MappedFile.hpp"
+#include "cloud/MetadataCache.hpp"
+#include "cloud/Query.hpp"
+#include "cloud/TransferManager.hpp"
+#include "cloud/WorkerPool.hpp"
+
+#if CLOUD_API_IS_EMULATOR
+#include "cloud/Emulator.hpp"
+#endif
 
 using namespace cloud;
 
@@ -0,0 +1,68 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_BASE64_HPP
+#define CLOUDAPI_CLOUD_BASE64_HPP
+
+#include <sdk/types.h>
+
+#include <var/Data.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/View.hpp>
+
+namespace cloud {
+
+/*! \brief Base64 Codec Class
+ *
+ * \details The codec converts between binary data and standard (RFC 4648)
+ * base64 text. It reads from a `var::View` and writes directly to the
+ * destination, so no intermediate `String` or `Data` is created.
+ *
+ * Input is processed in 12 byte (16 character) blocks with table lookups
+ * so the loop has no data dependent branches.
+ *
+ */
+class Base64Codec {
+public:
+  static constexpr size_t get_encoded_size(size_t size) {
+    return (size + 2) / 3 * 4;
+  }
+
+  // the maximum number of bytes decoded from length characters
+  static constexpr size_t get_decoded_size(size_t length) {
+    return (length + 3) / 4 * 3;
+  }
+
+  // writes get_encoded_size(input.size()) characters to output
+  static size_t encode(var::View input, char *output);
+
+  // appends the encoded input to output
+  static void encode(var::View input, var::String &output);
+
+  // returns the number of bytes written to output or -1 if input is invalid
+  static int decode(var::StringView input, void *output);
+
+  // replaces the contents of output, returns -1 if input is invalid
+  static int decode(var::StringView input, var::Data &output);
+
+  /*! \details The encoder converts a stream of chunks. Up to two bytes
+   * of a chunk are kept until the next chunk (or `finish()`) so that the
+   * output is the same as encoding the input in one call.
+   */
+  class Encoder {
+  public:
+    explicit Encoder(var::String &output) : m_output(&output) {}
+
+    Encoder &feed(var::View chunk);
+    Encoder &finish();
+
+  private:
+    var::String *m_output;
+    u8 m_pending[3];
+    u8 m_pending_size = 0;
+  };
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_BASE64_HPP
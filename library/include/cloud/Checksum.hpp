@@ -0,0 +1,72 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_CHECKSUM_HPP
+#define CLOUDAPI_CLOUD_CHECKSUM_HPP
+
+#include <sdk/types.h>
+
+#include <var/String.hpp>
+#include <var/View.hpp>
+
+namespace cloud {
+
+/*! \brief CRC32C Class
+ *
+ * \details The class calculates the CRC32C (Castagnoli) checksum that Cloud
+ * Storage keeps for every object. Data is fed in chunks as it is
+ * transferred, so the checksum costs no extra pass over the data.
+ *
+ * The SSE 4.2 and ARMv8 CRC32 instructions are used when the CPU has them.
+ * Otherwise eight bytes are processed per step with lookup tables.
+ *
+ */
+class Crc32c {
+public:
+  // continues from value, the checksum of the data before the next update()
+  explicit Crc32c(u32 value = 0) : m_state(~value) {}
+
+  Crc32c &update(var::View data);
+
+  API_NO_DISCARD u32 value() const { return ~m_state; }
+
+  // the big-endian value in base64, the format of the crc32c metadata
+  API_NO_DISCARD var::String to_base64() const;
+
+  API_NO_DISCARD static u32 calculate(var::View data) {
+    return Crc32c().update(data).value();
+  }
+
+  // the checksum of A followed by B from the checksums of A and B
+  API_NO_DISCARD static u32 combine(u32 first, u32 second, u64 second_size);
+
+private:
+  u32 m_state;
+};
+
+/*! \brief MD5 Class
+ *
+ * \details The class calculates the MD5 digest that Cloud Storage keeps
+ * for objects that are not composite. It is slower than `Crc32c`, so
+ * transfers only calculate it when asked to.
+ *
+ */
+class Md5 {
+public:
+  Md5();
+
+  Md5 &update(var::View data);
+
+  // the 16 byte digest of the data so far
+  API_NO_DISCARD var::String to_base64() const;
+
+private:
+  u32 m_state[4];
+  u64 m_size = 0;
+  u8 m_block[64];
+
+  static void process_block(u32 *state, const u8 *block);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_CHECKSUM_HPP
@@ -9,13 +9,20 @@
 #include <inet/Url.hpp>
 #include <json/Json.hpp>
 #include <thread/Mutex.hpp>
+#include <var/Data.hpp>
 #include <var/String.hpp>
 #include <var/Vector.hpp>
 
 #include "CloudObject.hpp"
+#include "ConnectionPool.hpp"
+#include "JsonStream.hpp"
+#include "WorkerPool.hpp"
 
 namespace cloud {
 
+// built with CLOUD_API_IS_EMULATOR (see Emulator.hpp)
+class Emulator;
+
 class CloudMap : public json::JsonObject {
 public:
   // constructs an existing cloud map
@@ -23,10 +30,30 @@ public:
 
   // imports regular old JSON to the cloud map
   static CloudMap from_json(const json::JsonObject &input);
+  // imports a single value, for example {"integerValue": "5"}
+  static json::JsonObject from_json_value(const json::JsonValue &input);
   // exports to regular old JSON
   json::JsonObject to_json();
 
+  /*
+   * Firestore types without a plain JSON equivalent are written as
+   * single key objects, for example {"timestampValue": "..."}. They are
+   * imported and exported as they are, so they can be mixed with regular
+   * JSON values.
+   */
+  static json::JsonObject create_timestamp(var::StringView rfc3339);
+  static json::JsonObject create_timestamp(const chrono::DateTime &value);
+  static json::JsonObject create_bytes(var::View data);
+  // for example "projects/{project_id}/databases/(default)/documents/a/b"
+  static json::JsonObject create_reference(var::StringView document_name);
+  static json::JsonObject create_geo_point(double latitude, double longitude);
+
+  // decodes a {"bytesValue": "..."} value
+  static var::Data get_bytes(const json::JsonValue &value);
+
 private:
+  static bool is_typed_value(const json::JsonValue &value);
+
   static int import_json_recursive(
     json::JsonObject *object,
     json::JsonArray *array,
@@ -175,27 +202,86 @@ public:
 
   class SecureClient : public CloudObject {
   public:
+    // async callbacks run on a worker thread, check is_success() for the result
+    using Callback = std::function<void()>;
+    using IdCallback = std::function<void(var::StringView id)>;
+    using JsonCallback = std::function<void(const json::JsonValue &value)>;
+
+    SecureClient(
+      const Cloud &cloud,
+      const var::StringView database_project,
+      const var::StringView host = var::StringView())
+      : m_cloud(cloud), m_database_project(database_project), m_host(host) {}
+
+    virtual ~SecureClient() = default;
+
+    // checks out a connection to host() from the cloud connection pool
+    ConnectionPool::Lease checkout() const {
+      return m_cloud.connection_pool().checkout(host());
+    }
 
-    SecureClient(const Cloud & cloud, const var::StringView database_project) : m_cloud(cloud), m_database_project(database_project){}
+    // requests are handled by the emulator of the cloud
+    API_NO_DISCARD bool is_emulated() const {
+      return m_cloud.connection_pool().is_emulated();
+    }
 
-    inet::HttpSecureClient &client() { return m_client; }
-    const inet::HttpSecureClient &client() const { return m_client; }
-    const thread::Mutex &mutex() const { return m_mutex; }
-    thread::Mutex &mutex() { return m_mutex; }
-    void assign_error_from_status();
+    void assign_error_from_status(const inet::Http &http);
+    void assign_error_from_status(inet::Http::Status status);
+    // uses the message of an error response body ({"error":{"message":...}})
+    // if there is one
+    void assign_error_from_status(
+      inet::Http::Status status,
+      var::StringView response_body);
+
+    API_NO_DISCARD static bool is_success(inet::Http::Status status) {
+      // for example 201 (created) and 204 (no content)
+      return int(status) >= 200 && int(status) < 300;
+    }
+
+    const Cloud &cloud() const { return m_cloud; }
 
     const Credentials & credentials() const { return m_cloud.credentials(); }
 
-    const inet::HttpSecureClient &http_client() const {
-      return m_client;
+    var::String traffic() const {
+      thread::Mutex::Scope m_scope(m_mutex);
+      return m_traffic;
     }
 
-    inet::HttpSecureClient &http_client(){
-      return m_client;
-    }
+    SecureClient &execute(
+      ConnectionPool::Lease &connection,
+      inet::Http::Method method,
+      var::StringView url,
+      const inet::HttpClient::ExecuteMethod &options);
+
+    // returns the status rather than assigning an error for it (transport
+    // errors are still assigned)
+    inet::Http::Status execute_request(
+      ConnectionPool::Lease &connection,
+      inet::Http::Method method,
+      var::StringView url,
+      const inet::HttpClient::ExecuteMethod &options);
 
-    const var::String & traffic() const {
-      return http_client().traffic();
+    // adds a header field to the next request on connection
+    SecureClient &add_header_field(
+      ConnectionPool::Lease &connection,
+      var::StringView key,
+      var::StringView value);
+
+    // a header field of the last response on connection
+    API_NO_DISCARD var::String
+    get_header_field(ConnectionPool::Lease &connection, var::StringView key);
+
+    // the status of the response on connection, it is known once the body
+    // is received, so a response file can check it as data arrives
+    API_NO_DISCARD inet::Http::Status
+    get_status(ConnectionPool::Lease &connection);
+
+    SecureClient &execute(
+      inet::Http::Method method,
+      var::StringView url,
+      const inet::HttpClient::ExecuteMethod &options) {
+      auto connection = checkout();
+      return execute(connection, method, url, options);
     }
 
     json::JsonValue execute_method(
@@ -208,6 +294,13 @@ public:
       var::StringView url,
       var::StringView request);
 
+    // parses the response as it arrives and passes it to handler
+    SecureClient &execute_method(
+      inet::Http::Method method,
+      var::StringView url,
+      var::StringView request,
+      JsonHandler &handler);
+
     json::JsonValue
     execute_get_json(var::StringView url);
 
@@ -215,18 +308,41 @@ public:
       return m_database_project.string_view();
     }
 
+    // the host after any Cloud::set_host() override
+    var::StringView host() const { return m_cloud.get_host(default_host()); }
+
+    var::StringView default_host() const { return m_host.string_view(); }
+
   protected:
 
     void interface_set_project_id(const var::StringView a){
       m_database_project = a;
     }
 
+    void interface_set_host(const var::StringView a) { m_host = a; }
+
+    // adds the header fields needed for each request to this host
+    virtual void interface_add_header_fields(inet::Http &http) const {
+      MCU_UNUSED_ARGUMENT(http);
+    }
+
+    // runs the task on the worker pool (or immediately if there isn't one)
+    void submit(WorkerPool::Task task) {
+      if (worker_pool() == nullptr) {
+        task();
+        return;
+      }
+      worker_pool()->submit(std::move(task));
+    }
+
   private:
     const Cloud & m_cloud;
-    thread::Mutex m_mutex;
-    inet::HttpSecureClient m_client;
+    mutable thread::Mutex m_mutex;
     var::PathString m_database_project;
+    var::PathString m_host;
+    var::String m_traffic;
     API_ACCESS_STRING(SecureClient, error_string);
+    API_ACCESS_FUNDAMENTAL(SecureClient, WorkerPool *, worker_pool, nullptr);
 
   };
 
@@ -243,12 +359,42 @@ public:
   Cloud &login(var::StringView email, var::StringView password);
   Cloud &refresh_login();
 
+  // connections are shared by every client that uses this cloud
+  ConnectionPool &connection_pool() const { return m_connection_pool; }
+
+  // clients connect to host instead of default_host, for example
+  // cloud.set_host("firestore.googleapis.com", "localhost:8080"); set hosts
+  // before the clients make requests
+  Cloud &set_host(var::StringView default_host, var::StringView host);
+  API_NO_DISCARD var::StringView get_host(var::StringView default_host) const;
+
+#if CLOUD_API_IS_EMULATOR
+  // requests are handled by the emulator instead of being sent, they still
+  // lease (unconnected) connections from connection_pool()
+  Cloud &set_emulator(Emulator *value) {
+    m_emulator = value;
+    m_connection_pool.set_emulated(value != nullptr);
+    return *this;
+  }
+  API_NO_DISCARD Emulator *emulator() const { return m_emulator; }
+#endif
 
 private:
   API_ACCESS_FUNDAMENTAL(Cloud, u32, ticket_lifetime, 0);
   API_ACCESS_COMPOUND(Cloud, Cloud::Credentials, credentials);
   API_ACCESS_COMPOUND(Cloud, var::PathString, api_key);
   API_ACCESS_STRING(Cloud, traffic);
+  // declared in every build so the size of Cloud does not depend on
+  // CLOUD_API_IS_EMULATOR (it is only used when that is set)
+  [[maybe_unused]] Emulator *m_emulator = nullptr;
+
+  struct HostOverride {
+    var::PathString default_host;
+    var::PathString host;
+  };
+
+  mutable ConnectionPool m_connection_pool;
+  var::Vector<HostOverride> m_host_list;
 
   API_NO_DISCARD static var::StringView identity_host() { return "www.googleapis.com"; }
   API_NO_DISCARD static var::StringView refresh_login_host() {
@@ -12,11 +12,21 @@ class CloudService : public CloudObject {
   Database m_database;
   Storage m_storage;
   Store m_store;
+  // declared last so queued tasks finish before the clients are destroyed
+  WorkerPool m_worker_pool;
 
 public:
-  CloudService(const var::StringView api_key, const var::StringView project)
+  CloudService(
+    const var::StringView api_key,
+    const var::StringView project,
+    const WorkerPool::Construct &worker_options = WorkerPool::Construct())
     : m_cloud(api_key, 0), m_database(m_cloud, project),
-      m_storage(m_cloud, project), m_store(m_cloud, project) {}
+      m_storage(m_cloud, project), m_store(m_cloud, project),
+      m_worker_pool(worker_options) {
+    m_database.set_worker_pool(&m_worker_pool);
+    m_storage.set_worker_pool(&m_worker_pool);
+    m_store.set_worker_pool(&m_worker_pool);
+  }
 
   const Database &database() const { return m_database; }
   Database &database() { return m_database; }
@@ -29,6 +39,9 @@ public:
 
   const Cloud &cloud() const { return m_cloud; }
   Cloud &cloud() { return m_cloud; }
+
+  const WorkerPool &worker_pool() const { return m_worker_pool; }
+  WorkerPool &worker_pool() { return m_worker_pool; }
 };
 
 class CloudAccess : public CloudObject {
@@ -0,0 +1,165 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_CLOUDMAPSTREAM_HPP
+#define CLOUDAPI_CLOUD_CLOUDMAPSTREAM_HPP
+
+#include <json/Json.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+
+#include "JsonStream.hpp"
+
+namespace cloud {
+
+/*! \brief Cloud Map Encoder Class
+ *
+ * \details The encoder is a `JsonHandler` that converts plain JSON events
+ * to Cloud Firestore document events and passes them to another handler.
+ * Together with `JsonStreamParser` and `JsonWriter`, it converts JSON text
+ * to the Firestore format in one pass without building a `CloudMap`.
+ *
+ * ```cpp
+ * // {"fields":{"name":{"stringValue":"tyler"}}}
+ * String document = CloudMapEncoder::encode(R"({"name":"tyler"})");
+ * ```
+ *
+ * The input must be an object. Arrays inside arrays are not supported by
+ * Firestore and stop the encoder.
+ *
+ * An object with the one key `timestampValue`, `bytesValue`,
+ * `referenceValue` or `geoPointValue` is written as that Firestore type
+ * rather than as a map. With other keys it is an ordinary map, as in
+ * `CloudMap::is_typed_value()`.
+ *
+ * ```cpp
+ * // {"fields":{"created":{"timestampValue":"2021-01-01T00:00:00Z"}}}
+ * CloudMapEncoder::encode(
+ *   R"({"created":{"timestampValue":"2021-01-01T00:00:00Z"}})");
+ * ```
+ *
+ */
+class CloudMapEncoder : public JsonHandler {
+public:
+  explicit CloudMapEncoder(JsonHandler &output) : m_output(&output) {}
+
+  // returns an empty string if the input is not a valid JSON object
+  static var::String encode(var::StringView json);
+  static var::String encode(const json::JsonObject &object);
+
+  int begin_object() override;
+  int end_object() override;
+  int begin_array() override;
+  int end_array() override;
+  int key(var::StringView key) override;
+  int string(var::StringView value) override;
+  int number(var::StringView value) override;
+  int boolean(bool value) override;
+  int null() override;
+
+private:
+  enum class Container : u8 {
+    object,
+    array,
+    // an object before its first key
+    pending,
+    // timestamp, bytes, reference or geo point, until a second key shows
+    // that it is a map
+    typed,
+    // inside a typed value
+    raw
+  };
+
+  JsonHandler *m_output;
+  var::Vector<Container> m_stack;
+  // the key and value of a typed container are held until it ends
+  var::String m_typed_key;
+  var::String m_typed_value;
+  JsonWriter m_typed_writer{m_typed_value};
+
+  bool is_raw() const;
+  JsonHandler *raw_output();
+  int end_typed_value();
+  int begin_typed_map();
+  int begin_typed_value(var::StringView type);
+  int begin_map();
+};
+
+/*! \brief Cloud Map Decoder Class
+ *
+ * \details The decoder is a `JsonHandler` that converts the events of a
+ * Cloud Firestore document (as returned by the REST API) to plain JSON
+ * events and passes them to another handler. Members other than `fields`
+ * (such as `name` and `updateTime`) are skipped.
+ *
+ * Value types are found by comparing the type key as it is parsed, so no
+ * memory is allocated per field. Timestamp, bytes, reference and geo point
+ * values are kept in their typed form (for example
+ * `{"timestampValue":"2021-01-01T00:00:00Z"}`) so that encoding the output
+ * again gives the same document.
+ *
+ * ```cpp
+ * JsonTreeBuilder builder;
+ * CloudMapDecoder decoder(builder);
+ * store.get_document("projects/abc", decoder);
+ * JsonObject project = builder.value().to_object();
+ * ```
+ *
+ */
+class CloudMapDecoder : public JsonHandler {
+public:
+  explicit CloudMapDecoder(JsonHandler &output) : m_output(&output) {}
+
+  // returns an empty string if the input is not a valid document
+  static var::String decode(var::StringView document);
+
+  int begin_object() override;
+  int end_object() override;
+  int begin_array() override;
+  int end_array() override;
+  int key(var::StringView key) override;
+  int string(var::StringView value) override;
+  int number(var::StringView value) override;
+  int boolean(bool value) override;
+  int null() override;
+
+private:
+  enum class Frame : u8 {
+    skip,
+    document,
+    fields,
+    value,
+    map_value,
+    array_value,
+    values,
+    typed_value,
+    pass_through
+  };
+
+  enum class Type : u8 {
+    unknown,
+    string,
+    integer,
+    real,
+    boolean,
+    null,
+    map,
+    array,
+    typed
+  };
+
+  JsonHandler *m_output;
+  var::Vector<Frame> m_stack;
+  Type m_type = Type::unknown;
+  // the last key of a document, map or array value was the one to keep
+  bool m_is_member_wanted = false;
+
+  static Type get_type(var::StringView key);
+  bool is_pass_through() const;
+  int push_object();
+  int scalar(Type type);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_CLOUDMAPSTREAM_HPP
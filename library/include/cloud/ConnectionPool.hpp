@@ -0,0 +1,150 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_CONNECTIONPOOL_HPP
+#define CLOUDAPI_CLOUD_CONNECTIONPOOL_HPP
+
+#include <memory>
+
+#include <chrono/ClockTimer.hpp>
+#include <chrono/MicroTime.hpp>
+#include <inet/Http.hpp>
+#include <thread/Cond.hpp>
+#include <thread/Mutex.hpp>
+#include <var/StackString.hpp>
+#include <var/String.hpp>
+#include <var/Vector.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief Connection Pool Class
+ *
+ * \details The connection pool keeps a bounded number of keep-alive
+ * TLS connections for each host. Clients check out a connection for the
+ * duration of a request and check it back in when the request completes.
+ *
+ * If all connections for a host are checked out and `max_connections_per_host`
+ * has been reached, `checkout()` blocks until another thread checks in a
+ * connection. Idle connections are closed once they have been idle for longer
+ * than `idle_timeout`.
+ *
+ * When the cloud uses an emulator, the pool is `emulated`. Connections are
+ * leased and limited in the same way but they are never connected.
+ *
+ */
+class ConnectionPool : public CloudObject {
+public:
+  class Connection {
+  public:
+    explicit Connection(var::StringView host) : m_host(host) {}
+
+    inet::HttpSecureClient &client() { return m_client; }
+    const inet::HttpSecureClient &client() const { return m_client; }
+
+    var::StringView host() const { return m_host.string_view(); }
+
+  private:
+    friend ConnectionPool;
+    var::PathString m_host;
+    inet::HttpSecureClient m_client;
+    chrono::ClockTimer m_idle_timer;
+    bool m_is_checked_out = false;
+    bool m_is_reusable = true;
+  };
+
+  /*! \details A lease is a checked out connection.
+   *
+   * The connection is checked back in to the pool when the lease is
+   * destroyed or `release()` is called.
+   *
+   */
+  class Lease {
+  public:
+    Lease() = default;
+    Lease(ConnectionPool &pool, Connection *connection)
+      : m_pool(&pool), m_connection(connection) {}
+
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+
+    Lease(Lease &&a) noexcept { swap(a); }
+    Lease &operator=(Lease &&a) noexcept {
+      swap(a);
+      return *this;
+    }
+
+    ~Lease() { release(); }
+
+    bool is_valid() const { return m_connection != nullptr; }
+
+    inet::HttpSecureClient &client() {
+      API_ASSERT(m_connection != nullptr);
+      return m_connection->client();
+    }
+
+    // the connection is closed rather than reused when checked in
+    Lease &discard() {
+      if (m_connection) {
+        m_connection->m_is_reusable = false;
+      }
+      return *this;
+    }
+
+    void release();
+
+    // an emulated request keeps the request header fields and then the
+    // response header fields here
+    var::String &header_fields() { return m_header_fields; }
+    // and the response status here
+    inet::Http::Status &status() { return m_status; }
+
+  private:
+    ConnectionPool *m_pool = nullptr;
+    Connection *m_connection = nullptr;
+    var::String m_header_fields;
+    inet::Http::Status m_status = inet::Http::Status::null;
+
+    void swap(Lease &a) {
+      std::swap(m_pool, a.m_pool);
+      std::swap(m_connection, a.m_connection);
+      std::swap(m_header_fields, a.m_header_fields);
+      std::swap(m_status, a.m_status);
+    }
+  };
+
+  ConnectionPool();
+
+  ConnectionPool(const ConnectionPool &) = delete;
+  ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+  Lease checkout(var::StringView host);
+
+  // closes connections that have been idle longer than idle_timeout()
+  ConnectionPool &evict_idle();
+
+  // closes all connections that are not checked out
+  ConnectionPool &clear();
+
+  API_NO_DISCARD size_t connection_count() const;
+  API_NO_DISCARD size_t connection_count(var::StringView host) const;
+
+private:
+  API_ACCESS_FUNDAMENTAL(ConnectionPool, u16, max_connections_per_host, 4);
+  API_ACCESS_COMPOUND(ConnectionPool, chrono::MicroTime, idle_timeout);
+  // set by Cloud::set_emulator(), connections are not connected
+  API_ACCESS_BOOL(ConnectionPool, emulated, false);
+
+  mutable thread::Mutex m_mutex;
+  thread::Cond m_cond;
+  var::Vector<std::unique_ptr<Connection>> m_connections;
+
+  void checkin(Connection *connection);
+  void remove_idle(bool is_all);
+  size_t count_for_host(var::StringView host) const;
+  bool is_open(const Connection &connection) const;
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_CONNECTIONPOOL_HPP
@@ -2,6 +2,7 @@
 #define CLOUDAPI_CLOUD_DATABASE_HPP
 
 #include "Cloud.hpp"
+#include "EventStream.hpp"
 
 namespace cloud {
 
@@ -12,6 +13,7 @@ public:
 
   Database& set_project_id(const var::StringView project){
     interface_set_project_id(project);
+    interface_set_host(database_host());
     return *this;
   }
 
@@ -33,14 +35,59 @@ public:
 
   Database &patch_object(var::StringView path, const json::JsonObject &object);
 
+  // asynchronous variants run on the CloudService worker pool
+  Database &get_value_async(
+    var::StringView path,
+    IsRequestShallow is_shallow,
+    JsonCallback callback);
+
+  Database &get_value_async(
+    var::StringView path,
+    const fs::FileObject &dest,
+    IsRequestShallow is_shallow,
+    Callback callback);
+
+  Database &remove_object_async(var::StringView path, Callback callback);
+
+  Database &create_object_async(
+    var::StringView path,
+    const json::JsonObject &object,
+    var::StringView id,
+    IdCallback callback);
+
+  Database &patch_object_async(
+    var::StringView path,
+    const json::JsonObject &object,
+    Callback callback);
+
   // realtime database operations
+  using Event = EventStreamParser::Event;
+  // return a negative value to stop listening
+  using EventCallback = std::function<int(const Event &event)>;
+
+  Database &listen(var::StringView path, EventCallback callback);
+
+  // the stream is read using client (connected to host() if it isn't yet),
+  // another thread can stop a blocked listen() by shutting down the socket
+  // of client
+  Database &listen(
+    var::StringView path,
+    inet::HttpSecureClient &client,
+    EventCallback callback);
+
+  // writes the data of each put and patch event to destination
   Database &listen(
     var::StringView path,
     const fs::FileObject &destination,
     thread::Mutex *lock_on_receive = nullptr);
 
+protected:
+  void interface_add_header_fields(inet::Http &http) const override {
+    http.add_header_field("Content-Type", "application/json");
+  }
+
 private:
-  var::PathString database_host() {
+  var::PathString database_host() const {
     return database_project() & ".firebaseio.com";
   }
 
@@ -49,13 +96,6 @@ private:
            (!credentials().get_token().is_empty() ?
                                                           ("?auth=" + credentials().get_token()) : var::String());
   }
-
-  void refresh_http_client_database_headers() {
-    http_client().add_header_field("Content-Type", "application/json");
-    if (!http_client().is_connected()) {
-      http_client().connect(database_host());
-    }
-  }
 };
 
 } // namespace cloud
@@ -0,0 +1,144 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_DATABASEMIRROR_HPP
+#define CLOUDAPI_CLOUD_DATABASEMIRROR_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include <chrono/MicroTime.hpp>
+#include <inet/Http.hpp>
+#include <thread/Cond.hpp>
+#include <thread/Mutex.hpp>
+#include <thread/Thread.hpp>
+
+#include "Database.hpp"
+
+namespace cloud {
+
+/*! \brief Database Mirror Class
+ *
+ * \details The database mirror keeps a local copy of a Realtime Database
+ * subtree. `start()` loads a snapshot using `Database::get_value()` and
+ * then applies the `put` and `patch` events from `Database::listen()` on a
+ * background thread.
+ *
+ * If the stream ends without `stop()`, for example because the connection
+ * dropped, the listener waits `reconnect_delay()`, loads a new snapshot
+ * and listens again. The new snapshot is passed to the change callbacks as
+ * a put at the root path. `is_stale()` is true until it has been loaded.
+ *
+ * Reads are served from memory. Any number of threads can read at the same
+ * time; they only wait while an event is being applied. `get_value()`
+ * copies the value so it can be kept, `read_value()` passes the value to a
+ * callback without copying it, which is cheaper for large subtrees.
+ *
+ * ```cpp
+ * DatabaseMirror mirror(database, "devices");
+ * mirror.start();
+ * JsonValue status = mirror.get_value("device0/status");
+ * mirror.read_value("", [](const JsonValue &devices) {
+ *   printer().object("devices", devices.to_object());
+ * });
+ * ```
+ *
+ */
+class DatabaseMirror : public CloudObject {
+public:
+  // path is relative to the mirrored subtree, value is null if removed
+  using ChangeCallback
+    = std::function<void(var::StringView path, const json::JsonValue &value)>;
+  // the value must not be modified or kept after the callback returns
+  using ValueCallback = std::function<void(const json::JsonValue &value)>;
+
+  DatabaseMirror(Database &database, var::StringView path);
+  ~DatabaseMirror();
+
+  DatabaseMirror(const DatabaseMirror &) = delete;
+  DatabaseMirror &operator=(const DatabaseMirror &) = delete;
+
+  DatabaseMirror &start();
+
+  // closes the listening connection and waits for the listener to finish
+  DatabaseMirror &stop();
+
+  // true until stop() is called, the listener reconnects if the stream ends
+  API_NO_DISCARD bool is_running() const { return m_is_running; }
+
+  // true while the listener is reconnecting: reads are served from the
+  // tree as it was when the stream ended
+  API_NO_DISCARD bool is_stale() const { return m_is_stale; }
+
+  // returns a copy of the value at path (relative to the mirrored subtree)
+  API_NO_DISCARD json::JsonValue get_value(var::StringView path = "") const;
+
+  // passes the value at path to callback while events wait (it is invalid
+  // if path does not exist)
+  const DatabaseMirror &
+  read_value(var::StringView path, const ValueCallback &callback) const;
+
+  // callbacks must be added before start()
+  DatabaseMirror &add_change_callback(ChangeCallback callback) {
+    m_change_callbacks.push_back(std::move(callback));
+    return *this;
+  }
+
+  // applies an event from Database::listen() to the local tree
+  int apply(const Database::Event &event);
+
+  DatabaseMirror &put(var::StringView path, const json::JsonValue &value);
+  DatabaseMirror &patch(var::StringView path, const json::JsonObject &value);
+
+private:
+  // the wait before the listener reconnects and loads a new snapshot
+  API_ACCESS_COMPOUND(DatabaseMirror, chrono::MicroTime, reconnect_delay);
+
+  class ReadScope {
+  public:
+    explicit ReadScope(const DatabaseMirror &mirror);
+    ~ReadScope();
+
+  private:
+    const DatabaseMirror &m_mirror;
+  };
+
+  class WriteScope {
+  public:
+    explicit WriteScope(DatabaseMirror &mirror);
+    ~WriteScope();
+
+  private:
+    DatabaseMirror &m_mirror;
+  };
+
+  Database *m_database;
+  var::PathString m_path;
+  json::JsonValue m_root;
+
+  mutable thread::Mutex m_mutex;
+  mutable thread::Cond m_cond;
+  mutable size_t m_reader_count = 0;
+  // readers wait for pending writers so events are not starved
+  size_t m_writer_wait_count = 0;
+  bool m_is_writing = false;
+
+  var::Vector<ChangeCallback> m_change_callbacks;
+  thread::Mutex m_client_mutex;
+  std::unique_ptr<inet::HttpSecureClient> m_client;
+  std::unique_ptr<thread::Thread> m_thread;
+  std::atomic<bool> m_is_running{false};
+  std::atomic<bool> m_is_stopping{false};
+  std::atomic<bool> m_is_stale{false};
+
+  static void *listen_function(void *args);
+  void reconnect();
+  json::JsonValue find_value(var::StringView path) const;
+  void set_value(var::StringView path, const json::JsonValue &value);
+  void notify(var::StringView path, const json::JsonValue &value);
+  static json::JsonValue copy_value(const json::JsonValue &value);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_DATABASEMIRROR_HPP
@@ -0,0 +1,565 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_DOCUMENTSCHEMA_HPP
+#define CLOUDAPI_CLOUD_DOCUMENTSCHEMA_HPP
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <var/Data.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+
+#include "Base64.hpp"
+#include "JsonStream.hpp"
+
+/*! \details Declares the members of a struct that are stored in a Cloud
+ * Firestore document. Use it in the namespace of the struct.
+ *
+ * ```cpp
+ * struct Project {
+ *   var::String name;
+ *   u32 version = 0;
+ *   var::Vector<var::String> tags;
+ * };
+ * CLOUD_DOCUMENT_FIELDS(Project, name, version, tags)
+ *
+ * store.create_document("projects", Project{"demo", 1, {}});
+ * ```
+ *
+ * Members can be `bool`, integers, floating point values, `var::String`,
+ * `var::Data` (stored as a `bytesValue`), `var::Vector` or `std::vector` of
+ * a supported type, or another struct with `CLOUD_DOCUMENT_FIELDS`. Up to
+ * 32 members can be listed.
+ *
+ */
+#define CLOUD_DOCUMENT_FIELDS(TYPE, ...)                                       \
+  inline constexpr auto cloud_document_fields(const TYPE *) {                  \
+    return std::make_tuple(                                                    \
+      CLOUD_DOCUMENT_FOR_EACH(CLOUD_DOCUMENT_FIELD, TYPE, __VA_ARGS__));       \
+  }
+
+#define CLOUD_DOCUMENT_FIELD(TYPE, MEMBER)                                     \
+  ::cloud::DocumentField<TYPE, decltype(TYPE::MEMBER)> { #MEMBER, &TYPE::MEMBER }
+
+#define CLOUD_DOCUMENT_EXPAND(x) x
+#define CLOUD_DOCUMENT_FOR_EACH_1(M, T, x) M(T, x)
+#define CLOUD_DOCUMENT_FOR_EACH_2(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_1(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_3(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_2(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_4(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_3(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_5(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_4(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_6(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_5(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_7(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_6(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_8(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_7(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_9(M, T, x, ...)                                \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_8(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_10(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_9(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_11(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_10(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_12(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_11(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_13(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_12(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_14(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_13(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_15(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_14(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_16(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_15(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_17(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_16(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_18(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_17(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_19(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_18(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_20(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_19(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_21(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_20(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_22(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_21(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_23(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_22(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_24(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_23(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_25(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_24(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_26(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_25(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_27(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_26(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_28(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_27(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_29(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_28(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_30(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_29(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_31(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_30(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_FOR_EACH_32(M, T, x, ...)                               \
+  M(T, x), CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_FOR_EACH_31(M, T, __VA_ARGS__))
+#define CLOUD_DOCUMENT_GET_FOR_EACH(                                           \
+  _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16,       \
+  _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31,   \
+  _32, NAME, ...)                                                              \
+  NAME
+#define CLOUD_DOCUMENT_FOR_EACH(M, T, ...)                                     \
+  CLOUD_DOCUMENT_EXPAND(CLOUD_DOCUMENT_GET_FOR_EACH(                           \
+    __VA_ARGS__, CLOUD_DOCUMENT_FOR_EACH_32, CLOUD_DOCUMENT_FOR_EACH_31,       \
+    CLOUD_DOCUMENT_FOR_EACH_30, CLOUD_DOCUMENT_FOR_EACH_29,                    \
+    CLOUD_DOCUMENT_FOR_EACH_28, CLOUD_DOCUMENT_FOR_EACH_27,                    \
+    CLOUD_DOCUMENT_FOR_EACH_26, CLOUD_DOCUMENT_FOR_EACH_25,                    \
+    CLOUD_DOCUMENT_FOR_EACH_24, CLOUD_DOCUMENT_FOR_EACH_23,                    \
+    CLOUD_DOCUMENT_FOR_EACH_22, CLOUD_DOCUMENT_FOR_EACH_21,                    \
+    CLOUD_DOCUMENT_FOR_EACH_20, CLOUD_DOCUMENT_FOR_EACH_19,                    \
+    CLOUD_DOCUMENT_FOR_EACH_18, CLOUD_DOCUMENT_FOR_EACH_17,                    \
+    CLOUD_DOCUMENT_FOR_EACH_16, CLOUD_DOCUMENT_FOR_EACH_15,                    \
+    CLOUD_DOCUMENT_FOR_EACH_14, CLOUD_DOCUMENT_FOR_EACH_13,                    \
+    CLOUD_DOCUMENT_FOR_EACH_12, CLOUD_DOCUMENT_FOR_EACH_11,                    \
+    CLOUD_DOCUMENT_FOR_EACH_10, CLOUD_DOCUMENT_FOR_EACH_9,                     \
+    CLOUD_DOCUMENT_FOR_EACH_8, CLOUD_DOCUMENT_FOR_EACH_7,                      \
+    CLOUD_DOCUMENT_FOR_EACH_6, CLOUD_DOCUMENT_FOR_EACH_5,                      \
+    CLOUD_DOCUMENT_FOR_EACH_4, CLOUD_DOCUMENT_FOR_EACH_3,                      \
+    CLOUD_DOCUMENT_FOR_EACH_2, CLOUD_DOCUMENT_FOR_EACH_1)                      \
+  (M, T, __VA_ARGS__))
+
+namespace cloud {
+
+template <typename Class, typename Member> struct DocumentField {
+  using type = Member;
+  const char *name;
+  Member Class::*member;
+};
+
+// true if T has CLOUD_DOCUMENT_FIELDS
+template <typename T, typename = void> struct is_document : std::false_type {};
+
+template <typename T>
+struct is_document<
+  T,
+  std::void_t<decltype(cloud_document_fields(static_cast<const T *>(nullptr)))>>
+  : std::true_type {};
+
+template <typename T> struct is_document_sequence : std::false_type {};
+template <typename T>
+struct is_document_sequence<var::Vector<T>> : std::true_type {
+  using element_type = T;
+};
+template <typename T>
+struct is_document_sequence<std::vector<T>> : std::true_type {
+  using element_type = T;
+};
+
+/*! \brief Document Value Sink Class
+ *
+ * \details A sink receives the plain JSON value of one member. Sinks for
+ * each member are created with the `DocumentSink` of the struct, so
+ * decoding does not allocate a sink per value. The values stored in the
+ * struct and the container stack of `DocumentSinkHandler` (one entry per
+ * nesting level) are allocated.
+ *
+ */
+class DocumentValueSink {
+public:
+  virtual ~DocumentValueSink() = default;
+  virtual int begin() { return 0; }
+  virtual int string(var::StringView) { return 0; }
+  virtual int number(var::StringView) { return 0; }
+  virtual int boolean(bool) { return 0; }
+  virtual int null() { return 0; }
+  // returns the sink for a member of an object or nullptr to skip it
+  virtual DocumentValueSink *member(var::StringView) { return nullptr; }
+  // returns the sink for the next element of an array
+  virtual DocumentValueSink *element() { return nullptr; }
+};
+
+template <typename T, typename Enable = void> class DocumentSink;
+
+template <typename T>
+class DocumentSink<T, std::enable_if_t<std::is_same<T, bool>::value>>
+  : public DocumentValueSink {
+public:
+  void set_target(T *value) { m_value = value; }
+  int boolean(bool value) override {
+    *m_value = value;
+    return 0;
+  }
+
+private:
+  T *m_value = nullptr;
+};
+
+template <typename T>
+class DocumentSink<
+  T,
+  std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>>
+  : public DocumentValueSink {
+public:
+  void set_target(T *value) { m_value = value; }
+  int number(var::StringView value) override { return set(value); }
+  // int64 values are strings unless they pass through CloudMapDecoder
+  int string(var::StringView value) override { return set(value); }
+
+private:
+  T *m_value = nullptr;
+
+  // returns -1 (with an error) if value is not an integer that fits in T
+  int set(var::StringView value) {
+    // the longest 64-bit integer has 20 digits and a sign
+    char buffer[32];
+    if (value.is_empty() || value.length() >= sizeof(buffer)) {
+      API_RETURN_VALUE_ASSIGN_ERROR(-1, "integer value is invalid", EINVAL);
+    }
+    ::memcpy(buffer, value.data(), value.length());
+    buffer[value.length()] = 0;
+
+    char *end = nullptr;
+    errno = 0;
+    bool is_in_range = false;
+    T result = 0;
+    if constexpr (std::is_signed<T>::value) {
+      const long long parsed = ::strtoll(buffer, &end, 10);
+      is_in_range
+        = errno != ERANGE
+          && parsed >= static_cast<long long>(std::numeric_limits<T>::min())
+          && parsed <= static_cast<long long>(std::numeric_limits<T>::max());
+      result = static_cast<T>(parsed);
+    } else {
+      const unsigned long long parsed = ::strtoull(buffer, &end, 10);
+      // strtoull() accepts a sign and negates the value
+      is_in_range = errno != ERANGE && buffer[0] != '-'
+                    && parsed <= static_cast<unsigned long long>(
+                         std::numeric_limits<T>::max());
+      result = static_cast<T>(parsed);
+    }
+
+    if (*end != 0) {
+      API_RETURN_VALUE_ASSIGN_ERROR(-1, "integer value is invalid", EINVAL);
+    }
+    if (!is_in_range) {
+      API_RETURN_VALUE_ASSIGN_ERROR(
+        -1,
+        "integer value does not fit in the member",
+        ERANGE);
+    }
+    *m_value = result;
+    return 0;
+  }
+};
+
+template <typename T>
+class DocumentSink<T, std::enable_if_t<std::is_floating_point<T>::value>>
+  : public DocumentValueSink {
+public:
+  void set_target(T *value) { m_value = value; }
+  int number(var::StringView value) override {
+    char buffer[64];
+    const size_t length
+      = value.length() < sizeof(buffer) ? value.length() : sizeof(buffer) - 1;
+    ::memcpy(buffer, value.data(), length);
+    buffer[length] = 0;
+    *m_value = static_cast<T>(::strtod(buffer, nullptr));
+    return 0;
+  }
+  int null() override {
+    *m_value = static_cast<T>(NAN);
+    return 0;
+  }
+
+private:
+  T *m_value = nullptr;
+};
+
+template <typename T>
+class DocumentSink<T, std::enable_if_t<std::is_same<T, var::String>::value>>
+  : public DocumentValueSink {
+public:
+  void set_target(T *value) { m_value = value; }
+  int string(var::StringView value) override {
+    *m_value = var::String(value);
+    return 0;
+  }
+  int null() override {
+    m_value->clear();
+    return 0;
+  }
+
+private:
+  T *m_value = nullptr;
+};
+
+template <typename T>
+class DocumentSink<T, std::enable_if_t<std::is_same<T, var::Data>::value>>
+  : public DocumentValueSink {
+public:
+  void set_target(T *value) { m_value = value; }
+  // the value is {"bytesValue": "..."}
+  DocumentValueSink *member(var::StringView key) override {
+    return key == "bytesValue" ? this : nullptr;
+  }
+  int string(var::StringView value) override {
+    return Base64Codec::decode(value, *m_value) < 0 ? -1 : 0;
+  }
+  int null() override {
+    m_value->resize(0);
+    return 0;
+  }
+
+private:
+  T *m_value = nullptr;
+};
+
+template <typename T>
+class DocumentSink<T, std::enable_if_t<is_document_sequence<T>::value>>
+  : public DocumentValueSink {
+public:
+  void set_target(T *value) { m_value = value; }
+
+  int begin() override {
+    // the array in the document replaces the values in the struct
+    m_value->clear();
+    return 0;
+  }
+
+  DocumentValueSink *element() override {
+    m_value->push_back(typename is_document_sequence<T>::element_type());
+    m_element.set_target(&m_value->back());
+    return &m_element;
+  }
+
+private:
+  T *m_value = nullptr;
+  DocumentSink<typename is_document_sequence<T>::element_type> m_element;
+};
+
+template <typename T>
+class DocumentSink<T, std::enable_if_t<is_document<T>::value>>
+  : public DocumentValueSink {
+public:
+  DocumentSink() = default;
+  explicit DocumentSink(T *value) { set_target(value); }
+
+  void set_target(T *value) { m_value = value; }
+
+  DocumentValueSink *member(var::StringView key) override {
+    return find_member(key, std::make_index_sequence<field_count>());
+  }
+
+private:
+  using Fields
+    = decltype(cloud_document_fields(static_cast<const T *>(nullptr)));
+  static constexpr size_t field_count = std::tuple_size<Fields>::value;
+
+  template <typename Tuple> struct Sinks;
+  template <typename... Field> struct Sinks<std::tuple<Field...>> {
+    using type = std::tuple<DocumentSink<typename Field::type>...>;
+  };
+
+  T *m_value = nullptr;
+  typename Sinks<Fields>::type m_sinks;
+
+  template <size_t... Index>
+  DocumentValueSink *
+  find_member(var::StringView key, std::index_sequence<Index...>) {
+    const auto fields = cloud_document_fields(static_cast<const T *>(nullptr));
+    DocumentValueSink *result = nullptr;
+    // stops at the first match
+    (void)((key == var::StringView(std::get<Index>(fields).name)
+              ? (std::get<Index>(m_sinks).set_target(
+                   &(m_value->*(std::get<Index>(fields).member))),
+                 result = &std::get<Index>(m_sinks),
+                 true)
+              : false)
+           || ...);
+    return result;
+  }
+};
+
+/*! \brief Document Sink Handler Class
+ *
+ * \details The handler passes plain JSON events (for example, from
+ * `CloudMapDecoder`) to a `DocumentSink`. Members that are not part of the
+ * struct are skipped.
+ *
+ */
+class DocumentSinkHandler : public JsonHandler {
+public:
+  explicit DocumentSinkHandler(DocumentValueSink &root) : m_root(&root) {}
+
+  int begin_object() override { return begin_container(false); }
+  int end_object() override { return end_container(); }
+  int begin_array() override { return begin_container(true); }
+  int end_array() override { return end_container(); }
+  int key(var::StringView key) override;
+  int string(var::StringView value) override;
+  int number(var::StringView value) override;
+  int boolean(bool value) override;
+  int null() override;
+
+private:
+  struct Container {
+    DocumentValueSink *sink;
+    bool is_array;
+  };
+
+  DocumentValueSink *m_root;
+  var::Vector<Container> m_stack;
+  // the sink for the value after the last key
+  DocumentValueSink *m_member = nullptr;
+
+  DocumentValueSink *get_value_sink();
+  int begin_container(bool is_array);
+  int end_container();
+};
+
+namespace document_schema {
+
+template <typename T> int write_value(JsonHandler &output, const T &value);
+
+template <typename T> int write_fields(JsonHandler &output, const T &value) {
+  int result = 0;
+  std::apply(
+    [&](const auto &... field) {
+      (void)((result = output.key(field.name) < 0
+                         ? -1
+                         : write_value(output, value.*(field.member)),
+              result >= 0)
+             && ...);
+    },
+    cloud_document_fields(&value));
+  return result;
+}
+
+inline int begin_typed_value(JsonHandler &output, var::StringView type) {
+  return (output.begin_object() < 0 || output.key(type) < 0) ? -1 : 0;
+}
+
+template <typename T> int write_value(JsonHandler &output, const T &value) {
+  if constexpr (std::is_same<T, bool>::value) {
+    return (begin_typed_value(output, "booleanValue") < 0
+            || output.boolean(value) < 0)
+             ? -1
+             : output.end_object();
+  } else if constexpr (std::is_integral<T>::value) {
+    // int64 values are strings in the Firestore JSON format
+    char buffer[32];
+    if (std::is_signed<T>::value) {
+      ::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value));
+    } else {
+      ::snprintf(
+        buffer,
+        sizeof(buffer),
+        "%llu",
+        static_cast<unsigned long long>(value));
+    }
+    return (begin_typed_value(output, "integerValue") < 0
+            || output.string(buffer) < 0)
+             ? -1
+             : output.end_object();
+  } else if constexpr (std::is_floating_point<T>::value) {
+    if (begin_typed_value(output, "doubleValue") < 0) {
+      return -1;
+    }
+    if (std::isnan(value)) {
+      return output.string("NaN") < 0 ? -1 : output.end_object();
+    }
+    if (std::isinf(value)) {
+      return output.string(value > 0 ? "Infinity" : "-Infinity") < 0
+               ? -1
+               : output.end_object();
+    }
+    char buffer[32];
+    ::snprintf(buffer, sizeof(buffer), "%.17g", static_cast<double>(value));
+    return output.number(buffer) < 0 ? -1 : output.end_object();
+  } else if constexpr (std::is_same<T, var::String>::value) {
+    return (begin_typed_value(output, "stringValue") < 0
+            || output.string(value.string_view()) < 0)
+             ? -1
+             : output.end_object();
+  } else if constexpr (std::is_same<T, var::Data>::value) {
+    var::String encoded;
+    Base64Codec::encode(var::View(value), encoded);
+    return (begin_typed_value(output, "bytesValue") < 0
+            || output.string(encoded.string_view()) < 0)
+             ? -1
+             : output.end_object();
+  } else if constexpr (is_document_sequence<T>::value) {
+    if (
+      begin_typed_value(output, "arrayValue") < 0 || output.begin_object() < 0
+      || output.key("values") < 0 || output.begin_array() < 0) {
+      return -1;
+    }
+    for (const auto &element : value) {
+      if (write_value(output, element) < 0) {
+        return -1;
+      }
+    }
+    return (output.end_array() < 0 || output.end_object() < 0)
+             ? -1
+             : output.end_object();
+  } else {
+    static_assert(is_document<T>::value, "type is not supported in documents");
+    if (
+      begin_typed_value(output, "mapValue") < 0 || output.begin_object() < 0
+      || output.key("fields") < 0 || output.begin_object() < 0
+      || write_fields(output, value) < 0) {
+      return -1;
+    }
+    return (output.end_object() < 0 || output.end_object() < 0)
+             ? -1
+             : output.end_object();
+  }
+}
+
+} // namespace document_schema
+
+// returns the Firestore document JSON for value
+template <typename T> var::String encode_document(const T &value) {
+  static_assert(is_document<T>::value, "use CLOUD_DOCUMENT_FIELDS for T");
+  var::String result;
+  JsonWriter writer(result);
+  if (
+    writer.begin_object() < 0 || writer.key("fields") < 0
+    || writer.begin_object() < 0
+    || document_schema::write_fields(writer, value) < 0
+    || writer.end_object() < 0 || writer.end_object() < 0) {
+    return var::String();
+  }
+  return result;
+}
+
+// returns the updateMask arguments that limit a patch to the members of T
+template <typename T> var::String get_document_update_mask() {
+  static_assert(is_document<T>::value, "use CLOUD_DOCUMENT_FIELDS for T");
+  var::String result;
+  std::apply(
+    [&](const auto &... field) {
+      ((result += var::StringView(result.is_empty() ? "" : "&"),
+        result += var::StringView("updateMask.fieldPaths="),
+        result += var::StringView(field.name)),
+       ...);
+    },
+    cloud_document_fields(static_cast<const T *>(nullptr)));
+  return result;
+}
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_DOCUMENTSCHEMA_HPP
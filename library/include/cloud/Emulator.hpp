@@ -0,0 +1,245 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_EMULATOR_HPP
+#define CLOUDAPI_CLOUD_EMULATOR_HPP
+
+#include <functional>
+
+#include <chrono/MicroTime.hpp>
+#include <fs/File.hpp>
+#include <inet/Http.hpp>
+#include <json/Json.hpp>
+#include <thread/Mutex.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief Emulator Class
+ *
+ * \details The emulator stands in for the Firebase services in the same
+ * process. When a `Cloud` has an emulator, the requests from `Cloud`,
+ * `Database`, `Store` and `Storage` are handled by the emulator rather than
+ * sent over the network, so the clients can be tested and load tested
+ * without a project, quota or WAN latency.
+ *
+ * The emulator is only built when `CLOUD_API_IS_EMULATOR` is on (the test
+ * and benchmark builds turn it on), so release builds do not carry it.
+ * Requests still check out a connection from the `ConnectionPool` of the
+ * cloud, but the connection is never connected.
+ *
+ * ```cpp
+ * Emulator emulator;
+ * Cloud cloud("api-key");
+ * cloud.set_emulator(&emulator);
+ *
+ * Store store(cloud, "project");
+ * store.create_document("projects", JsonObject().insert("name", ...));
+ * ```
+ *
+ * It handles:
+ * - Identity Toolkit `verifyPassword` and securetoken `token` (any email
+ *   and password are accepted)
+ * - Realtime Database REST requests; `listen()` gets one `put` event with
+ *   the current value and then the stream ends
+ * - Firestore document get, create, patch, delete and list, `:commit`,
+ *   `:batchGet`, `:runQuery` and `:runAggregationQuery` (query cursors are
+ *   ignored and masks select top level fields)
+ * - Cloud Storage object details, list (with a prefix and delimiter),
+ *   delete, media downloads (with a `Range` header field), `compose`,
+ *   `uploadType=media` uploads, `uploadType=resumable` upload sessions and
+ *   `batch/storage/v1` requests
+ *
+ * Data is kept in memory. Requests are handled one at a time; `latency` is
+ * added to each request outside of the lock to model the server round trip.
+ *
+ * A fault callback can fail chosen requests to test retries and resumes:
+ *
+ * ```cpp
+ * emulator.set_fault_callback([](const Emulator::Request &request) {
+ *   return request.url().find("upload_id=") != StringView::npos
+ *            ? Emulator::Fault::truncate
+ *            : Emulator::Fault::none;
+ * });
+ * ```
+ *
+ */
+class Emulator : public CloudObject {
+public:
+  class Request {
+  private:
+    API_ACCESS_FUNDAMENTAL(
+      Request,
+      inet::Http::Method,
+      method,
+      inet::Http::Method::get);
+    // the service host, for example "firestore.googleapis.com"
+    API_ACCESS_FUNDAMENTAL(Request, var::StringView, host, var::StringView());
+    // the path and query
+    API_ACCESS_FUNDAMENTAL(Request, var::StringView, url, var::StringView());
+    // for example "Accept: text/event-stream\r\n"
+    API_ACCESS_FUNDAMENTAL(
+      Request,
+      var::StringView,
+      header_fields,
+      var::StringView());
+    API_ACCESS_FUNDAMENTAL(Request, const fs::FileObject *, body, nullptr);
+    API_ACCESS_FUNDAMENTAL(Request, const fs::FileObject *, response, nullptr);
+    // receives the response header fields, for example "Location: ...\r\n"
+    API_ACCESS_FUNDAMENTAL(
+      Request,
+      var::String *,
+      response_header_fields,
+      nullptr);
+    // receives the status before the response body is written
+    API_ACCESS_FUNDAMENTAL(
+      Request,
+      inet::Http::Status *,
+      response_status,
+      nullptr);
+  };
+
+  enum class Fault {
+    // the request is handled
+    none,
+    // 503 without handling the request
+    unavailable,
+    // as if the connection dropped: only half of the request body is
+    // received or, for requests without a body, half of the response body
+    // is sent
+    truncate
+  };
+
+  using FaultCallback = std::function<Fault(const Request &request)>;
+
+  Emulator() = default;
+
+  Emulator(const Emulator &) = delete;
+  Emulator &operator=(const Emulator &) = delete;
+
+  // handles the request and writes the response body to request.response()
+  inet::Http::Status execute(const Request &request);
+
+  API_NO_DISCARD u32 request_count() const;
+
+  // called for each request (outside of the lock), set it before use
+  Emulator &set_fault_callback(FaultCallback callback) {
+    m_fault_callback = std::move(callback);
+    return *this;
+  }
+
+  // removes all data
+  Emulator &clear();
+
+  // the value of key in "Key: value\r\n" lines (keys ignore case)
+  static var::String
+  get_header_field(var::StringView header_fields, var::StringView key);
+
+private:
+  struct Response {
+    inet::Http::Status status;
+    var::String body;
+    var::String header_fields;
+  };
+
+  struct StorageObject {
+    var::String bucket;
+    var::String name;
+    var::String data;
+    u64 generation;
+  };
+
+  struct UploadSession {
+    var::String id;
+    var::String bucket;
+    var::String name;
+    size_t size;
+    var::String data;
+  };
+
+  API_ACCESS_COMPOUND(Emulator, chrono::MicroTime, latency);
+  // as with GCS, a resumable chunk that does not end the upload only
+  // commits a multiple of this many bytes (tests can make it smaller)
+  API_ACCESS_FUNDAMENTAL(Emulator, u32, upload_chunk_granularity, 256 * 1024);
+
+  mutable thread::Mutex m_mutex;
+  u32 m_request_count = 0;
+  u64 m_id_count = 0;
+  // Realtime Database tree
+  json::JsonObject m_database;
+  // Firestore documents by name
+  json::JsonObject m_documents;
+  var::Vector<StorageObject> m_objects;
+  var::Vector<UploadSession> m_upload_sessions;
+  FaultCallback m_fault_callback;
+
+  Response execute_identity(const Request &request, var::StringView body);
+  Response execute_token();
+  Response execute_database(const Request &request, var::StringView body);
+  Response execute_firestore(const Request &request, var::StringView body);
+  Response execute_storage(const Request &request, var::StringView body);
+  Response execute_batch(const Request &request, var::StringView body);
+
+  json::JsonValue get_database_value(var::StringView path) const;
+  void set_database_value(var::StringView path, const json::JsonValue &value);
+
+  Response create_document(
+    var::StringView collection,
+    var::StringView url,
+    var::StringView body);
+  Response patch_document(
+    var::StringView name,
+    var::StringView url,
+    var::StringView body);
+  Response list_documents(var::StringView collection, var::StringView url);
+  Response commit(var::StringView body);
+  Response batch_get(var::StringView body);
+  Response run_query(var::StringView parent, var::StringView body);
+  Response run_aggregation_query(var::StringView parent, var::StringView body);
+
+  void update_document(
+    var::StringView name,
+    const json::JsonObject &fields,
+    const json::JsonValue &update_mask);
+  void transform_document(
+    var::StringView name,
+    const json::JsonArray &field_transforms);
+  var::Vector<json::JsonObject>
+  get_query_documents(var::StringView parent, const json::JsonObject &query)
+    const;
+
+  Response upload_object(
+    var::StringView bucket,
+    var::StringView url,
+    var::StringView body);
+  Response start_upload_session(const Request &request, var::StringView bucket);
+  Response continue_upload_session(
+    const Request &request,
+    var::StringView body);
+  Response compose_object(
+    var::StringView bucket,
+    var::StringView name,
+    var::StringView body);
+  Response store_object(
+    var::StringView bucket,
+    var::StringView name,
+    var::StringView data);
+  Response list_objects(var::StringView bucket, var::StringView url) const;
+  size_t find_object(var::StringView bucket, var::StringView name) const;
+  json::JsonObject get_object_details(const StorageObject &object) const;
+
+  var::String generate_id();
+
+  static Response create_response(const json::JsonValue &value);
+  static Response create_error(
+    inet::Http::Status status,
+    var::StringView code,
+    var::StringView message);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_EMULATOR_HPP
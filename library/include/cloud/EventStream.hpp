@@ -0,0 +1,99 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_EVENTSTREAM_HPP
+#define CLOUDAPI_CLOUD_EVENTSTREAM_HPP
+
+#include <functional>
+
+#include <var/Data.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/View.hpp>
+
+namespace cloud {
+
+/*! \brief Event Stream Parser Class
+ *
+ * \details The event stream parser decodes a `text/event-stream` (Server-Sent
+ * Events) response incrementally. Chunks can split lines and events at any
+ * point. Bytes are copied into a buffer that is reused for the life of the
+ * parser, so no memory is allocated per chunk once the buffer is large
+ * enough to hold the biggest event.
+ *
+ * The views in an `Event` point into the parser buffer and are only valid
+ * for the duration of the callback.
+ *
+ */
+class EventStreamParser {
+public:
+  class Event {
+  public:
+    enum class Type { unknown, put, patch, keep_alive, cancel, auth_revoked };
+
+    Type type() const { return m_type; }
+    var::StringView name() const { return m_name; }
+    var::StringView data() const { return m_data; }
+
+    // put and patch events carry {"path": ..., "data": ...}
+    var::StringView path() const { return m_path; }
+    // the JSON text of the "data" member of a put or patch event
+    var::StringView value() const { return m_value; }
+
+    static Type get_type(var::StringView name);
+
+  private:
+    friend EventStreamParser;
+    Type m_type = Type::unknown;
+    var::StringView m_name;
+    var::StringView m_data;
+    var::StringView m_path;
+    var::StringView m_value;
+  };
+
+  // return a negative value to stop parsing
+  using Callback = std::function<int(const Event &event)>;
+
+  explicit EventStreamParser(Callback callback, size_t capacity = 4096);
+
+  // returns the number of bytes consumed or a negative value on failure
+  int feed(var::View chunk);
+
+  EventStreamParser &reset();
+
+private:
+  struct Range {
+    size_t offset = 0;
+    size_t length = 0;
+  };
+
+  Callback m_callback;
+  var::Data m_buffer;
+  // start of the event being collected
+  size_t m_head = 0;
+  // start of the line being collected
+  size_t m_line = 0;
+  // bytes before this offset have been searched for a line ending
+  size_t m_scan = 0;
+  // end of the valid bytes in the buffer
+  size_t m_tail = 0;
+
+  Range m_name;
+  Range m_data;
+  size_t m_data_count = 0;
+  // only used if an event has more than one data line
+  var::String m_data_lines;
+
+  int process_line(size_t begin, size_t end);
+  int dispatch();
+  void make_room();
+  var::StringView get_view(const Range &range) const;
+
+  static int split_payload(
+    var::StringView payload,
+    var::StringView &path,
+    var::StringView &value);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_EVENTSTREAM_HPP
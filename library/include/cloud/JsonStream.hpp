@@ -0,0 +1,220 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_JSONSTREAM_HPP
+#define CLOUDAPI_CLOUD_JSONSTREAM_HPP
+
+#include <functional>
+
+#include <json/Json.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+#include <var/View.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief JSON Handler Class
+ *
+ * \details A JSON handler receives the events produced by
+ * `JsonStreamParser`. Views passed to the handler are only valid for the
+ * duration of the call.
+ *
+ * Each method returns a negative value to stop parsing.
+ *
+ */
+class JsonHandler {
+public:
+  virtual ~JsonHandler() = default;
+
+  virtual int begin_object() = 0;
+  virtual int end_object() = 0;
+  virtual int begin_array() = 0;
+  virtual int end_array() = 0;
+  virtual int key(var::StringView key) = 0;
+  virtual int string(var::StringView value) = 0;
+  // the number exactly as it appears in the input
+  virtual int number(var::StringView value) = 0;
+  virtual int boolean(bool value) = 0;
+  virtual int null() = 0;
+};
+
+/*! \brief JSON Stream Parser Class
+ *
+ * \details The stream parser accepts JSON text in chunks of any size (for
+ * example, as they arrive from a socket) and passes events to a
+ * `JsonHandler`. Tokens split across chunks are buffered internally.
+ * Strings and numbers that are complete within a chunk are passed to the
+ * handler as views of the chunk without being copied.
+ *
+ * ```cpp
+ * JsonTreeBuilder builder;
+ * JsonStreamParser parser(builder);
+ * parser.feed(first_chunk);
+ * parser.feed(second_chunk);
+ * if( parser.finish() == 0 ){
+ *   JsonValue value = builder.value();
+ * }
+ * ```
+ *
+ */
+class JsonStreamParser {
+public:
+  explicit JsonStreamParser(JsonHandler &handler) : m_handler(&handler) {}
+
+  // returns the number of bytes consumed or -1 if parsing failed
+  int feed(var::View chunk);
+
+  // returns 0 if the input was a complete JSON value (or empty)
+  int finish();
+
+  JsonStreamParser &reset();
+
+  API_NO_DISCARD bool is_error() const { return m_state == State::error; }
+  API_NO_DISCARD bool is_complete() const { return m_state == State::done; }
+  API_NO_DISCARD size_t depth() const { return m_stack.count(); }
+  // true if parsing failed because the handler returned a negative value
+  API_NO_DISCARD bool is_stopped() const { return m_is_stopped; }
+
+private:
+  enum class State : u8 {
+    value,
+    value_or_end_array,
+    key_or_end_object,
+    key,
+    colon,
+    comma_or_end,
+    done,
+    error
+  };
+
+  enum class Token : u8 { none, string, number, literal };
+  enum class Container : u8 { object, array };
+
+  JsonHandler *m_handler;
+  State m_state = State::value;
+  Token m_token = Token::none;
+  var::Vector<Container> m_stack;
+  var::String m_buffer;
+
+  bool m_is_key = false;
+  bool m_is_escape = false;
+  bool m_is_stopped = false;
+  u8 m_unicode_count = 0;
+  u32 m_unicode_value = 0;
+  u32 m_high_surrogate = 0;
+  var::StringView m_literal;
+  size_t m_literal_position = 0;
+
+  int parse_string(const char *data, size_t size, size_t &offset);
+  int parse_number(const char *data, size_t size, size_t &offset);
+  int parse_literal(const char *data, size_t size, size_t &offset);
+  int parse_structure(char c);
+
+  int complete_string(var::StringView value);
+  int complete_number(var::StringView value);
+  int complete_value(int handler_result);
+  int handle(int handler_result);
+  void append_code_point(u32 code_point);
+  bool is_value_expected() const {
+    return m_state == State::value || m_state == State::value_or_end_array;
+  }
+
+  int fail() {
+    m_state = State::error;
+    return -1;
+  }
+};
+
+/*! \brief JSON Tree Builder Class
+ *
+ * \details The tree builder is a `JsonHandler` that assembles the parsed
+ * events into a `json::JsonValue`.
+ *
+ * If an element callback is set, each value that completes at the given
+ * depth is passed to the callback rather than being added to the tree. This
+ * lets a large response array be handled one element at a time.
+ *
+ */
+class JsonTreeBuilder : public JsonHandler {
+public:
+  using ElementCallback = std::function<int(const json::JsonValue &element)>;
+
+  JsonTreeBuilder &
+  set_element_callback(size_t depth, ElementCallback callback) {
+    m_element_depth = depth;
+    m_element_callback = std::move(callback);
+    return *this;
+  }
+
+  const json::JsonValue &value() const { return m_value; }
+  json::JsonValue &value() { return m_value; }
+
+  int begin_object() override;
+  int end_object() override { return end_container(); }
+  int begin_array() override;
+  int end_array() override { return end_container(); }
+  int key(var::StringView key) override;
+  int string(var::StringView value) override;
+  int number(var::StringView value) override;
+  int boolean(bool value) override;
+  int null() override;
+
+  // JsonInteger only holds an int and JsonReal a float, these keep the
+  // 64-bit integer or the double (a token with '.', 'e' or 'E' is a double)
+  static json::JsonValue create_number(var::StringView token);
+  static json::JsonValue create_integer(s64 value);
+  static json::JsonValue create_real(double value);
+
+private:
+  json::JsonValue m_value;
+  var::Vector<json::JsonValue> m_stack;
+  var::String m_key;
+  size_t m_element_depth = 0;
+  ElementCallback m_element_callback;
+
+  bool is_element(size_t depth) const {
+    return m_element_callback && depth == m_element_depth;
+  }
+
+  int add_value(const json::JsonValue &value);
+  int begin_container(const json::JsonValue &container);
+  int end_container();
+};
+
+/*! \brief JSON Writer Class
+ *
+ * \details The writer is a `JsonHandler` that appends compact JSON text to
+ * a string. Numbers are written exactly as they are received.
+ *
+ */
+class JsonWriter : public JsonHandler {
+public:
+  explicit JsonWriter(var::String &output) : m_output(&output) {}
+
+  int begin_object() override;
+  int end_object() override;
+  int begin_array() override;
+  int end_array() override;
+  int key(var::StringView key) override;
+  int string(var::StringView value) override;
+  int number(var::StringView value) override;
+  int boolean(bool value) override;
+  int null() override;
+
+  // appends value as a quoted JSON string
+  static void append_string(var::String &output, var::StringView value);
+
+private:
+  var::String *m_output;
+  // true until the first member or element of each open container
+  var::Vector<u8> m_is_first;
+  bool m_is_after_key = false;
+
+  void begin_value();
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_JSONSTREAM_HPP
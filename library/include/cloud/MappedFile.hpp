@@ -0,0 +1,58 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_MAPPEDFILE_HPP
+#define CLOUDAPI_CLOUD_MAPPEDFILE_HPP
+
+#include <fs/ViewFile.hpp>
+#include <var/StringView.hpp>
+#include <var/View.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief Mapped File Class
+ *
+ * \details A mapped file is a regular file that is memory mapped, so it is
+ * read and written in place without `read()` and `write()` calls or a
+ * buffer between the file and the transfer.
+ *
+ * Mapping is used where the system has POSIX `mmap()`. Elsewhere (for
+ * example on Stratify OS), or if the file cannot be opened or mapped (a
+ * file larger than the free address space of a 32-bit process, for
+ * example), `is_mapped()` is false without an error and the caller should
+ * use `fs::File` instead, as `Storage::upload_file()` and
+ * `Storage::download_file()` do.
+ *
+ */
+class MappedFile : public CloudObject {
+public:
+  // maps path for reading
+  explicit MappedFile(var::StringView path);
+  // creates path with size bytes and maps it for reading and writing
+  MappedFile(var::StringView path, size_t size);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  API_NO_DISCARD static bool is_supported();
+
+  API_NO_DISCARD bool is_mapped() const { return m_is_mapped; }
+  API_NO_DISCARD var::View view() const { return m_view; }
+  // the mapping as a file that can be passed to Storage
+  API_NO_DISCARD const fs::FileObject &file() const { return m_file; }
+
+private:
+  void *m_address = nullptr;
+  size_t m_size = 0;
+  bool m_is_mapped = false;
+  var::View m_view;
+  fs::ViewFile m_file;
+
+  var::View map(var::StringView path, size_t size, bool is_write);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_MAPPEDFILE_HPP
@@ -0,0 +1,80 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_METADATACACHE_HPP
+#define CLOUDAPI_CLOUD_METADATACACHE_HPP
+
+#include <json/Json.hpp>
+#include <thread/Mutex.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief Metadata Cache Class
+ *
+ * \details The metadata cache keeps the details of recently used Cloud
+ * Storage objects in memory so `Storage::get_details()` and ranged
+ * downloads do not need a metadata request each time.
+ *
+ * Entries are keyed by path and generation. When the cache is full, the
+ * least recently used entry is removed. A `Storage` that writes or removes
+ * an object drops its entry, but changes made by other clients are not
+ * seen until the entry is replaced, so only share a cache between clients
+ * that can accept stale details.
+ *
+ * ```cpp
+ * MetadataCache cache(128);
+ * Storage storage(cloud, "project");
+ * storage.set_metadata_cache(&cache);
+ * ```
+ *
+ * The cache is safe to share between threads.
+ *
+ */
+class MetadataCache : public CloudObject {
+public:
+  explicit MetadataCache(size_t capacity = 64);
+
+  MetadataCache(const MetadataCache &) = delete;
+  MetadataCache &operator=(const MetadataCache &) = delete;
+
+  /*! \details Returns the details of path or an empty object if path is
+   * not cached.
+   *
+   * If generation is not empty, only an entry with that generation matches.
+   *
+   */
+  API_NO_DISCARD json::JsonObject
+  get(var::StringView path, var::StringView generation = var::StringView())
+    const;
+
+  // replaces any entry for path, the generation is read from details
+  MetadataCache &insert(var::StringView path, const json::JsonObject &details);
+  MetadataCache &remove(var::StringView path);
+  MetadataCache &clear();
+
+  API_NO_DISCARD size_t count() const;
+  API_NO_DISCARD size_t capacity() const { return m_capacity; }
+
+private:
+  struct Entry {
+    var::String path;
+    var::String generation;
+    // JSON text so each caller parses its own copy
+    var::String details;
+  };
+
+  mutable thread::Mutex m_mutex;
+  size_t m_capacity;
+  // least recently used first
+  mutable var::Vector<Entry> m_entries;
+
+  size_t find(var::StringView path) const;
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_METADATACACHE_HPP
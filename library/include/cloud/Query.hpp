@@ -0,0 +1,106 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_QUERY_HPP
+#define CLOUDAPI_CLOUD_QUERY_HPP
+
+#include <json/Json.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief Query Class
+ *
+ * \details A query describes a Cloud Firestore structured query. The
+ * filters, ordering and limits are evaluated by the server so only the
+ * matching documents are downloaded.
+ *
+ * ```cpp
+ * Query query("projects");
+ * query.where("owner", Query::Operator::equal, JsonString("tyler"))
+ *   .order_by("created", Query::Direction::descending)
+ *   .set_limit(10);
+ * store.run_query(query, [](StringView path, const JsonValue &document) {
+ *   return 0;
+ * });
+ * ```
+ *
+ * Values are plain JSON; they are converted to Firestore values when the
+ * query is built.
+ *
+ */
+class Query {
+public:
+  enum class Operator {
+    less_than,
+    less_than_or_equal,
+    greater_than,
+    greater_than_or_equal,
+    equal,
+    not_equal,
+    array_contains,
+    in,
+    array_contains_any,
+    not_in
+  };
+
+  enum class Direction { ascending, descending };
+
+  // path is the collection, for example "projects" or "projects/abc/tasks"
+  explicit Query(var::StringView path);
+
+  // null values are sent as IS_NULL and IS_NOT_NULL filters
+  Query &
+  where(var::StringView field, Operator operation, const json::JsonValue &value);
+
+  Query &order_by(
+    var::StringView field,
+    Direction direction = Direction::ascending);
+
+  // values match the order_by() fields
+  Query &start_at(const json::JsonArray &values);
+  Query &start_after(const json::JsonArray &values);
+  Query &end_at(const json::JsonArray &values);
+  Query &end_before(const json::JsonArray &values);
+
+  // only returns the listed fields
+  Query &select(const var::StringList &fields);
+
+  // the parent document of the collection, empty for top level collections
+  var::StringView parent() const { return m_parent.string_view(); }
+  var::StringView collection_id() const {
+    return m_collection_id.string_view();
+  }
+
+  // the filter as a Firestore `where` object (invalid if there are no filters)
+  json::JsonObject get_filter() const;
+
+  // the Firestore `structuredQuery` object
+  json::JsonObject to_object() const;
+
+  static var::StringView to_string(Operator value);
+
+private:
+  API_ACCESS_FUNDAMENTAL(Query, u32, limit, 0);
+  API_ACCESS_FUNDAMENTAL(Query, u32, offset, 0);
+  // includes collections with the same id under every parent
+  API_ACCESS_BOOL(Query, all_descendants, false);
+
+  var::String m_parent;
+  var::String m_collection_id;
+  json::JsonArray m_filters;
+  json::JsonArray m_orders;
+  json::JsonArray m_fields;
+  json::JsonObject m_start_at;
+  json::JsonObject m_end_at;
+
+  static json::JsonObject
+  create_cursor(const json::JsonArray &values, bool is_before);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_QUERY_HPP
@@ -1,27 +1,208 @@
 #ifndef CLOUDAPI_CLOUD_STORAGE_HPP
 #define CLOUDAPI_CLOUD_STORAGE_HPP
 
+#include "Checksum.hpp"
 #include "Cloud.hpp"
+#include "MetadataCache.hpp"
 
 namespace cloud {
 
 class Storage : public Cloud::SecureClient {
 public:
+  /*! \details The state of a resumable upload.
+   *
+   * Save `to_object()` (for example to a file) after each chunk to continue
+   * the upload from another process with `resume_upload()`. Sessions expire
+   * on the server after about a week. Sizes are saved as decimal strings,
+   * as in the object details, so they are not limited to 32 bits.
+   *
+   */
+  class UploadSession {
+  public:
+    UploadSession() = default;
+    explicit UploadSession(const json::JsonObject &object);
+
+    API_NO_DISCARD json::JsonObject to_object() const;
+
+    API_NO_DISCARD bool is_valid() const { return !m_url.is_empty(); }
+
+  private:
+    // the session URI without the scheme and host
+    API_ACCESS_COMPOUND(UploadSession, var::String, url);
+    API_ACCESS_COMPOUND(UploadSession, var::PathString, destination);
+    API_ACCESS_FUNDAMENTAL(UploadSession, size_t, size, 0);
+    // the number of bytes the server has committed
+    API_ACCESS_FUNDAMENTAL(UploadSession, size_t, offset, 0);
+    API_ACCESS_BOOL(UploadSession, complete, false);
+    // the CRC32C of the first crc32c_size() bytes that were sent
+    API_ACCESS_FUNDAMENTAL(UploadSession, u32, crc32c, 0);
+    API_ACCESS_FUNDAMENTAL(UploadSession, size_t, crc32c_size, 0);
+  };
+
   Storage(const Cloud & cloud, var::StringView database_project);
 
+  // uses metadata_cache() when it is set
   API_NO_DISCARD json::JsonObject get_details(var::StringView path);
+
+  /*! \details Downloads the object at path to destination.
+   *
+   * The data is requested with `alt=media` in a single request.
+   *
+   * If `download_range_size()` is set and the object is larger, the object
+   * is fetched in ranges of that size, `download_range_count()` at a time,
+   * each over its own connection. Each range is written at its own offset,
+   * so destination must allow writes at any location (not an append only
+   * file). A range that fails is requested again from the last byte
+   * received, up to `download_retry_count()` times. Ranged downloads need
+   * the size of the object, so they use `get_details()`.
+   *
+   * The CRC32C of the data (and the MD5 if `is_verify_md5()`) is
+   * calculated as it arrives and compared with the checksums the server
+   * has for the object. The checksum of each range is combined into the
+   * checksum of the object. If they do not match, the error number is
+   * `EIO`.
+   *
+   */
   Storage &
   get_object(var::StringView path, const fs::FileObject &destination);
 
+  /*! \details Uploads source to destination.
+   *
+   * If `composite_upload_part_count()` is more than one, source is split
+   * into that many parts that are uploaded at the same time as temporary
+   * objects, combined with `compose` and then removed. Otherwise, if
+   * `upload_chunk_size()` is set, a resumable upload is used.
+   *
+   * The CRC32C of the source is calculated as it is sent and compared with
+   * the checksum of the new object. If they do not match, the error number
+   * is `EIO`.
+   *
+   */
   Storage &create_object(
     var::StringView destination,
     const fs::FileObject &source,
     var::StringView count_description = var::StringView());
 
+  /*! \details Uploads the local file at local_path to destination.
+   *
+   * Where `MappedFile::is_supported()`, the file is memory mapped and the
+   * upload reads it in place rather than through `read()` calls.
+   * Otherwise it is the same as `create_object()` with an `fs::File`.
+   *
+   */
+  Storage &upload_file(var::StringView destination, var::StringView local_path);
+
+  /*! \details Downloads the object at path to the local file at
+   * local_path.
+   *
+   * Where `MappedFile::is_supported()`, the file is created at the size of
+   * the object (from `get_details()`) and memory mapped so the data, and
+   * each range of a ranged download, is written in place. Otherwise it is
+   * the same as `get_object()` with an `fs::File`.
+   *
+   */
+  Storage &download_file(var::StringView path, var::StringView local_path);
+
   Storage& remove_object(var::StringView path);
 
+  /*! \details Removes each object in path_list.
+   *
+   * Up to `batch_limit` deletes are sent in each multipart
+   * `batch/storage/v1` request. The result has the status of each delete
+   * in the order of path_list, for example `not_found` if the object did
+   * not exist. Only a failed batch request is an error; the result then
+   * stops at the deletes that were sent before it.
+   *
+   */
+  API_NO_DISCARD var::Vector<inet::Http::Status>
+  remove_objects(const var::StringList &path_list);
+
+  // the most requests the server accepts in one batch
+  static constexpr u8 batch_limit = 100;
+
+  /*! \details Returns one page of the objects whose names start with
+   * prefix.
+   *
+   * The response has `items` with the details of each object and
+   * `nextPageToken` if there are more pages. If delimiter is set (usually
+   * "/"), objects with the delimiter after the prefix are not in `items`.
+   * Their names up to the delimiter are listed once in `prefixes`, like
+   * the directories of a file system.
+   *
+   */
+  API_NO_DISCARD json::JsonObject list_objects(
+    var::StringView prefix,
+    var::StringView delimiter = var::StringView(),
+    var::StringView page_token = var::StringView());
+
+  // return false to stop listing
+  using ObjectCallback = std::function<bool(const json::JsonObject &details)>;
+
+  // calls callback with the details of each object on every page
+  Storage &for_each_object(
+    var::StringView prefix,
+    var::StringView delimiter,
+    const ObjectCallback &callback);
+
+  // starts a resumable upload of size bytes to destination
+  API_NO_DISCARD UploadSession
+  start_upload(var::StringView destination, size_t size);
+
+  /*! \details Sends source to the session from the offset the server has
+   * committed, `upload_chunk_size()` bytes per request. Each chunk is
+   * read from source while it is sent, not buffered first.
+   *
+   * If a chunk fails, the committed offset is fetched from the server and
+   * the upload continues from there, up to `upload_retry_count()` times in
+   * a row. A chunk that the server answers without committing any of it
+   * also counts as a failure. `session` is updated after each chunk. `source` is read from
+   * the start of the file, so it must be the whole object.
+   *
+   */
+  Storage &resume_upload(UploadSession &session, const fs::FileObject &source);
+
+  // asynchronous variants run on the CloudService worker pool, transfers
+  // that run at the same time would share printer(), so they do not report
+  // progress
+  Storage &get_details_async(var::StringView path, JsonCallback callback);
+
+  Storage &get_object_async(
+    var::StringView path,
+    const fs::FileObject &destination,
+    Callback callback);
+
+  Storage &create_object_async(
+    var::StringView destination,
+    const fs::FileObject &source,
+    var::StringView count_description,
+    Callback callback);
+
+  Storage &remove_object_async(var::StringView path, Callback callback);
+
 
 private:
+  // when set, create_object() uses a resumable upload in chunks of this
+  // many bytes (a multiple of 256 KiB)
+  API_ACCESS_FUNDAMENTAL(Storage, u32, upload_chunk_size, 0);
+  API_ACCESS_FUNDAMENTAL(Storage, u8, upload_retry_count, 3);
+  // when set, larger objects are downloaded in ranges of this many bytes
+  API_ACCESS_FUNDAMENTAL(Storage, u32, download_range_size, 0);
+  API_ACCESS_FUNDAMENTAL(Storage, u8, download_range_count, 4);
+  API_ACCESS_FUNDAMENTAL(Storage, u8, download_retry_count, 3);
+  API_ACCESS_FUNDAMENTAL(Storage, u32, download_stack_size, 65536);
+  // up to 32 parts (the compose limit), parts use resumable uploads
+  API_ACCESS_FUNDAMENTAL(Storage, u8, composite_upload_part_count, 0);
+  // objects per list_objects() page, zero uses the server default (1000)
+  API_ACCESS_FUNDAMENTAL(Storage, u16, list_page_size, 0);
+  // compare checksums of transferred data with the server's checksums
+  API_ACCESS_BOOL(Storage, verify_crc32c, true);
+  API_ACCESS_BOOL(Storage, verify_md5, false);
+  // when false, transfers do not update printer().progress_callback()
+  API_ACCESS_BOOL(Storage, report_progress, true);
+  // shared object details, not owned by the Storage object
+  API_ACCESS_FUNDAMENTAL(Storage, MetadataCache *, metadata_cache, nullptr);
+
+  static constexpr u32 default_upload_chunk_size = 8 * 1024 * 1024;
 
   API_NO_DISCARD static var::StringView storage_host() { return "www.googleapis.com"; }
 
@@ -34,6 +215,81 @@ private:
     return get_storage_bucket_path() / inet::Url::encode(path);
   }
 
+  // set while an asynchronous transfer runs on a worker thread
+  static thread_local bool m_is_async_transfer;
+
+  bool is_progress_reported() const {
+    return is_report_progress() && !m_is_async_transfer;
+  }
+
+  const api::ProgressCallback *get_progress_callback() {
+    return is_progress_reported() ? printer().progress_callback() : nullptr;
+  }
+
+  // the printer is shared, so it is left alone when progress is off
+  void set_progress_key(var::StringView key) {
+    if (is_progress_reported()) {
+      printer().set_progress_key(key);
+    }
+  }
+
+  // the path to download an object in one request
+  var::String get_media_path(
+    var::StringView path,
+    var::StringView generation = var::StringView());
+
+  struct CompositeUpload;
+
+  static constexpr u8 compose_source_limit = 32;
+
+  void create_composite_object(
+    var::StringView destination,
+    const fs::FileObject &source);
+  json::JsonObject compose_object(
+    var::StringView destination,
+    const var::StringList &source_list);
+  void delete_object(var::StringView path);
+  void remove_batch(
+    const var::StringList &path_list,
+    size_t offset,
+    size_t count,
+    var::Vector<inet::Http::Status> &result);
+  static void *upload_parts(void *args);
+
+  void get_object_ranges(
+    var::StringView url,
+    size_t size,
+    const fs::FileObject &destination,
+    var::StringView crc32c);
+
+  // empty values are not checked, md5 is only checked if it is not null
+  void verify_checksums(
+    var::StringView expected_crc32c,
+    var::StringView expected_md5,
+    const Crc32c &crc32c,
+    const Md5 *md5);
+
+  // receives the number of bytes the server committed for a chunk
+  using SentCallback = std::function<void(size_t sent)>;
+
+  void upload_chunks(
+    UploadSession &session,
+    const fs::FileObject &source,
+    size_t source_offset,
+    thread::Mutex *source_lock,
+    const SentCallback &sent_callback);
+  void send_upload_chunk(
+    UploadSession &session,
+    const fs::FileObject &source,
+    size_t chunk_size,
+    size_t source_offset,
+    thread::Mutex *source_lock);
+  void query_upload(UploadSession &session);
+  void update_upload_session(
+    UploadSession &session,
+    inet::Http::Status status,
+    ConnectionPool::Lease &connection);
+
 };
 }
 
@@ -0,0 +1,113 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_STORAGESYNC_HPP
+#define CLOUDAPI_CLOUD_STORAGESYNC_HPP
+
+#include <thread/Mutex.hpp>
+#include <var/String.hpp>
+#include <var/StringView.hpp>
+#include <var/Vector.hpp>
+
+#include "Storage.hpp"
+
+namespace cloud {
+
+/*! \brief Storage Sync Class
+ *
+ * \details The sync copies only the files that differ between a local
+ * directory and the objects under a prefix in Cloud Storage.
+ *
+ * The objects are listed with `Storage::for_each_object()`. A file is the
+ * same as an object if the sizes match and the CRC32C of the file matches
+ * the `crc32c` of the object, so unchanged files are read but not sent.
+ * Files that are missing or different are copied with `transfer_count()`
+ * transfers running at the same time. Nothing is deleted from the
+ * destination.
+ *
+ * When downloading, objects whose name (after the prefix) has a `..`, `.`
+ * or empty segment are not written, so no file is created outside of
+ * `local_path()`. They are counted by `rejected_count()`.
+ *
+ * The object `generation` is not compared: a local file has no
+ * generation to compare it with, and the sync keeps no record of earlier
+ * runs, so the content (size and CRC32C) decides.
+ *
+ * The progress reports of `storage` are turned off during a sync.
+ * `printer().progress_callback()` gets the bytes of the finished
+ * transfers out of the total to transfer instead.
+ *
+ * ```cpp
+ * Storage storage(cloud, "project");
+ * StorageSync(storage).sync(StorageSync::Options()
+ *                             .set_local_path("/home/artifacts")
+ *                             .set_remote_path("artifacts/nightly")
+ *                             .set_direction(StorageSync::Direction::upload));
+ * ```
+ *
+ */
+class StorageSync : public CloudObject {
+public:
+  enum class Direction { upload, download };
+
+  class Options {
+    // the local directory
+    API_ACCESS_COMPOUND(Options, var::PathString, local_path);
+    // the object prefix without the trailing slash
+    API_ACCESS_COMPOUND(Options, var::PathString, remote_path);
+    API_ACCESS_FUNDAMENTAL(Options, Direction, direction, Direction::upload);
+    API_ACCESS_FUNDAMENTAL(Options, u8, transfer_count, 4);
+    API_ACCESS_FUNDAMENTAL(Options, u32, stack_size, 65536);
+  };
+
+  explicit StorageSync(Storage &storage) : m_storage(&storage) {}
+
+  StorageSync &sync(const Options &options);
+
+  // the results of the last sync()
+  API_NO_DISCARD u32 transferred_count() const { return m_transferred_count; }
+  API_NO_DISCARD u32 skipped_count() const { return m_skipped_count; }
+  // downloads of objects with "..", "." or empty segments in the name
+  API_NO_DISCARD u32 rejected_count() const { return m_rejected_count; }
+  API_NO_DISCARD u64 transferred_size() const { return m_transferred_size; }
+
+  // the CRC32C of a local file, in the format of the crc32c metadata
+  static var::String get_file_crc32c(var::StringView path);
+
+private:
+  struct Transfer {
+    var::PathString local_path;
+    var::String remote_path;
+    size_t size;
+  };
+
+  // shared by the threads of a sync
+  struct Context {
+    StorageSync *self;
+    Direction direction;
+    var::Vector<Transfer> transfers;
+
+    thread::Mutex mutex;
+    size_t next_transfer = 0;
+    u64 total_size = 0;
+    var::String error_message;
+    int error_number = 0;
+  };
+
+  Storage *m_storage;
+  u32 m_transferred_count = 0;
+  u32 m_skipped_count = 0;
+  u32 m_rejected_count = 0;
+  u64 m_transferred_size = 0;
+
+  bool is_different(
+    var::StringView local_path,
+    size_t local_size,
+    const json::JsonObject &details) const;
+  void create_directories(const var::Vector<Transfer> &transfers);
+
+  static void *run_transfers(void *args);
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_STORAGESYNC_HPP
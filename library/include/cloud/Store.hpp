@@ -1,7 +1,13 @@
 #ifndef CLOUDAPI_CLOUD_STORE_HPP
 #define CLOUDAPI_CLOUD_STORE_HPP
 
+#include <thread/Cond.hpp>
+#include <thread/Mutex.hpp>
+
 #include "Cloud.hpp"
+#include "CloudMapStream.hpp"
+#include "DocumentSchema.hpp"
+#include "Query.hpp"
 
 namespace cloud {
 
@@ -15,6 +21,151 @@ public:
     return *this;
   }
 
+  class FieldTransform : public json::JsonObject {
+  public:
+    static FieldTransform server_timestamp(var::StringView field);
+    static FieldTransform
+    increment(var::StringView field, const json::JsonValue &value);
+    static FieldTransform
+    maximum(var::StringView field, const json::JsonValue &value);
+    static FieldTransform
+    minimum(var::StringView field, const json::JsonValue &value);
+    static FieldTransform append_missing_elements(
+      var::StringView field,
+      const json::JsonArray &values);
+    static FieldTransform remove_all_from_array(
+      var::StringView field,
+      const json::JsonArray &values);
+
+  private:
+    FieldTransform(
+      var::StringView field,
+      var::StringView kind,
+      const json::JsonValue &value);
+  };
+
+  /*! \details A write batch collects document writes and sends them
+   * using `documents:commit`.
+   *
+   * Each commit is atomic. If the batch has more than `max_write_count()`
+   * writes, it is split across several commits. If one of them fails, the
+   * earlier ones stay committed and are removed from the batch, so
+   * `count()` is what is left and calling `commit()` again sends only that.
+   *
+   * ```cpp
+   * store.write_batch()
+   *   .create("projects", JsonObject().insert("name", JsonString("a")))
+   *   .patch("projects/b", JsonObject().insert("name", JsonString("b")))
+   *   .remove("projects/c")
+   *   .commit();
+   * ```
+   *
+   */
+  class WriteBatch : public CloudObject {
+  public:
+    explicit WriteBatch(Store &store) : m_store(&store) {}
+
+    // path is the collection, a random id is used if id is empty
+    WriteBatch &create(
+      var::StringView path,
+      const json::JsonObject &object,
+      var::StringView id = var::StringView());
+
+    // update_mask lists the fields to write, all fields are replaced if empty
+    WriteBatch &patch(
+      var::StringView path,
+      const json::JsonObject &object,
+      IsExisting is_existing = IsExisting::yes,
+      const var::StringList &update_mask = var::StringList());
+
+    WriteBatch &remove(var::StringView path);
+
+    WriteBatch &
+    transform(var::StringView path, const FieldTransform &field_transform);
+
+    API_NO_DISCARD size_t count() const { return m_writes.count(); }
+
+    // sends the pending writes, removing each chunk once it is committed
+    WriteBatch &commit();
+
+    // the results of the commits since the batch was created
+    const json::JsonArray &write_results() const { return m_write_results; }
+
+  private:
+    API_ACCESS_FUNDAMENTAL(WriteBatch, u16, max_write_count, 500);
+    Store *m_store;
+    json::JsonArray m_writes;
+    json::JsonArray m_write_results;
+  };
+
+  WriteBatch write_batch() { return WriteBatch(*this); }
+
+  /*! \details A document cursor walks every document in a collection.
+   *
+   * Pages are requested using `pageSize` and `pageToken`. If the store has
+   * a worker pool, the next page is requested on another connection while
+   * the current page is being read.
+   *
+   * ```cpp
+   * Store::DocumentCursor cursor(store, "projects");
+   * while (cursor.next()) {
+   *   printer().object(cursor.path(), cursor.document());
+   * }
+   * ```
+   *
+   */
+  class DocumentCursor : public CloudObject {
+  public:
+    DocumentCursor(
+      Store &store,
+      var::StringView path,
+      u16 page_size = 300,
+      const var::StringList &mask = var::StringList());
+    ~DocumentCursor();
+
+    DocumentCursor(const DocumentCursor &) = delete;
+    DocumentCursor &operator=(const DocumentCursor &) = delete;
+
+    // moves to the next document, returns false at the end or on an error
+    bool next();
+
+    // the document as plain JSON
+    const json::JsonObject &document() const { return m_document; }
+    // the path of the document relative to the database
+    var::StringView path() const { return m_document_path.string_view(); }
+
+    API_NO_DISCARD u32 page_count() const { return m_page_count; }
+
+  private:
+    struct Page {
+      json::JsonObject response;
+      var::String error_message;
+      int error_number = 0;
+    };
+
+    Store *m_store;
+    var::String m_options;
+    var::String m_path;
+    json::JsonArray m_documents;
+    u32 m_index = 0;
+    u32 m_page_count = 0;
+    var::String m_next_page_token;
+    bool m_is_started = false;
+    json::JsonObject m_document;
+    var::String m_document_path;
+
+    thread::Mutex m_mutex;
+    thread::Cond m_cond;
+    bool m_is_prefetching = false;
+    bool m_is_prefetch_ready = false;
+    Page m_prefetched;
+
+    Page fetch_page(var::StringView page_token);
+    void start_prefetch();
+    Page wait_prefetch();
+    bool load_page();
+  };
+
   // Cloud Firestore operations
   API_NO_DISCARD var::KeyString create_document(
     var::StringView path,
@@ -28,11 +179,121 @@ public:
 
   API_NO_DISCARD json::JsonObject get_document(var::StringView path);
 
+  // passes the document to handler as plain JSON while it is downloaded
+  Store &get_document(var::StringView path, JsonHandler &handler);
+
+  // structs declared with CLOUD_DOCUMENT_FIELDS are encoded directly
+  template <typename T, typename = std::enable_if_t<is_document<T>::value>>
+  API_NO_DISCARD var::KeyString create_document(
+    var::StringView path,
+    const T &value,
+    var::StringView id = var::StringView("")) {
+    return create_encoded_document(path, encode_document(value), id);
+  }
+
+  // unless document_update_mask_fields() is set, only the members of T are
+  // written and other fields in the document are kept
+  template <typename T, typename = std::enable_if_t<is_document<T>::value>>
+  Store &patch_document(
+    var::StringView path,
+    const T &value,
+    IsExisting is_existing = IsExisting::yes) {
+    const bool is_update_mask = !document_update_mask_fields().is_empty();
+    var::String mask_field_arguments = create_mask_fields();
+    if (!is_update_mask) {
+      if (!mask_field_arguments.is_empty()) {
+        mask_field_arguments += "&";
+      }
+      mask_field_arguments += get_document_update_mask<T>();
+    }
+    return patch_encoded_document(
+      path,
+      encode_document(value),
+      is_existing,
+      mask_field_arguments);
+  }
+
+  // members of T that are missing from the document are left unchanged
+  template <typename T, typename = std::enable_if_t<is_document<T>::value>>
+  Store &get_document(var::StringView path, T &value) {
+    DocumentSink<T> sink(&value);
+    DocumentSinkHandler handler(sink);
+    return get_document(path, handler);
+  }
+
+  // document is null if it does not exist, return a negative value to stop
+  // (stopping is not an error)
+  using DocumentResultCallback = std::function<
+    int(var::StringView path, const json::JsonValue &document)>;
+
+  /*! \details Fetches many documents using `documents:batchGet`.
+   *
+   * The response is parsed as it arrives and each document is passed to
+   * `callback` once it is complete. Paths are sent `batch_get_limit()` at a
+   * time. `mask` limits the fields that are returned.
+   *
+   */
+  Store &get_documents(
+    const var::StringList &paths,
+    const DocumentResultCallback &callback,
+    const var::StringList &mask = var::StringList());
+
+  // returns an object keyed by path, missing documents are null
+  API_NO_DISCARD json::JsonObject get_documents(
+    const var::StringList &paths,
+    const var::StringList &mask = var::StringList());
+
+  /*! \details Runs a structured query using `:runQuery`.
+   *
+   * The response is parsed as it arrives and each matching document is
+   * passed to `callback` in query order.
+   *
+   */
+  Store &run_query(const Query &query, const DocumentResultCallback &callback);
+
+  // returns the matching documents as plain JSON
+  API_NO_DISCARD json::JsonArray run_query(const Query &query);
+
+  /*! \details Aggregations are computed by the server using
+   * `:runAggregationQuery` so the matching documents are not downloaded.
+   *
+   * `up_to` stops counting once the value is reached (0 for no limit).
+   * `avg()` returns NaN if no documents have a numeric value for `field`.
+   *
+   */
+  API_NO_DISCARD u64 count(const Query &query, u64 up_to = 0);
+  API_NO_DISCARD double sum(const Query &query, var::StringView field);
+  API_NO_DISCARD double avg(const Query &query, var::StringView field);
+
   Store &remove_document(var::StringView path);
 
   json::JsonObject
   list_documents(var::StringView path, var::StringView mask_options);
 
+  // asynchronous variants run on the CloudService worker pool
+  using DocumentCallback = std::function<void(const json::JsonObject &document)>;
+
+  Store &create_document_async(
+    var::StringView path,
+    const json::JsonObject &object,
+    var::StringView id,
+    IdCallback callback);
+
+  Store &patch_document_async(
+    var::StringView path,
+    const json::JsonObject &object,
+    IsExisting is_existing,
+    Callback callback);
+
+  Store &get_document_async(var::StringView path, DocumentCallback callback);
+
+  Store &remove_document_async(var::StringView path, Callback callback);
+
+  Store &list_documents_async(
+    var::StringView path,
+    var::StringView mask_options,
+    DocumentCallback callback);
+
   const var::StringList &document_mask_fields() const {
     return m_document_mask_fields;
   }
@@ -45,7 +306,18 @@ public:
     return m_document_update_mask_fields;
   }
 
+protected:
+  void interface_add_header_fields(inet::Http &http) const override {
+    http.add_header_field("Content-Type", "application/json");
+    if (!credentials().get_token().is_empty()) {
+      http.add_header_field(
+        "Authorization",
+        var::String("Bearer ") + credentials().get_token());
+    }
+  }
+
 private:
+  API_ACCESS_FUNDAMENTAL(Store, u16, batch_get_limit, 100);
   var::StringList m_document_mask_fields;
   var::StringList m_document_update_mask_fields;
 
@@ -53,29 +325,56 @@ private:
 
   var::String create_mask_fields();
 
-  var::PathString document_api_path() {
-    return "v1/projects" / database_project() / "databases/(default)/documents";
+  Store &patch_document_with_mask(
+    var::StringView path,
+    const json::JsonObject &object,
+    IsExisting is_existing,
+    var::StringView mask_field_arguments);
+
+  // request is a Firestore document, an empty request is an error
+  var::KeyString create_encoded_document(
+    var::StringView path,
+    var::StringView request,
+    var::StringView id);
+
+  Store &patch_encoded_document(
+    var::StringView path,
+    var::StringView request,
+    IsExisting is_existing,
+    var::StringView mask_field_arguments);
+
+  var::PathString document_api_path() { return "v1" / document_root(); }
+
+  var::PathString document_root() const {
+    return "projects" / database_project() / "databases/(default)/documents";
   }
 
-  var::PathString get_document_url_path(var::StringView path) {
-    return "/" & document_api_path() / path;
+  // the full resource name used in request bodies
+  var::PathString get_document_name(var::StringView path) const {
+    return document_root() / path;
   }
 
-  void refresh_http_client_document_headers() {
+  // returns the raw text of the aggregate value
+  var::String run_aggregation_query(
+    const Query &query,
+    const json::JsonObject &aggregation);
 
-    http_client().add_header_field(
-      "Content-Type",
-      "application/json");
+  // the inverse of get_document_name()
+  var::StringView get_document_path(var::StringView name) const;
 
-    if (!credentials().get_token().is_empty()) {
-      http_client().add_header_field(
-        "Authorization",
-        var::String("Bearer ") + credentials().get_token());
-    }
+  static var::KeyString generate_document_id();
 
-    if (!http_client().is_connected()) {
-      http_client().connect(m_document_host);
-    }
+  // the url for a query on the parent document
+  var::PathString
+  get_query_url_path(const Query &query, var::StringView method) {
+    return "/"
+           & (query.parent().is_empty() ? document_api_path()
+                                        : document_api_path() / query.parent())
+           & method;
+  }
+
+  var::PathString get_document_url_path(var::StringView path) {
+    return "/" & document_api_path() / path;
   }
 };
 
@@ -0,0 +1,144 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_TRANSFERMANAGER_HPP
+#define CLOUDAPI_CLOUD_TRANSFERMANAGER_HPP
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <thread/Cond.hpp>
+#include <thread/Mutex.hpp>
+#include <thread/Thread.hpp>
+#include <var/Queue.hpp>
+#include <var/String.hpp>
+#include <var/Vector.hpp>
+
+#include "Storage.hpp"
+
+namespace cloud {
+
+/*! \brief Transfer Manager Class
+ *
+ * \details The transfer manager queues `Storage` uploads and downloads so
+ * bulk transfers do not take all of the uplink from `Store` and `Database`
+ * requests.
+ *
+ * At most `transfer_count()` transfers run at the same time. Higher
+ * priorities start first and equal priorities start in the order they
+ * were submitted. Bandwidth is limited with token buckets: one shared by
+ * every transfer (`Construct::bandwidth_limit()`) and one for each
+ * transfer (`Transfer::bandwidth_limit()`).
+ *
+ * ```cpp
+ * Storage storage(cloud, "project");
+ * TransferManager manager(
+ *   storage,
+ *   TransferManager::Construct().set_bandwidth_limit(1024 * 1024));
+ * manager.submit(TransferManager::Transfer()
+ *                  .set_path("logs/today.txt")
+ *                  .set_file(&log_file)
+ *                  .set_priority(TransferManager::Priority::low));
+ * manager.wait();
+ * ```
+ *
+ * The manager reports the bytes of every queued transfer as one total to
+ * `printer().progress_callback()`, so it turns off the progress reports of
+ * `storage` until it is destroyed. As with `WorkerPool`, the callback of a
+ * transfer runs on the worker thread and can check `is_success()`.
+ *
+ */
+class TransferManager : public CloudObject {
+public:
+  enum class Direction { upload, download };
+  enum class Priority { low, normal, high };
+
+  class Construct {
+    API_ACCESS_FUNDAMENTAL(Construct, u8, transfer_count, 2);
+    // bytes per second for all transfers, zero is unlimited
+    API_ACCESS_FUNDAMENTAL(Construct, u32, bandwidth_limit, 0);
+    API_ACCESS_FUNDAMENTAL(Construct, u32, stack_size, 65536);
+  };
+
+  class Transfer {
+    API_ACCESS_FUNDAMENTAL(Transfer, Direction, direction, Direction::upload);
+    // the object path
+    API_ACCESS_COMPOUND(Transfer, var::String, path);
+    // the source or destination, it must be valid until the transfer ends
+    API_ACCESS_FUNDAMENTAL(Transfer, const fs::FileObject *, file, nullptr);
+    API_ACCESS_FUNDAMENTAL(Transfer, Priority, priority, Priority::normal);
+    // bytes per second for this transfer, zero is unlimited
+    API_ACCESS_FUNDAMENTAL(Transfer, u32, bandwidth_limit, 0);
+    // the size of a download for the progress total
+    API_ACCESS_FUNDAMENTAL(Transfer, size_t, size, 0);
+  };
+
+  using Callback = std::function<void()>;
+
+  explicit TransferManager(
+    Storage &storage,
+    const Construct &options = Construct());
+  ~TransferManager();
+
+  TransferManager(const TransferManager &) = delete;
+  TransferManager &operator=(const TransferManager &) = delete;
+
+  TransferManager &
+  submit(const Transfer &transfer, Callback callback = Callback());
+
+  // blocks until every submitted transfer has completed
+  TransferManager &wait();
+
+  API_NO_DISCARD size_t pending_count() const;
+  // the number of transfers that failed
+  API_NO_DISCARD u32 error_count() const;
+
+private:
+  class TokenBucket {
+  public:
+    // a full bucket holds one second of bytes
+    explicit TokenBucket(u32 rate);
+
+    // blocks until count bytes are allowed
+    void consume(size_t count);
+
+  private:
+    thread::Mutex m_mutex;
+    u32 m_rate;
+    double m_tokens;
+    std::chrono::steady_clock::time_point m_refill_time;
+  };
+
+  struct Pending {
+    Transfer transfer;
+    Callback callback;
+  };
+
+  static constexpr size_t priority_count = 3;
+
+  Storage *m_storage;
+  TokenBucket m_bucket;
+  mutable thread::Mutex m_mutex;
+  thread::Cond m_task_cond;
+  thread::Cond m_idle_cond;
+  // one queue for each priority
+  var::Queue<Pending> m_queues[priority_count];
+  var::Vector<std::unique_ptr<thread::Thread>> m_threads;
+  size_t m_active_count = 0;
+  bool m_is_stopping = false;
+  u64 m_total_size = 0;
+  u64 m_transferred_size = 0;
+  u32 m_error_count = 0;
+  // restored when the manager is destroyed
+  bool m_is_report_progress;
+
+  static void *work_function(void *args);
+  void work();
+  void execute(const Transfer &transfer);
+  void update_progress(size_t count);
+  bool is_queue_empty() const;
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_TRANSFERMANAGER_HPP
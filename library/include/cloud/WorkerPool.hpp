@@ -0,0 +1,69 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#ifndef CLOUDAPI_CLOUD_WORKERPOOL_HPP
+#define CLOUDAPI_CLOUD_WORKERPOOL_HPP
+
+#include <functional>
+#include <memory>
+
+#include <thread/Cond.hpp>
+#include <thread/Mutex.hpp>
+#include <thread/Thread.hpp>
+#include <var/Queue.hpp>
+#include <var/Vector.hpp>
+
+#include "CloudObject.hpp"
+
+namespace cloud {
+
+/*! \brief Worker Pool Class
+ *
+ * \details The worker pool runs submitted tasks on a fixed number of
+ * threads. It is used by the `*_async()` methods of `Database`, `Store`
+ * and `Storage` so that a single application thread can keep many requests
+ * in flight.
+ *
+ * Errors are tracked per thread. A completion callback runs on the worker
+ * thread, so it can check `is_success()` to see if the request worked. The
+ * worker error is reset after each task.
+ *
+ */
+class WorkerPool : public CloudObject {
+public:
+  using Task = std::function<void()>;
+
+  class Construct {
+    API_ACCESS_FUNDAMENTAL(Construct, u16, thread_count, 4);
+    API_ACCESS_FUNDAMENTAL(Construct, u32, stack_size, 65536);
+  };
+
+  explicit WorkerPool(const Construct &options = Construct());
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  WorkerPool &submit(Task task);
+
+  // blocks until every submitted task has completed
+  WorkerPool &wait();
+
+  API_NO_DISCARD size_t thread_count() const { return m_threads.count(); }
+  API_NO_DISCARD size_t pending_count() const;
+
+private:
+  mutable thread::Mutex m_mutex;
+  thread::Cond m_task_cond;
+  thread::Cond m_idle_cond;
+  var::Queue<Task> m_tasks;
+  var::Vector<std::unique_ptr<thread::Thread>> m_threads;
+  size_t m_active_count = 0;
+  bool m_is_stopping = false;
+
+  static void *work_function(void *args);
+  void work();
+};
+
+} // namespace cloud
+
+#endif // CLOUDAPI_CLOUD_WORKERPOOL_HPP
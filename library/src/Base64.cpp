@@ -0,0 +1,195 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <var.hpp>
+
+#include "cloud/Base64.hpp"
+
+using namespace cloud;
+
+namespace {
+
+constexpr char alphabet[]
+  = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+constexpr u8 invalid = 0xff;
+
+struct DecodeTable {
+  u8 value[256];
+  constexpr DecodeTable() : value() {
+    for (auto &entry : value) {
+      entry = invalid;
+    }
+    for (u8 i = 0; i < 64; i++) {
+      value[static_cast<u8>(alphabet[i])] = i;
+    }
+  }
+};
+
+constexpr DecodeTable decode_table;
+
+inline void encode_triple(const u8 *input, char *output) {
+  const u32 word = (u32(input[0]) << 16) | (u32(input[1]) << 8) | input[2];
+  output[0] = alphabet[(word >> 18) & 0x3f];
+  output[1] = alphabet[(word >> 12) & 0x3f];
+  output[2] = alphabet[(word >> 6) & 0x3f];
+  output[3] = alphabet[word & 0x3f];
+}
+
+// returns a value with bit 7 set if any character is invalid
+inline u32 decode_quad(const char *input, u8 *output) {
+  const u32 a = decode_table.value[static_cast<u8>(input[0])];
+  const u32 b = decode_table.value[static_cast<u8>(input[1])];
+  const u32 c = decode_table.value[static_cast<u8>(input[2])];
+  const u32 d = decode_table.value[static_cast<u8>(input[3])];
+  const u32 word = (a << 18) | (b << 12) | (c << 6) | d;
+  output[0] = u8(word >> 16);
+  output[1] = u8(word >> 8);
+  output[2] = u8(word);
+  return a | b | c | d;
+}
+
+} // namespace
+
+size_t Base64Codec::encode(var::View input, char *output) {
+  const u8 *source = input.to_const_u8();
+  size_t size = input.size();
+  char *destination = output;
+
+  while (size >= 12) {
+    encode_triple(source, destination);
+    encode_triple(source + 3, destination + 4);
+    encode_triple(source + 6, destination + 8);
+    encode_triple(source + 9, destination + 12);
+    source += 12;
+    destination += 16;
+    size -= 12;
+  }
+
+  while (size >= 3) {
+    encode_triple(source, destination);
+    source += 3;
+    destination += 4;
+    size -= 3;
+  }
+
+  if (size) {
+    const u8 last[3] = {source[0], size > 1 ? source[1] : u8(0), 0};
+    encode_triple(last, destination);
+    destination[3] = '=';
+    if (size == 1) {
+      destination[2] = '=';
+    }
+    destination += 4;
+  }
+
+  return size_t(destination - output);
+}
+
+void Base64Codec::encode(var::View input, var::String &output) {
+  // 192 bytes encode to 256 characters
+  char buffer[256];
+  const u8 *source = input.to_const_u8();
+  size_t size = input.size();
+  while (size) {
+    const size_t page_size = size < 192 ? size : 192;
+    const size_t length = encode(var::View(source, page_size), buffer);
+    output.append(var::StringView(buffer, length));
+    source += page_size;
+    size -= page_size;
+  }
+}
+
+int Base64Codec::decode(var::StringView input, void *output) {
+  size_t length = input.length();
+  if (length % 4 == 0) {
+    for (int i = 0; i < 2 && length && input.at(length - 1) == '='; i++) {
+      length--;
+    }
+  }
+
+  if (length % 4 == 1) {
+    return -1;
+  }
+
+  const char *source = input.data();
+  u8 *destination = reinterpret_cast<u8 *>(output);
+  u32 is_invalid = 0;
+
+  while (length >= 16) {
+    is_invalid |= decode_quad(source, destination);
+    is_invalid |= decode_quad(source + 4, destination + 3);
+    is_invalid |= decode_quad(source + 8, destination + 6);
+    is_invalid |= decode_quad(source + 12, destination + 9);
+    source += 16;
+    destination += 12;
+    length -= 16;
+  }
+
+  while (length >= 4) {
+    is_invalid |= decode_quad(source, destination);
+    source += 4;
+    destination += 3;
+    length -= 4;
+  }
+
+  if (length) {
+    // two or three characters without padding
+    const char last[4]
+      = {source[0], source[1], length > 2 ? source[2] : 'A', 'A'};
+    u8 bytes[3];
+    is_invalid |= decode_quad(last, bytes);
+    destination[0] = bytes[0];
+    if (length > 2) {
+      destination[1] = bytes[1];
+    }
+    destination += length - 1;
+  }
+
+  if (is_invalid & 0x80) {
+    return -1;
+  }
+
+  return int(destination - reinterpret_cast<u8 *>(output));
+}
+
+int Base64Codec::decode(var::StringView input, var::Data &output) {
+  output.resize(get_decoded_size(input.length()));
+  const int result = decode(input, output.data());
+  output.resize(result < 0 ? 0 : size_t(result));
+  return result;
+}
+
+Base64Codec::Encoder &Base64Codec::Encoder::feed(var::View chunk) {
+  const u8 *source = chunk.to_const_u8();
+  size_t size = chunk.size();
+
+  // complete the bytes left from the last chunk
+  while (m_pending_size && m_pending_size < 3 && size) {
+    m_pending[m_pending_size++] = *source++;
+    size--;
+  }
+
+  if (m_pending_size == 3) {
+    char buffer[4];
+    encode_triple(m_pending, buffer);
+    m_output->append(var::StringView(buffer, sizeof(buffer)));
+    m_pending_size = 0;
+  }
+
+  const size_t whole_size = size / 3 * 3;
+  encode(var::View(source, whole_size), *m_output);
+  source += whole_size;
+  size -= whole_size;
+
+  while (size) {
+    m_pending[m_pending_size++] = *source++;
+    size--;
+  }
+  return *this;
+}
+
+Base64Codec::Encoder &Base64Codec::Encoder::finish() {
+  encode(var::View(m_pending, m_pending_size), *m_output);
+  m_pending_size = 0;
+  return *this;
+}
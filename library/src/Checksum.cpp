@@ -0,0 +1,317 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <cstring>
+
+#include <var.hpp>
+
+#include "cloud/Base64.hpp"
+#include "cloud/Checksum.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CLOUD_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CLOUD_CRC32C_ARMV8 1
+#endif
+
+using namespace cloud;
+
+namespace {
+
+// the reflected Castagnoli polynomial
+constexpr u32 crc32c_polynomial = 0x82f63b78;
+
+// value[k][b] is the CRC of byte b followed by k zero bytes
+struct Crc32cTable {
+  u32 value[8][256];
+  constexpr Crc32cTable() : value() {
+    for (u32 i = 0; i < 256; i++) {
+      u32 crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (crc32c_polynomial & (0U - (crc & 1)));
+      }
+      value[0][i] = crc;
+    }
+    for (u32 i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) {
+        value[k][i]
+          = (value[k - 1][i] >> 8) ^ value[0][value[k - 1][i] & 0xff];
+      }
+    }
+  }
+};
+
+constexpr Crc32cTable crc32c_table;
+
+inline u32 load_u32(const u8 *data) {
+  // byte by byte so the result does not depend on the CPU byte order
+  return u32(data[0]) | (u32(data[1]) << 8) | (u32(data[2]) << 16)
+         | (u32(data[3]) << 24);
+}
+
+u32 update_table(u32 state, const u8 *data, size_t size) {
+  const auto &table = crc32c_table.value;
+  while (size >= 8) {
+    const u32 low = state ^ load_u32(data);
+    const u32 high = load_u32(data + 4);
+    state = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff]
+            ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+            ^ table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff]
+            ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+    data += 8;
+    size -= 8;
+  }
+  while (size--) {
+    state = (state >> 8) ^ table[0][(state ^ *data++) & 0xff];
+  }
+  return state;
+}
+
+#if CLOUD_CRC32C_SSE42
+__attribute__((target("sse4.2"))) u32
+update_hardware(u32 state, const u8 *data, size_t size) {
+  u64 value = state;
+  while (size >= 8) {
+    u64 word;
+    ::memcpy(&word, data, sizeof(word));
+    value = _mm_crc32_u64(value, word);
+    data += 8;
+    size -= 8;
+  }
+  state = u32(value);
+  while (size--) {
+    state = _mm_crc32_u8(state, *data++);
+  }
+  return state;
+}
+
+bool is_hardware_supported() {
+  static const bool result = __builtin_cpu_supports("sse4.2");
+  return result;
+}
+#elif CLOUD_CRC32C_ARMV8
+u32 update_hardware(u32 state, const u8 *data, size_t size) {
+  while (size >= 8) {
+    u64 word;
+    ::memcpy(&word, data, sizeof(word));
+    state = __crc32cd(state, word);
+    data += 8;
+    size -= 8;
+  }
+  while (size--) {
+    state = __crc32cb(state, *data++);
+  }
+  return state;
+}
+
+constexpr bool is_hardware_supported() { return true; }
+#endif
+
+// multiplies the 32x32 GF(2) matrix by vector
+u32 gf2_matrix_times(const u32 *matrix, u32 vector) {
+  u32 result = 0;
+  while (vector) {
+    if (vector & 1) {
+      result ^= *matrix;
+    }
+    vector >>= 1;
+    matrix++;
+  }
+  return result;
+}
+
+void gf2_matrix_square(u32 *square, const u32 *matrix) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = gf2_matrix_times(matrix, matrix[n]);
+  }
+}
+
+} // namespace
+
+Crc32c &Crc32c::update(var::View data) {
+  const u8 *bytes = data.to_const_u8();
+#if CLOUD_CRC32C_SSE42 || CLOUD_CRC32C_ARMV8
+  if (is_hardware_supported()) {
+    m_state = update_hardware(m_state, bytes, data.size());
+    return *this;
+  }
+#endif
+  m_state = update_table(m_state, bytes, data.size());
+  return *this;
+}
+
+var::String Crc32c::to_base64() const {
+  const u32 crc = value();
+  const u8 big_endian[4]
+    = {u8(crc >> 24), u8(crc >> 16), u8(crc >> 8), u8(crc)};
+  var::String result;
+  Base64Codec::encode(var::View(big_endian, sizeof(big_endian)), result);
+  return result;
+}
+
+u32 Crc32c::combine(u32 first, u32 second, u64 second_size) {
+  // appends second_size zero bytes to first, see crc32_combine() in zlib
+  if (second_size == 0) {
+    return first;
+  }
+
+  u32 even[32];
+  u32 odd[32];
+
+  // the operator for one zero bit
+  odd[0] = crc32c_polynomial;
+  u32 row = 1;
+  for (int n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+
+  // two zero bits then four zero bits
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+
+  // the first square gives one zero byte
+  do {
+    gf2_matrix_square(even, odd);
+    if (second_size & 1) {
+      first = gf2_matrix_times(even, first);
+    }
+    second_size >>= 1;
+    if (second_size == 0) {
+      break;
+    }
+
+    gf2_matrix_square(odd, even);
+    if (second_size & 1) {
+      first = gf2_matrix_times(odd, first);
+    }
+    second_size >>= 1;
+  } while (second_size);
+
+  return first ^ second;
+}
+
+Md5::Md5() : m_state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476} {}
+
+Md5 &Md5::update(var::View data) {
+  const u8 *bytes = data.to_const_u8();
+  size_t size = data.size();
+  size_t used = size_t(m_size % sizeof(m_block));
+  m_size += size;
+
+  if (used) {
+    const size_t page
+      = size < sizeof(m_block) - used ? size : sizeof(m_block) - used;
+    ::memcpy(m_block + used, bytes, page);
+    bytes += page;
+    size -= page;
+    used += page;
+    if (used < sizeof(m_block)) {
+      return *this;
+    }
+    process_block(m_state, m_block);
+  }
+
+  while (size >= sizeof(m_block)) {
+    process_block(m_state, bytes);
+    bytes += sizeof(m_block);
+    size -= sizeof(m_block);
+  }
+
+  if (size) {
+    ::memcpy(m_block, bytes, size);
+  }
+  return *this;
+}
+
+var::String Md5::to_base64() const {
+  // pad a copy so more data can still be added
+  u32 state[4] = {m_state[0], m_state[1], m_state[2], m_state[3]};
+  u8 block[128] = {};
+  const size_t used = size_t(m_size % 64);
+  ::memcpy(block, m_block, used);
+  block[used] = 0x80;
+
+  const size_t padded = used < 56 ? 64 : 128;
+  const u64 bits = m_size * 8;
+  for (int i = 0; i < 8; i++) {
+    block[padded - 8 + i] = u8(bits >> (8 * i));
+  }
+  process_block(state, block);
+  if (padded == 128) {
+    process_block(state, block + 64);
+  }
+
+  u8 digest[16];
+  for (int i = 0; i < 16; i++) {
+    digest[i] = u8(state[i / 4] >> (8 * (i % 4)));
+  }
+
+  var::String result;
+  Base64Codec::encode(var::View(digest, sizeof(digest)), result);
+  return result;
+}
+
+void Md5::process_block(u32 *state, const u8 *block) {
+  // RFC 1321
+  static constexpr u32 sine_table[64]
+    = {0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+       0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+       0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+       0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+       0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+       0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+       0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+       0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+       0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+       0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+       0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+  static constexpr u8 shift_table[16]
+    = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+  u32 word[16];
+  for (int i = 0; i < 16; i++) {
+    word[i] = load_u32(block + 4 * i);
+  }
+
+  u32 a = state[0];
+  u32 b = state[1];
+  u32 c = state[2];
+  u32 d = state[3];
+  for (int i = 0; i < 64; i++) {
+    const int round = i / 16;
+    u32 f;
+    int g;
+    switch (round) {
+    case 0:
+      f = (b & c) | (~b & d);
+      g = i;
+      break;
+    case 1:
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+      break;
+    case 2:
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+      break;
+    default:
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+      break;
+    }
+
+    const u32 sum = a + f + sine_table[i] + word[g];
+    const u8 shift = shift_table[round * 4 + i % 4];
+    a = d;
+    d = c;
+    c = b;
+    b += (sum << shift) | (sum >> (32 - shift));
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
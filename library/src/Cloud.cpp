@@ -5,25 +5,55 @@
 #include <json.hpp>
 #include <var.hpp>
 
+#include "cloud/Base64.hpp"
 #include "cloud/Cloud.hpp"
+#include "cloud/JsonStream.hpp"
+
+#if CLOUD_API_IS_EMULATOR
+#include "cloud/Emulator.hpp"
+#endif
 
 using namespace cloud;
 
 Cloud::Cloud(const var::StringView api_key, u32 lifetime)
   : m_ticket_lifetime(lifetime), m_api_key(api_key) {}
 
-void Cloud::SecureClient::assign_error_from_status() {
+void Cloud::SecureClient::assign_error_from_status(const inet::Http &http) {
+  assign_error_from_status(http.response().status());
+}
+
+void Cloud::SecureClient::assign_error_from_status(inet::Http::Status status) {
+  assign_error_from_status(status, var::StringView());
+}
+
+void Cloud::SecureClient::assign_error_from_status(
+  inet::Http::Status status,
+  var::StringView response_body) {
   API_RETURN_IF_ERROR();
 
-  if (m_client.response().status() == Http::Status::ok) {
+  if (is_success(status)) {
     return;
   }
 
-  const auto error_string = Http::to_string(m_client.response().status());
+  // Firestore and Storage send {"error":{"message":...}}, the Realtime
+  // Database sends {"error":"..."}
+  String message;
+  if (!response_body.is_empty()) {
+    const auto error
+      = JsonDocument().from_string(response_body).to_object().at("error");
+    message = String(
+      error.is_string() ? error.to_string_view()
+                        : error.to_object().at("message").to_string_view());
+    // the body may not be JSON
+    API_RESET_ERROR();
+  }
+  const auto error_string = message.is_empty()
+                              ? String(Http::to_string(status).string_view())
+                              : message;
   int error_number = EINVAL;
-  if (m_client.response().status() == Http::Status::not_found) {
+  if (status == Http::Status::not_found) {
     error_number = ENOENT;
-  } else if (m_client.response().status() == Http::Status::forbidden) {
+  } else if (status == Http::Status::forbidden) {
     error_number = EPERM;
   }
 
@@ -44,6 +74,113 @@ bool Cloud::is_logged_in() const {
   return credentials().get_token_timestamp().age() < 1_hours;
 }
 
+Cloud &Cloud::set_host(var::StringView default_host, var::StringView host) {
+  for (auto &item : m_host_list) {
+    if (item.default_host.string_view() == default_host) {
+      item.host = host;
+      return *this;
+    }
+  }
+  m_host_list.push_back({var::PathString(default_host), var::PathString(host)});
+  return *this;
+}
+
+var::StringView Cloud::get_host(var::StringView default_host) const {
+  for (const auto &item : m_host_list) {
+    if (item.default_host.string_view() == default_host) {
+      return item.host.string_view();
+    }
+  }
+  return default_host;
+}
+
+Cloud::SecureClient &Cloud::SecureClient::execute(
+  ConnectionPool::Lease &connection,
+  inet::Http::Method method,
+  var::StringView url,
+  const inet::HttpClient::ExecuteMethod &options) {
+  API_RETURN_VALUE_IF_ERROR(*this);
+  const auto status = execute_request(connection, method, url, options);
+  API_RETURN_VALUE_IF_ERROR(*this);
+  assign_error_from_status(status);
+  return *this;
+}
+
+inet::Http::Status Cloud::SecureClient::execute_request(
+  ConnectionPool::Lease &connection,
+  inet::Http::Method method,
+  var::StringView url,
+  const inet::HttpClient::ExecuteMethod &options) {
+  API_RETURN_VALUE_IF_ERROR(Http::Status::null);
+
+#if CLOUD_API_IS_EMULATOR
+  if (m_cloud.emulator()) {
+    // the emulator routes by service, so it gets the default host
+    String response_header_fields;
+    const auto status = m_cloud.emulator()->execute(
+      Emulator::Request()
+        .set_method(method)
+        .set_host(default_host())
+        .set_url(url)
+        .set_header_fields(connection.header_fields())
+        .set_body(options.request())
+        .set_response(options.response())
+        .set_response_header_fields(&response_header_fields)
+        .set_response_status(&connection.status()));
+    connection.header_fields() = std::move(response_header_fields);
+    return status;
+  }
+#endif
+
+  interface_add_header_fields(connection.client());
+  connection.client().execute_method(method, url, options);
+
+  {
+    thread::Mutex::Scope m_scope(m_mutex);
+    m_traffic = connection.client().traffic();
+  }
+
+  if (is_error()) {
+    // the connection state is unknown after a transport error
+    connection.discard();
+    return Http::Status::null;
+  }
+
+  return connection.client().response().status();
+}
+
+Cloud::SecureClient &Cloud::SecureClient::add_header_field(
+  ConnectionPool::Lease &connection,
+  var::StringView key,
+  var::StringView value) {
+  if (is_emulated()) {
+    connection.header_fields().append(key).append(": ").append(value).append(
+      "\r\n");
+  } else {
+    connection.client().add_header_field(key, value);
+  }
+  return *this;
+}
+
+var::String Cloud::SecureClient::get_header_field(
+  ConnectionPool::Lease &connection,
+  var::StringView key) {
+#if CLOUD_API_IS_EMULATOR
+  if (is_emulated()) {
+    return Emulator::get_header_field(connection.header_fields(), key);
+  }
+#endif
+  return String(connection.client().get_header_field(key));
+}
+
+inet::Http::Status
+Cloud::SecureClient::get_status(ConnectionPool::Lease &connection) {
+  if (is_emulated()) {
+    return connection.status();
+  }
+  return connection.client().response().status();
+}
+
 var::String Cloud::SecureClient::execute_method(
   inet::Http::Method method,
   var::StringView url,
@@ -52,36 +189,80 @@ var::String Cloud::SecureClient::execute_method(
   fs::DataFile response_file(fs::OpenMode::append_write_only());
   auto request_file = fs::ViewFile(View(request));
 
-  {
-    thread::Mutex::Scope m_scope(mutex());
-    http_client().execute_method(
-      method,
-      url,
-      HttpClient::ExecuteMethod()
-        .set_request(request.is_empty() ? nullptr : &request_file)
-        .set_response(&response_file));
-  }
-
-  assign_error_from_status();
+  execute(
+    method,
+    url,
+    HttpClient::ExecuteMethod()
+      .set_request(request.is_empty() ? nullptr : &request_file)
+      .set_response(&response_file));
 
   return String(response_file.data());
 }
 
+Cloud::SecureClient &Cloud::SecureClient::execute_method(
+  inet::Http::Method method,
+  var::StringView url,
+  var::StringView request,
+  JsonHandler &handler) {
+
+  JsonStreamParser parser(handler);
+  auto connection = checkout();
+  String error_body;
+  auto request_file = fs::ViewFile(View(request));
+  auto response_file = fs::LambdaFile().set_write_callback(
+    [&](int location, const var::View view) -> int {
+      MCU_UNUSED_ARGUMENT(location);
+      if (!is_success(get_status(connection))) {
+        // an error body is not for the handler, it gives the error message
+        error_body.append(
+          var::StringView(view.to_const_char(), view.size()));
+        return int(view.size());
+      }
+      // parse errors are reported after the status is checked
+      parser.feed(view);
+      return int(view.size());
+    });
+
+  const auto status = execute_request(
+    connection,
+    method,
+    url,
+    HttpClient::ExecuteMethod()
+      .set_request(request.is_empty() ? nullptr : &request_file)
+      .set_response(&response_file));
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  assign_error_from_status(status, error_body.string_view());
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  if (parser.finish() < 0) {
+    if (parser.is_stopped()) {
+      // the handler did not assign an error, it stopped on purpose
+      API_RETURN_VALUE_ASSIGN_ERROR(
+        *this,
+        "JSON handler stopped parsing",
+        ECANCELED);
+    }
+    API_RETURN_VALUE_ASSIGN_ERROR(*this, "failed to parse JSON response", EBADMSG);
+  }
+
+  return *this;
+}
+
 json::JsonValue Cloud::SecureClient::execute_method(
   inet::Http::Method method,
   var::StringView path,
   const json::JsonObject &request) {
 
-  String string_request = !request.is_empty()
-                            ? JsonDocument()
-                                .set_flags(JsonDocument::Flags::compact)
-                                .to_string(request)
-                            : String();
+  const String string_request = !request.is_empty()
+                                  ? JsonDocument()
+                                      .set_flags(JsonDocument::Flags::compact)
+                                      .to_string(request)
+                                  : String();
 
-  String string_response = execute_method(method, path, string_request);
-  return string_response.is_empty()
-           ? JsonObject()
-           : JsonDocument().from_string(string_response).to_object();
+  JsonTreeBuilder builder;
+  execute_method(method, path, string_request, builder);
+  return builder.value().is_valid() ? builder.value() : JsonObject();
 }
 
 json::JsonValue Cloud::SecureClient::execute_get_json(var::StringView path) {
@@ -92,9 +273,7 @@ Cloud &Cloud::login(var::StringView email, var::StringView password) {
   const String path
     = "/identitytoolkit/v3/relyingparty/verifyPassword?key=" + api_key();
 
-  SecureClient client(*this, "");
-  client.client().connect(identity_host());
-  API_RETURN_VALUE_IF_ERROR(*this);
+  SecureClient client(*this, "", identity_host());
 
   credentials().clear();
   API_RETURN_VALUE_IF_ERROR(*this);
@@ -128,8 +307,7 @@ Cloud &Cloud::refresh_login() {
 
   const PathString path = "/v1/token?key=" & api_key();
 
-  SecureClient client(*this, "");
-  client.client().connect(refresh_login_host());
+  SecureClient client(*this, "", refresh_login_host());
 
   JsonObject response_object = client.execute_method(
     Http::Method::post,
@@ -160,6 +338,69 @@ CloudMap CloudMap::from_json(const json::JsonObject &input) {
   return result;
 }
 
+json::JsonObject CloudMap::from_json_value(const json::JsonValue &input) {
+  JsonObject result;
+  import_value(&result, nullptr, "value", input);
+  return result.at("value").to_object();
+}
+
+json::JsonObject CloudMap::create_timestamp(var::StringView rfc3339) {
+  return JsonObject().insert(
+    "timestampValue",
+    JsonString(String(rfc3339).cstring()));
+}
+
+json::JsonObject CloudMap::create_timestamp(const chrono::DateTime &value) {
+  const time_t seconds = value.ctime();
+  struct tm utc;
+  gmtime_r(&seconds, &utc);
+  char buffer[32];
+  strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &utc);
+  return create_timestamp(buffer);
+}
+
+json::JsonObject CloudMap::create_bytes(var::View data) {
+  String encoded;
+  Base64Codec::encode(data, encoded);
+  return JsonObject().insert("bytesValue", JsonString(encoded.cstring()));
+}
+
+json::JsonObject CloudMap::create_reference(var::StringView document_name) {
+  return JsonObject().insert(
+    "referenceValue",
+    JsonString(String(document_name).cstring()));
+}
+
+json::JsonObject CloudMap::create_geo_point(double latitude, double longitude) {
+  // parsed from text because JsonReal only holds a float
+  return JsonDocument()
+    .from_string(String().format(
+      "{\"geoPointValue\":{\"latitude\":%.17g,\"longitude\":%.17g}}",
+      latitude,
+      longitude))
+    .to_object();
+}
+
+var::Data CloudMap::get_bytes(const json::JsonValue &value) {
+  Data result;
+  if (value.is_object()) {
+    Base64Codec::decode(
+      value.to_object().at("bytesValue").to_string_view(),
+      result);
+  }
+  return result;
+}
+
+bool CloudMap::is_typed_value(const json::JsonValue &value) {
+  if (!value.is_object() || value.to_object().count() != 1) {
+    return false;
+  }
+  const auto key_list = value.to_object().get_key_list();
+  const var::StringView key = key_list.at(0);
+  return key == "timestampValue" || key == "bytesValue"
+         || key == "referenceValue" || key == "geoPointValue";
+}
+
 json::JsonObject CloudMap::to_json() {
   JsonObject result;
   export_json_recursive(&result, nullptr, to_object());
@@ -213,6 +454,14 @@ int CloudMap::import_value(
       // this will return -1 if an array is inserted in an array
       return -1;
     }
+  } else if (is_typed_value(value)) {
+    // already a Firestore value such as {"timestampValue": "..."}
+    if (object) {
+      object->insert(key, value);
+    }
+    if (array) {
+      array->append(value);
+    }
   } else if (value.is_object()) {
     JsonObject map_result;
     map_result.insert(("fields"), JsonObject());
@@ -391,6 +640,17 @@ int CloudMap::export_value(
     if (keys.at(0) == var::StringView("mapValue")) {
       return export_map(object, array, key, value);
     }
+    if (is_typed_value(value)) {
+      // exported as is so that importing it again keeps the type
+      if (object) {
+        object->insert(key, value);
+        return object->return_value();
+      }
+      if (array) {
+        array->append(value);
+        return array->return_value();
+      }
+    }
   }
   return -1;
 }
@@ -416,12 +676,22 @@ int CloudMap::export_integer(
   json::JsonArray *array,
   const var::StringView key,
   const json::JsonObject &value) {
+  // int64 values arrive as strings, they are exported as numbers (as
+  // CloudMapDecoder does)
+  json::JsonValue integer = value.at("integerValue");
+  if (integer.is_string()) {
+    const auto number
+      = JsonTreeBuilder::create_number(integer.to_string_view());
+    if (number.is_valid()) {
+      integer = number;
+    }
+  }
   if (object) {
-    object->insert(key, value.at(("integerValue")));
+    object->insert(key, integer);
     return object->return_value();
   }
   if (array) {
-    array->append(value.at(("integerValue")));
+    array->append(integer);
     return array->return_value();
   }
   return -1;
@@ -0,0 +1,488 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <json.hpp>
+#include <var.hpp>
+
+#include "cloud/CloudMapStream.hpp"
+
+using namespace cloud;
+
+namespace {
+
+bool is_integer(var::StringView value) {
+  return value.find(".") == var::StringView::npos
+         && value.find("e") == var::StringView::npos
+         && value.find("E") == var::StringView::npos;
+}
+
+bool is_typed_key(var::StringView key) {
+  return key == "timestampValue" || key == "bytesValue"
+         || key == "referenceValue" || key == "geoPointValue";
+}
+
+// passes the events of json to handler
+int replay(var::StringView json, JsonHandler &handler) {
+  JsonStreamParser parser(handler);
+  return (parser.feed(var::View(json)) < 0 || parser.finish() < 0) ? -1 : 0;
+}
+
+} // namespace
+
+var::String CloudMapEncoder::encode(var::StringView json) {
+  var::String result;
+  JsonWriter writer(result);
+  CloudMapEncoder encoder(writer);
+  JsonStreamParser parser(encoder);
+  if (
+    parser.feed(var::View(json)) < 0 || parser.finish() < 0
+    || !parser.is_complete()) {
+    return var::String();
+  }
+  return result;
+}
+
+var::String CloudMapEncoder::encode(const json::JsonObject &object) {
+  // jansson writes the text much faster than CloudMap builds a second tree
+  return encode(json::JsonDocument()
+                  .set_flags(json::JsonDocument::Flags::compact)
+                  .to_string(object)
+                  .string_view());
+}
+
+int CloudMapEncoder::begin_object() {
+  if (m_stack.count() == 0) {
+    // the document
+    m_stack.push_back(Container::object);
+    return (m_output->begin_object() < 0 || m_output->key("fields") < 0
+            || m_output->begin_object() < 0)
+             ? -1
+             : 0;
+  }
+
+  if (is_raw()) {
+    m_stack.push_back(Container::raw);
+    return raw_output()->begin_object();
+  }
+
+  // the first key shows if this is a map or a typed value
+  m_stack.push_back(Container::pending);
+  return 0;
+}
+
+int CloudMapEncoder::end_object() {
+  const Container container = m_stack.back();
+  m_stack.pop_back();
+  switch (container) {
+  case Container::typed:
+    return end_typed_value();
+  case Container::raw:
+    return raw_output()->end_object();
+  case Container::pending:
+    // an empty map
+    if (begin_map() < 0) {
+      return -1;
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (m_stack.count() == 0) {
+    return (m_output->end_object() < 0 || m_output->end_object() < 0) ? -1 : 0;
+  }
+
+  return (m_output->end_object() < 0 || m_output->end_object() < 0
+          || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::begin_array() {
+  if (m_stack.count() == 0) {
+    // a document must be an object
+    return -1;
+  }
+
+  if (is_raw()) {
+    m_stack.push_back(Container::raw);
+    return raw_output()->begin_array();
+  }
+
+  if (m_stack.back() == Container::array) {
+    // arrays cannot contain arrays
+    return -1;
+  }
+
+  m_stack.push_back(Container::array);
+  return (begin_typed_value("arrayValue") < 0 || m_output->begin_object() < 0
+          || m_output->key("values") < 0 || m_output->begin_array() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::end_array() {
+  const Container container = m_stack.back();
+  m_stack.pop_back();
+  if (container == Container::raw) {
+    return raw_output()->end_array();
+  }
+
+  return (m_output->end_array() < 0 || m_output->end_object() < 0
+          || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::key(var::StringView key) {
+  switch (m_stack.back()) {
+  case Container::pending:
+    if (is_typed_key(key)) {
+      m_stack.back() = Container::typed;
+      m_typed_key = var::String(key);
+      return 0;
+    }
+    m_stack.back() = Container::object;
+    return (begin_map() < 0 || m_output->key(key) < 0) ? -1 : 0;
+  case Container::typed:
+    // as in CloudMap::is_typed_value(), more than one member is a map
+    return (begin_typed_map() < 0 || m_output->key(key) < 0) ? -1 : 0;
+  case Container::raw:
+    return raw_output()->key(key);
+  default:
+    return m_output->key(key);
+  }
+}
+
+int CloudMapEncoder::string(var::StringView value) {
+  if (is_raw()) {
+    return raw_output()->string(value);
+  }
+
+  return (begin_typed_value("stringValue") < 0 || m_output->string(value) < 0
+          || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::number(var::StringView value) {
+  if (is_raw()) {
+    return raw_output()->number(value);
+  }
+
+  if (is_integer(value)) {
+    // int64 values are strings in the Firestore JSON format
+    return (begin_typed_value("integerValue") < 0
+            || m_output->string(value) < 0 || m_output->end_object() < 0)
+             ? -1
+             : 0;
+  }
+
+  return (begin_typed_value("doubleValue") < 0 || m_output->number(value) < 0
+          || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::boolean(bool value) {
+  if (is_raw()) {
+    return raw_output()->boolean(value);
+  }
+
+  return (begin_typed_value("booleanValue") < 0
+          || m_output->boolean(value) < 0 || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::null() {
+  if (is_raw()) {
+    return raw_output()->null();
+  }
+
+  return (begin_typed_value("nullValue") < 0 || m_output->null() < 0
+          || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+bool CloudMapEncoder::is_raw() const {
+  return m_stack.count()
+         && (m_stack.back() == Container::typed
+             || m_stack.back() == Container::raw);
+}
+
+JsonHandler *CloudMapEncoder::raw_output() {
+  // raw values are only inside a typed container, which is held back
+  return &m_typed_writer;
+}
+
+int CloudMapEncoder::end_typed_value() {
+  // {"timestampValue":"..."} is passed on as it is
+  const var::String value = std::move(m_typed_value);
+  m_typed_value = var::String();
+  return (m_output->begin_object() < 0 || m_output->key(m_typed_key) < 0
+          || replay(value, *m_output) < 0 || m_output->end_object() < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::begin_typed_map() {
+  // the held member is encoded as an ordinary field of the map
+  const var::String key = std::move(m_typed_key);
+  const var::String value = std::move(m_typed_value);
+  m_typed_key = var::String();
+  m_typed_value = var::String();
+  m_stack.back() = Container::object;
+  return (begin_map() < 0 || m_output->key(key) < 0 || replay(value, *this) < 0)
+           ? -1
+           : 0;
+}
+
+int CloudMapEncoder::begin_typed_value(var::StringView type) {
+  if (m_stack.count() == 0) {
+    // scalars are not documents
+    return -1;
+  }
+  return (m_output->begin_object() < 0 || m_output->key(type) < 0) ? -1 : 0;
+}
+
+int CloudMapEncoder::begin_map() {
+  return (begin_typed_value("mapValue") < 0 || m_output->begin_object() < 0
+          || m_output->key("fields") < 0 || m_output->begin_object() < 0)
+           ? -1
+           : 0;
+}
+
+var::String CloudMapDecoder::decode(var::StringView document) {
+  var::String result;
+  JsonWriter writer(result);
+  CloudMapDecoder decoder(writer);
+  JsonStreamParser parser(decoder);
+  if (
+    parser.feed(var::View(document)) < 0 || parser.finish() < 0
+    || !parser.is_complete()) {
+    return var::String();
+  }
+  return result;
+}
+
+int CloudMapDecoder::begin_object() {
+  const int result = push_object();
+  m_is_member_wanted = false;
+  return result;
+}
+
+int CloudMapDecoder::push_object() {
+  if (m_stack.count() == 0) {
+    m_stack.push_back(Frame::document);
+    return m_output->begin_object();
+  }
+
+  switch (m_stack.back()) {
+  case Frame::fields:
+  case Frame::values:
+    m_stack.push_back(Frame::value);
+    return 0;
+
+  case Frame::document:
+  case Frame::map_value:
+    m_stack.push_back(m_is_member_wanted ? Frame::fields : Frame::skip);
+    return 0;
+
+  case Frame::value:
+    switch (m_type) {
+    case Type::map:
+      m_stack.push_back(Frame::map_value);
+      return m_output->begin_object();
+    case Type::array:
+      m_stack.push_back(Frame::array_value);
+      return m_output->begin_array();
+    default:
+      m_stack.push_back(Frame::skip);
+      return 0;
+    }
+
+  case Frame::typed_value:
+  case Frame::pass_through:
+    // for example the latitude and longitude of a geoPointValue
+    m_stack.push_back(Frame::pass_through);
+    return m_output->begin_object();
+
+  default:
+    m_stack.push_back(Frame::skip);
+    return 0;
+  }
+}
+
+int CloudMapDecoder::end_object() {
+  const Frame frame = m_stack.back();
+  m_stack.pop_back();
+  switch (frame) {
+  case Frame::document:
+  case Frame::map_value:
+  case Frame::typed_value:
+  case Frame::pass_through:
+    return m_output->end_object();
+  case Frame::array_value:
+    return m_output->end_array();
+  default:
+    return 0;
+  }
+}
+
+int CloudMapDecoder::begin_array() {
+  if (m_stack.count() == 0) {
+    return -1;
+  }
+
+  const Frame frame = m_stack.back();
+  if (frame == Frame::array_value && m_is_member_wanted) {
+    m_stack.push_back(Frame::values);
+    return 0;
+  }
+
+  if (frame == Frame::pass_through || frame == Frame::typed_value) {
+    m_stack.push_back(Frame::pass_through);
+    return m_output->begin_array();
+  }
+
+  m_stack.push_back(Frame::skip);
+  return 0;
+}
+
+int CloudMapDecoder::end_array() {
+  const Frame frame = m_stack.back();
+  m_stack.pop_back();
+  return frame == Frame::pass_through ? m_output->end_array() : 0;
+}
+
+int CloudMapDecoder::key(var::StringView key) {
+  switch (m_stack.back()) {
+  case Frame::fields:
+  case Frame::typed_value:
+  case Frame::pass_through:
+    return m_output->key(key);
+  case Frame::value:
+    m_type = get_type(key);
+    if (m_type == Type::typed) {
+      // kept as {"timestampValue":"..."} so the type is not lost
+      m_stack.back() = Frame::typed_value;
+      return (m_output->begin_object() < 0 || m_output->key(key) < 0) ? -1
+                                                                       : 0;
+    }
+    return 0;
+  case Frame::document:
+  case Frame::map_value:
+    m_is_member_wanted = key == "fields";
+    return 0;
+  case Frame::array_value:
+    m_is_member_wanted = key == "values";
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+int CloudMapDecoder::string(var::StringView value) {
+  if (m_stack.count() == 0) {
+    return -1;
+  }
+
+  if (is_pass_through()) {
+    return m_output->string(value);
+  }
+
+  if (m_stack.back() != Frame::value) {
+    return 0;
+  }
+
+  switch (m_type) {
+  case Type::string:
+    return m_output->string(value);
+  case Type::integer:
+    // int64 values arrive as strings
+    return m_output->number(value);
+  case Type::real:
+    // NaN and Infinity have no plain JSON form
+    return m_output->null();
+  default:
+    return scalar(m_type);
+  }
+}
+
+int CloudMapDecoder::number(var::StringView value) {
+  if (m_stack.count() == 0) {
+    return -1;
+  }
+
+  if (
+    is_pass_through()
+    || (m_stack.back() == Frame::value
+        && (m_type == Type::integer || m_type == Type::real))) {
+    return m_output->number(value);
+  }
+  return m_stack.back() == Frame::value ? scalar(m_type) : 0;
+}
+
+int CloudMapDecoder::boolean(bool value) {
+  if (m_stack.count() == 0) {
+    return -1;
+  }
+
+  if (
+    is_pass_through()
+    || (m_stack.back() == Frame::value && m_type == Type::boolean)) {
+    return m_output->boolean(value);
+  }
+  return m_stack.back() == Frame::value ? scalar(m_type) : 0;
+}
+
+int CloudMapDecoder::null() {
+  if (m_stack.count() == 0) {
+    return -1;
+  }
+
+  if (is_pass_through()) {
+    return m_output->null();
+  }
+  return m_stack.back() == Frame::value ? scalar(m_type) : 0;
+}
+
+bool CloudMapDecoder::is_pass_through() const {
+  return m_stack.back() == Frame::pass_through
+         || m_stack.back() == Frame::typed_value;
+}
+
+int CloudMapDecoder::scalar(Type type) {
+  // nullValue is sent as null or "NULL_VALUE"; other mismatches are ignored
+  return type == Type::null ? m_output->null() : 0;
+}
+
+CloudMapDecoder::Type CloudMapDecoder::get_type(var::StringView key) {
+  // ordered by how often the types appear in typical documents
+  if (key == "stringValue") {
+    return Type::string;
+  }
+  if (key == "integerValue") {
+    return Type::integer;
+  }
+  if (key == "doubleValue") {
+    return Type::real;
+  }
+  if (key == "booleanValue") {
+    return Type::boolean;
+  }
+  if (key == "mapValue") {
+    return Type::map;
+  }
+  if (key == "arrayValue") {
+    return Type::array;
+  }
+  if (key == "nullValue") {
+    return Type::null;
+  }
+  if (is_typed_key(key)) {
+    return Type::typed;
+  }
+  return Type::unknown;
+}
@@ -0,0 +1,125 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <chrono.hpp>
+#include <inet.hpp>
+#include <var.hpp>
+
+#include "cloud/ConnectionPool.hpp"
+
+using namespace cloud;
+
+void ConnectionPool::Lease::release() {
+  if (m_pool && m_connection) {
+    m_pool->checkin(m_connection);
+  }
+  m_pool = nullptr;
+  m_connection = nullptr;
+}
+
+ConnectionPool::ConnectionPool() : m_idle_timeout(30_seconds), m_cond(m_mutex) {}
+
+ConnectionPool::Lease ConnectionPool::checkout(var::StringView host) {
+  Connection *result = nullptr;
+  {
+    thread::Mutex::Scope m_scope(m_mutex);
+    do {
+      remove_idle(false);
+      for (auto &connection : m_connections) {
+        if (
+          !connection->m_is_checked_out && connection->host() == host
+          && is_open(*connection)) {
+          result = connection.get();
+          break;
+        }
+      }
+
+      if (result == nullptr && count_for_host(host) < max_connections_per_host()) {
+        m_connections.push_back(std::make_unique<Connection>(host));
+        result = m_connections.back().get();
+      }
+
+      if (result == nullptr) {
+        // every connection to the host is busy
+        m_cond.wait();
+      }
+    } while (result == nullptr);
+
+    result->m_is_checked_out = true;
+    result->m_is_reusable = true;
+  }
+
+  // connecting is slow, so it happens outside of the pool lock
+  if (!is_open(*result)) {
+    result->client().connect(host);
+  }
+
+  return Lease(*this, result);
+}
+
+void ConnectionPool::checkin(Connection *connection) {
+  thread::Mutex::Scope m_scope(m_mutex);
+  connection->m_is_checked_out = false;
+  connection->m_idle_timer.restart();
+  if (!connection->m_is_reusable || !is_open(*connection)) {
+    for (size_t i = 0; i < m_connections.count(); i++) {
+      if (m_connections.at(i).get() == connection) {
+        m_connections.remove(i);
+        break;
+      }
+    }
+  }
+  m_cond.signal();
+}
+
+ConnectionPool &ConnectionPool::evict_idle() {
+  thread::Mutex::Scope m_scope(m_mutex);
+  remove_idle(false);
+  return *this;
+}
+
+ConnectionPool &ConnectionPool::clear() {
+  thread::Mutex::Scope m_scope(m_mutex);
+  remove_idle(true);
+  return *this;
+}
+
+size_t ConnectionPool::connection_count() const {
+  thread::Mutex::Scope m_scope(m_mutex);
+  return m_connections.count();
+}
+
+size_t ConnectionPool::connection_count(var::StringView host) const {
+  thread::Mutex::Scope m_scope(m_mutex);
+  return count_for_host(host);
+}
+
+void ConnectionPool::remove_idle(bool is_all) {
+  // caller must hold m_mutex
+  size_t i = 0;
+  while (i < m_connections.count()) {
+    const auto &connection = m_connections.at(i);
+    if (
+      !connection->m_is_checked_out
+      && (is_all || connection->m_idle_timer.micro_time() > idle_timeout())) {
+      m_connections.remove(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+size_t ConnectionPool::count_for_host(var::StringView host) const {
+  // caller must hold m_mutex
+  size_t result = 0;
+  for (const auto &connection : m_connections) {
+    if (connection->host() == host) {
+      result++;
+    }
+  }
+  return result;
+}
+
+bool ConnectionPool::is_open(const Connection &connection) const {
+  // an emulator handles the requests of an emulated connection
+  return is_emulated() || connection.client().is_connected();
+}
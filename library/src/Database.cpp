@@ -5,72 +5,74 @@
 
 #include "cloud/Database.hpp"
 
+#if CLOUD_API_IS_EMULATOR
+#include "cloud/Emulator.hpp"
+#endif
+
 using namespace cloud;
 
 Database::Database(const Cloud &cloud, const var::StringView database_project)
-  : Cloud::SecureClient(cloud, database_project) {}
-
-Database &Database::listen(
-  const var::StringView path,
-  const fs::FileObject &destination,
-  thread::Mutex *lock_on_receive) {
+  : Cloud::SecureClient(cloud, database_project) {
+  interface_set_host(database_host());
+}
 
+Database &Database::listen(var::StringView path, EventCallback callback) {
   HttpSecureClient http_client;
-  const String url = "/" + path + ".json" + (credentials().get_token().is_empty() == false ? (String("?auth=") + credentials().get_token()) : String());
+  return listen(path, http_client, std::move(callback));
+}
 
-  struct ListenContext {
-    var::String incoming;
-    thread::Mutex *lock_on_receive = nullptr;
-    const fs::FileObject *file = nullptr;
-  };
+Database &Database::listen(
+  var::StringView path,
+  inet::HttpSecureClient &client,
+  EventCallback callback) {
 
-  ListenContext listen_context;
-  listen_context.file = &destination;
-  listen_context.lock_on_receive = lock_on_receive;
+  const String url = "/" + path + ".json" + (credentials().get_token().is_empty() == false ? (String("?auth=") + credentials().get_token()) : String());
 
+  EventStreamParser parser(std::move(callback));
   auto response_file = LambdaFile().set_write_callback(
     [&](int location, const var::View view) -> int {
       MCU_UNUSED_ARGUMENT(location);
+      return parser.feed(view);
+    });
 
-      auto incoming = String{};
-      incoming += String(View(view).to_const_char(), return_value());
-
-      size_t end = StringView(incoming).find("\n\n");
-
-      if (end != StringView::npos) {
-
-        StringViewList line_list = incoming.split("\n");
-
-        if (line_list.count() > 1) {
-          const auto data_colon_pos = line_list.at(1).find(":");
-          if (data_colon_pos != String::npos) {
-            const auto json_string
-              = line_list.at(1).get_substring_at_position(data_colon_pos + 1);
-            {
-              thread::Mutex::Scope m_scope(lock_on_receive);
-              const auto result = destination.write(json_string).return_value();
-              if (result < 0) {
-                return result;
-              }
-            }
-          }
-          incoming.clear();
-        }
-      }
+#if CLOUD_API_IS_EMULATOR
+  if (cloud().emulator()) {
+    assign_error_from_status(cloud().emulator()->execute(
+      Emulator::Request()
+        .set_host(default_host())
+        .set_url(url)
+        .set_header_fields("Accept: text/event-stream\r\n")
+        .set_response(&response_file)));
+    return *this;
+  }
+#endif
 
-      return int(view.size());
-    });
+  if (!client.is_connected()) {
+    client.connect(host());
+  }
 
   auto response = Http::MethodResponse(std::move(response_file));
-  http_client.add_header_field("Accept", "text/event-stream")
-    .connect(database_host())
-    .get(url, response);
+  client.add_header_field("Accept", "text/event-stream").get(url, response);
 
-  assign_error_from_status();
+  assign_error_from_status(client);
 
   return *this;
 }
 
+Database &Database::listen(
+  const var::StringView path,
+  const fs::FileObject &destination,
+  thread::Mutex *lock_on_receive) {
+  return listen(path, [&](const Event &event) -> int {
+    if (
+      event.type() != Event::Type::put && event.type() != Event::Type::patch) {
+      return 0;
+    }
+    thread::Mutex::Scope m_scope(lock_on_receive);
+    return destination.write(event.data()).return_value();
+  });
+}
+
 Database &Database::get_value(
   var::StringView path,
   const fs::FileObject &dest,
@@ -80,28 +82,33 @@ Database &Database::get_value(
   const auto url = "/" + path + ".json" +
                           (is_shallow_bool ? String("?shallow=true") : String())
                           + (credentials().get_token().is_empty() == false ? ((is_shallow_bool ? String("&") : String("?")) + "auth=" + credentials().get_token()) : String());
-  thread::Mutex::Scope(mutex(), [&]() {
-    refresh_http_client_database_headers();
-    http_client().get(url, HttpClient::Get().set_response(&dest));
-    assign_error_from_status();
-  });
+  execute(
+    Http::Method::get,
+    url,
+    HttpClient::ExecuteMethod().set_response(&dest));
   return *this;
 }
 
 json::JsonValue
 Database::get_value(var::StringView path, IsRequestShallow is_shallow) {
 
-  fs::DataFile response;
+  JsonTreeBuilder builder;
+  JsonStreamParser parser(builder);
+  auto response = LambdaFile().set_write_callback(
+    [&](int location, const var::View view) -> int {
+      MCU_UNUSED_ARGUMENT(location);
+      parser.feed(view);
+      return int(view.size());
+    });
 
   get_value(path, response, is_shallow);
+  API_RETURN_VALUE_IF_ERROR({});
 
-  if (response.size() == 0) {
-    return {};
+  if (parser.finish() < 0) {
+    API_RETURN_VALUE_ASSIGN_ERROR({}, "failed to parse JSON value", EBADMSG);
   }
 
-  return JsonDocument()
-    .set_flags(JsonDocument::Flags::decode_any)
-    .load(response.seek(0));
+  return builder.value();
 }
 
 var::KeyString Database::create_object(
@@ -110,9 +117,6 @@ var::KeyString Database::create_object(
   var::StringView id) {
   const auto url = !id.is_empty() ? get_database_url_path(path / id)
                                   : get_database_url_path(path);
-  thread::Mutex::Scope(mutex(), [&]() {
-    refresh_http_client_database_headers();
-  });
   const auto method = id.is_empty() ? Http::Method::post : Http::Method::put;
   const auto response = execute_method(method, url, object);
   return id.is_empty()
@@ -123,21 +127,93 @@ var::KeyString Database::create_object(
 Database &
 Database::patch_object(var::StringView path, const json::JsonObject &object) {
   const auto url = get_database_url_path(path);
-  thread::Mutex::Scope(mutex(), [&]() {
-    refresh_http_client_database_headers();
-  });
   execute_method(Http::Method::patch, url, object);
   return *this;
 }
 
 Database &Database::remove_object(var::StringView path) {
   const auto url = get_database_url_path(path);
-  thread::Mutex::Scope(mutex(), [&]() {
-    refresh_http_client_database_headers();
-    auto response
-      = Http::MethodResponse(fs::NullFile());
-    http_client().remove(url, response);
-    assign_error_from_status();
+  fs::NullFile response;
+  execute(
+    Http::Method::delete_,
+    url,
+    HttpClient::ExecuteMethod().set_response(&response));
+  return *this;
+}
+
+Database &Database::get_value_async(
+  var::StringView path,
+  IsRequestShallow is_shallow,
+  JsonCallback callback) {
+  submit(
+    [this, path = String(path), is_shallow, callback = std::move(callback)]() {
+      const auto result = get_value(path, is_shallow);
+      if (callback) {
+        callback(result);
+      }
+    });
+  return *this;
+}
+
+Database &Database::get_value_async(
+  var::StringView path,
+  const fs::FileObject &dest,
+  IsRequestShallow is_shallow,
+  Callback callback) {
+  submit([this,
+          path = String(path),
+          dest = &dest,
+          is_shallow,
+          callback = std::move(callback)]() {
+    get_value(path, *dest, is_shallow);
+    if (callback) {
+      callback();
+    }
+  });
+  return *this;
+}
+
+Database &
+Database::remove_object_async(var::StringView path, Callback callback) {
+  submit([this, path = String(path), callback = std::move(callback)]() {
+    remove_object(path);
+    if (callback) {
+      callback();
+    }
+  });
+  return *this;
+}
+
+Database &Database::create_object_async(
+  var::StringView path,
+  const json::JsonObject &object,
+  var::StringView id,
+  IdCallback callback) {
+  submit([this,
+          path = String(path),
+          object = JsonObject(object),
+          id = String(id),
+          callback = std::move(callback)]() {
+    const auto result = create_object(path, object, id);
+    if (callback) {
+      callback(result.string_view());
+    }
+  });
+  return *this;
+}
+
+Database &Database::patch_object_async(
+  var::StringView path,
+  const json::JsonObject &object,
+  Callback callback) {
+  submit([this,
+          path = String(path),
+          object = JsonObject(object),
+          callback = std::move(callback)]() {
+    patch_object(path, object);
+    if (callback) {
+      callback();
+    }
   });
   return *this;
 }
@@ -0,0 +1,352 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <chrono.hpp>
+#include <json.hpp>
+#include <thread.hpp>
+#include <var.hpp>
+
+#include "cloud/DatabaseMirror.hpp"
+
+using namespace cloud;
+
+namespace {
+
+// removes and returns the first segment of path
+var::StringView pop_segment(var::StringView &path) {
+  while (path.length() && path.front() == '/') {
+    path.pop_front();
+  }
+  const size_t slash = path.find("/");
+  const auto result
+    = slash == var::StringView::npos ? path : path.get_substring_with_length(slash);
+  path.pop_front(result.length());
+  return result;
+}
+
+json::JsonObject array_to_object(const json::JsonArray &array) {
+  json::JsonObject result;
+  for (u32 i = 0; i < array.count(); i++) {
+    result.insert(var::NumberString(i).string_view(), array.at(i));
+  }
+  return result;
+}
+
+} // namespace
+
+DatabaseMirror::ReadScope::ReadScope(const DatabaseMirror &mirror)
+  : m_mirror(mirror) {
+  thread::Mutex::Scope m_scope(m_mirror.m_mutex);
+  while (m_mirror.m_is_writing || m_mirror.m_writer_wait_count) {
+    m_mirror.m_cond.wait();
+  }
+  m_mirror.m_reader_count++;
+}
+
+DatabaseMirror::ReadScope::~ReadScope() {
+  thread::Mutex::Scope m_scope(m_mirror.m_mutex);
+  if (--m_mirror.m_reader_count == 0) {
+    m_mirror.m_cond.broadcast();
+  }
+}
+
+DatabaseMirror::WriteScope::WriteScope(DatabaseMirror &mirror)
+  : m_mirror(mirror) {
+  thread::Mutex::Scope m_scope(m_mirror.m_mutex);
+  m_mirror.m_writer_wait_count++;
+  while (m_mirror.m_is_writing || m_mirror.m_reader_count) {
+    m_mirror.m_cond.wait();
+  }
+  m_mirror.m_writer_wait_count--;
+  m_mirror.m_is_writing = true;
+}
+
+DatabaseMirror::WriteScope::~WriteScope() {
+  thread::Mutex::Scope m_scope(m_mirror.m_mutex);
+  m_mirror.m_is_writing = false;
+  m_mirror.m_cond.broadcast();
+}
+
+DatabaseMirror::DatabaseMirror(Database &database, var::StringView path)
+  : m_reconnect_delay(1_seconds), m_database(&database), m_path(path),
+    m_cond(m_mutex) {}
+
+DatabaseMirror::~DatabaseMirror() { stop(); }
+
+DatabaseMirror &DatabaseMirror::start() {
+  API_RETURN_VALUE_IF_ERROR(*this);
+  if (m_is_running) {
+    return *this;
+  }
+
+  const auto snapshot = m_database->get_value(m_path);
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  {
+    WriteScope write_scope(*this);
+    m_root = snapshot;
+  }
+
+  // the connection is made here so stop() can always close it
+  m_client = std::make_unique<inet::HttpSecureClient>();
+  if (!m_database->is_emulated()) {
+    m_client->connect(m_database->host());
+    API_RETURN_VALUE_IF_ERROR(*this);
+  }
+
+  m_is_stopping = false;
+  m_is_stale = false;
+  m_is_running = true;
+  m_thread = std::make_unique<thread::Thread>(
+    thread::Thread::Attributes().set_detach_state(
+      thread::Thread::DetachState::joinable),
+    thread::Thread::Construct().set_argument(this).set_function(
+      listen_function));
+
+  return *this;
+}
+
+DatabaseMirror &DatabaseMirror::stop() {
+  m_is_stopping = true;
+  if (m_thread && m_thread->is_joinable()) {
+    {
+      // the listener replaces the client when it reconnects
+      thread::Mutex::Scope client_scope(m_client_mutex);
+      if (m_client->is_connected()) {
+        // the listener is blocked until the next event arrives
+        m_client->socket().shutdown();
+      }
+    }
+    m_thread->join();
+  }
+  m_thread.reset();
+  m_client.reset();
+  return *this;
+}
+
+json::JsonValue DatabaseMirror::get_value(var::StringView path) const {
+  ReadScope read_scope(*this);
+  // the caller gets a copy that is not affected by later events
+  return copy_value(find_value(path));
+}
+
+const DatabaseMirror &DatabaseMirror::read_value(
+  var::StringView path,
+  const ValueCallback &callback) const {
+  ReadScope read_scope(*this);
+  callback(find_value(path));
+  return *this;
+}
+
+json::JsonValue DatabaseMirror::find_value(var::StringView path) const {
+  // caller holds the read lock
+  json::JsonValue node = m_root;
+  auto remaining = path;
+  while (node.is_valid()) {
+    const auto segment = pop_segment(remaining);
+    if (segment.is_empty()) {
+      return node;
+    }
+
+    if (node.is_object()) {
+      node = node.to_object().at(segment);
+    } else if (node.is_array()) {
+      node = node.to_array().at(segment.to_integer());
+    } else {
+      break;
+    }
+  }
+  return json::JsonValue();
+}
+
+int DatabaseMirror::apply(const Database::Event &event) {
+  using Type = Database::Event::Type;
+  switch (event.type()) {
+  case Type::put:
+  case Type::patch: {
+    JsonTreeBuilder builder;
+    JsonStreamParser parser(builder);
+    if (parser.feed(var::View(event.value())) < 0 || parser.finish() < 0) {
+      return -1;
+    }
+
+    if (event.type() == Type::put) {
+      put(event.path(), builder.value());
+    } else if (builder.value().is_object()) {
+      patch(event.path(), builder.value().to_object());
+    }
+    return 0;
+  }
+
+  case Type::cancel:
+  case Type::auth_revoked:
+    // the server has stopped sending events for this path
+    return -1;
+
+  default:
+    return 0;
+  }
+}
+
+DatabaseMirror &
+DatabaseMirror::put(var::StringView path, const json::JsonValue &value) {
+  {
+    WriteScope write_scope(*this);
+    set_value(path, value);
+  }
+  notify(path, value);
+  return *this;
+}
+
+DatabaseMirror &
+DatabaseMirror::patch(var::StringView path, const json::JsonObject &value) {
+  const auto key_list = value.get_key_list();
+  {
+    WriteScope write_scope(*this);
+    for (const auto &key : key_list) {
+      set_value((var::PathString(path) / key).string_view(), value.at(key));
+    }
+  }
+
+  for (const auto &key : key_list) {
+    notify((var::PathString(path) / key).string_view(), value.at(key));
+  }
+  return *this;
+}
+
+void *DatabaseMirror::listen_function(void *args) {
+  auto *self = reinterpret_cast<DatabaseMirror *>(args);
+  while (!self->m_is_stopping) {
+    self->m_database->listen(
+      self->m_path,
+      *self->m_client,
+      [self](const Database::Event &event) -> int {
+        if (self->m_is_stopping) {
+          return -1;
+        }
+        return self->apply(event);
+      });
+
+    if (self->m_is_stopping) {
+      break;
+    }
+
+    // the stream ended (dropped connection, cancel or auth_revoked) so
+    // events may have been missed until a new snapshot is loaded
+    self->m_is_stale = true;
+    API_RESET_ERROR();
+    self->reconnect();
+  }
+  self->m_is_running = false;
+  return nullptr;
+}
+
+void DatabaseMirror::reconnect() {
+  while (!m_is_stopping) {
+    // waits in steps so stop() is not held up by the delay
+    const auto step = 100_milliseconds;
+    for (chrono::MicroTime waited; waited < reconnect_delay() && !m_is_stopping;
+         waited += step) {
+      chrono::wait(step);
+    }
+
+    {
+      thread::Mutex::Scope client_scope(m_client_mutex);
+      if (m_is_stopping) {
+        return;
+      }
+      m_client = std::make_unique<inet::HttpSecureClient>();
+      if (!m_database->is_emulated()) {
+        m_client->connect(m_database->host());
+      }
+    }
+
+    const auto snapshot = m_database->get_value(m_path);
+    if (!is_error()) {
+      // callbacks see the whole subtree at the root path
+      put("", snapshot);
+      m_is_stale = false;
+      return;
+    }
+    API_RESET_ERROR();
+  }
+}
+
+void DatabaseMirror::set_value(
+  var::StringView path,
+  const json::JsonValue &value) {
+  // caller holds the write lock
+  const bool is_remove = !value.is_valid() || value.is_null();
+  auto remaining = path;
+  auto segment = pop_segment(remaining);
+  if (segment.is_empty()) {
+    m_root = is_remove ? json::JsonValue() : value;
+    return;
+  }
+
+  if (!m_root.is_object()) {
+    if (is_remove && !m_root.is_array()) {
+      return;
+    }
+    m_root = m_root.is_array() ? array_to_object(m_root.to_array())
+                               : json::JsonObject();
+  }
+
+  json::JsonValue node = m_root;
+  while (true) {
+    const auto next = pop_segment(remaining);
+    if (next.is_empty()) {
+      if (is_remove) {
+        node.to_object().remove(segment);
+      } else {
+        node.to_object().insert(segment, value);
+      }
+      return;
+    }
+
+    json::JsonValue child = node.to_object().at(segment);
+    if (!child.is_object()) {
+      if (is_remove && !child.is_array()) {
+        // nothing to remove
+        return;
+      }
+      // RTDB arrays are objects with integer keys
+      child = child.is_array() ? array_to_object(child.to_array())
+                               : json::JsonObject();
+      node.to_object().insert(segment, child);
+    }
+
+    node = child;
+    segment = next;
+  }
+}
+
+void DatabaseMirror::notify(
+  var::StringView path,
+  const json::JsonValue &value) {
+  for (const auto &callback : m_change_callbacks) {
+    callback(path, value);
+  }
+}
+
+json::JsonValue DatabaseMirror::copy_value(const json::JsonValue &value) {
+  if (value.is_object()) {
+    json::JsonObject result;
+    const auto &object = value.to_object();
+    for (const auto &key : object.get_key_list()) {
+      result.insert(key, copy_value(object.at(key)));
+    }
+    return result;
+  }
+
+  if (value.is_array()) {
+    json::JsonArray result;
+    const auto &array = value.to_array();
+    for (u32 i = 0; i < array.count(); i++) {
+      result.append(copy_value(array.at(i)));
+    }
+    return result;
+  }
+
+  // scalars are never modified in place, so they can be shared
+  return value;
+}
@@ -0,0 +1,59 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <var.hpp>
+
+#include "cloud/DocumentSchema.hpp"
+
+using namespace cloud;
+
+int DocumentSinkHandler::key(var::StringView key) {
+  const auto &container = m_stack.back();
+  m_member = container.sink ? container.sink->member(key) : nullptr;
+  return 0;
+}
+
+int DocumentSinkHandler::string(var::StringView value) {
+  auto *sink = get_value_sink();
+  return sink ? sink->string(value) : 0;
+}
+
+int DocumentSinkHandler::number(var::StringView value) {
+  auto *sink = get_value_sink();
+  return sink ? sink->number(value) : 0;
+}
+
+int DocumentSinkHandler::boolean(bool value) {
+  auto *sink = get_value_sink();
+  return sink ? sink->boolean(value) : 0;
+}
+
+int DocumentSinkHandler::null() {
+  auto *sink = get_value_sink();
+  return sink ? sink->null() : 0;
+}
+
+DocumentValueSink *DocumentSinkHandler::get_value_sink() {
+  if (m_stack.count() == 0) {
+    return m_root;
+  }
+
+  const auto &container = m_stack.back();
+  if (container.is_array) {
+    return container.sink ? container.sink->element() : nullptr;
+  }
+  return m_member;
+}
+
+int DocumentSinkHandler::begin_container(bool is_array) {
+  // a null sink skips the whole container
+  auto *sink = get_value_sink();
+  m_stack.push_back({sink, is_array});
+  m_member = nullptr;
+  return sink ? sink->begin() : 0;
+}
+
+int DocumentSinkHandler::end_container() {
+  m_stack.pop_back();
+  m_member = nullptr;
+  return 0;
+}
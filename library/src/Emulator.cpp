@@ -0,0 +1,1763 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#include <chrono.hpp>
+#include <fs.hpp>
+#include <inet.hpp>
+#include <json.hpp>
+#include <thread.hpp>
+#include <var.hpp>
+
+#include "cloud/Checksum.hpp"
+#include "cloud/Cloud.hpp"
+#include "cloud/Emulator.hpp"
+
+using namespace cloud;
+
+namespace {
+
+constexpr auto storage_media_host = "https://www.googleapis.com";
+
+bool starts_with(var::StringView value, var::StringView prefix) {
+  return value.length() >= prefix.length()
+         && value.get_substring_with_length(prefix.length()) == prefix;
+}
+
+bool ends_with(var::StringView value, var::StringView suffix) {
+  return value.length() >= suffix.length()
+         && value.get_substring_at_position(value.length() - suffix.length())
+              == suffix;
+}
+
+// removes and returns the first segment of path
+var::StringView pop_segment(var::StringView &path, var::StringView delimiter) {
+  while (path.length() && path.front() == delimiter.front()) {
+    path.pop_front();
+  }
+  const size_t position = path.find(delimiter);
+  const auto result = position == var::StringView::npos
+                        ? path
+                        : path.get_substring_with_length(position);
+  path.pop_front(result.length());
+  return result;
+}
+
+var::StringView get_url_path(var::StringView url) {
+  const size_t query = url.find("?");
+  return query == var::StringView::npos ? url
+                                        : url.get_substring_with_length(query);
+}
+
+// every value of key in the query of url
+var::StringList get_query_values(var::StringView url, var::StringView key) {
+  var::StringList result;
+  const size_t query = url.find("?");
+  if (query == var::StringView::npos) {
+    return result;
+  }
+
+  auto remaining = url.get_substring_at_position(query + 1);
+  while (remaining.length()) {
+    const auto pair = pop_segment(remaining, "&");
+    const size_t equal = pair.find("=");
+    if (equal != var::StringView::npos
+        && pair.get_substring_with_length(equal) == key) {
+      result.push_back(
+        inet::Url::decode(pair.get_substring_at_position(equal + 1)));
+    }
+  }
+  return result;
+}
+
+var::String get_query_value(var::StringView url, var::StringView key) {
+  const auto values = get_query_values(url, key);
+  return values.count() ? values.at(0) : var::String();
+}
+
+// the value of name in "crc32c=...,md5=..."
+var::StringView get_hash(var::StringView hashes, var::StringView name) {
+  auto remaining = hashes;
+  while (remaining.length()) {
+    auto pair = pop_segment(remaining, ",");
+    while (pair.length() && pair.front() == ' ') {
+      pair.pop_front();
+    }
+    const size_t equal = pair.find("=");
+    if (
+      equal != var::StringView::npos
+      && pair.get_substring_with_length(equal) == name) {
+      return pair.get_substring_at_position(equal + 1);
+    }
+  }
+  return var::StringView();
+}
+
+var::String to_json_string(const json::JsonValue &value) {
+  if (!value.is_valid()) {
+    return var::String("null");
+  }
+  return json::JsonDocument()
+    .set_flags(json::JsonDocument::Flags::compact)
+    .to_string(value);
+}
+
+json::JsonValue parse(var::StringView body) {
+  // Realtime Database bodies can be a bare number, string or literal
+  return json::JsonDocument()
+    .set_flags(json::JsonDocument::Flags::decode_any)
+    .from_string(body);
+}
+
+json::JsonString get_timestamp() {
+  const auto timestamp
+    = CloudMap::create_timestamp(chrono::DateTime::get_system_time());
+  return json::JsonString(timestamp.at("timestampValue").to_cstring());
+}
+
+// JsonReal only holds a float
+json::JsonValue create_real(double value) {
+  return JsonTreeBuilder::create_real(value);
+}
+
+json::JsonArray to_array(const var::StringList &list) {
+  json::JsonArray result;
+  for (const auto &item : list) {
+    result.append(json::JsonString(item.cstring()));
+  }
+  return result;
+}
+
+var::StringList to_list(const json::JsonValue &array) {
+  var::StringList result;
+  if (array.is_array()) {
+    for (u32 i = 0; i < array.to_array().count(); i++) {
+      result.push_back(var::String(array.to_array().at(i).to_string_view()));
+    }
+  }
+  return result;
+}
+
+// the type of a Firestore value such as {"integerValue": "5"}
+var::String get_type(const json::JsonValue &value) {
+  if (!value.is_object() || value.to_object().count() == 0) {
+    return var::String();
+  }
+  return var::String(value.to_object().get_key_list().at(0));
+}
+
+bool is_integer_text(const json::JsonValue &value) {
+  return value.is_string() || value.is_integer();
+}
+
+s64 to_integer(const json::JsonValue &value) {
+  return value.is_string() ? ::strtoll(value.to_cstring(), nullptr, 10)
+                           : s64(value.to_integer());
+}
+
+double to_number(const json::JsonValue &value) {
+  if (value.is_string()) {
+    return ::strtod(value.to_cstring(), nullptr);
+  }
+  return value.is_integer() ? double(value.to_integer())
+                            : double(value.to_real());
+}
+
+int get_type_order(var::StringView type) {
+  // the Firestore ordering of value types
+  static const var::StringView order[] = {
+    "nullValue",
+    "booleanValue",
+    "integerValue",
+    "timestampValue",
+    "stringValue",
+    "bytesValue",
+    "referenceValue",
+    "geoPointValue",
+    "arrayValue",
+    "mapValue"};
+  for (int i = 0; i < int(sizeof(order) / sizeof(order[0])); i++) {
+    if (type == order[i] || (type == "doubleValue" && i == 2)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int compare_values(const json::JsonValue &a, const json::JsonValue &b) {
+  const auto a_type = get_type(a);
+  const auto b_type = get_type(b);
+  const int a_order = get_type_order(a_type);
+  const int b_order = get_type_order(b_type);
+  if (a_order < 0 || b_order < 0) {
+    // a missing value
+    return a_order - b_order;
+  }
+  if (a_order != b_order) {
+    return a_order < b_order ? -1 : 1;
+  }
+
+  const auto a_value = a.to_object().at(a_type);
+  const auto b_value = b.to_object().at(b_type);
+  if (a_type == "integerValue" || a_type == "doubleValue") {
+    const double a_number = to_number(a_value);
+    const double b_number = to_number(b_value);
+    return a_number < b_number ? -1 : (a_number > b_number ? 1 : 0);
+  }
+
+  if (a_type == "booleanValue") {
+    return int(a_value.to_bool()) - int(b_value.to_bool());
+  }
+
+  if (a_value.is_string() && b_value.is_string()) {
+    return ::strcmp(a_value.to_cstring(), b_value.to_cstring());
+  }
+
+  return ::strcmp(
+    to_json_string(a_value).cstring(),
+    to_json_string(b_value).cstring());
+}
+
+json::JsonValue
+get_field(const json::JsonObject &fields, var::StringView field_path) {
+  json::JsonValue current = fields;
+  auto remaining = field_path;
+  while (true) {
+    const auto segment = pop_segment(remaining, ".");
+    if (!current.is_object()) {
+      return json::JsonValue();
+    }
+    const auto value = current.to_object().at(segment);
+    if (remaining.is_empty() || !value.is_object()) {
+      return remaining.is_empty() ? value : json::JsonValue();
+    }
+    const auto map = value.to_object().at("mapValue");
+    if (!map.is_object()) {
+      return json::JsonValue();
+    }
+    current = map.to_object().at("fields");
+  }
+}
+
+bool contains_value(
+  const json::JsonValue &array,
+  const json::JsonValue &value) {
+  if (!array.is_object()) {
+    return false;
+  }
+  const auto values = array.to_object().at("arrayValue").is_object()
+                        ? array.to_object().at("arrayValue").to_object().at(
+                          "values")
+                        : json::JsonValue();
+  if (!values.is_array()) {
+    return false;
+  }
+  for (u32 i = 0; i < values.to_array().count(); i++) {
+    if (compare_values(values.to_array().at(i), value) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool is_match(const json::JsonObject &fields, const json::JsonObject &filter) {
+  const auto composite = filter.at("compositeFilter");
+  if (composite.is_object()) {
+    const bool is_or = composite.to_object().at("op").to_string_view() == "OR";
+    const auto filters = composite.to_object().at("filters").to_array();
+    for (u32 i = 0; i < filters.count(); i++) {
+      if (is_match(fields, filters.at(i).to_object()) == is_or) {
+        return is_or;
+      }
+    }
+    return !is_or;
+  }
+
+  const auto unary = filter.at("unaryFilter");
+  if (unary.is_object()) {
+    const auto op = unary.to_object().at("op").to_string_view();
+    const auto field = unary.to_object().at("field").to_object();
+    const auto value = get_field(fields, field.at("fieldPath").to_string_view());
+    const bool is_null = get_type(value) == "nullValue";
+    if (op == "IS_NULL") {
+      return is_null;
+    }
+    if (op == "IS_NOT_NULL") {
+      return value.is_valid() && !is_null;
+    }
+    return false;
+  }
+
+  const auto field_filter = filter.at("fieldFilter").to_object();
+  const auto op = field_filter.at("op").to_string_view();
+  const auto operand = field_filter.at("value");
+  const auto value = get_field(
+    fields,
+    field_filter.at("field").to_object().at("fieldPath").to_string_view());
+  if (!value.is_valid()) {
+    // documents without the field never match
+    return false;
+  }
+
+  if (op == "ARRAY_CONTAINS") {
+    return contains_value(value, operand);
+  }
+  if (op == "IN") {
+    return contains_value(operand, value);
+  }
+  if (op == "NOT_IN") {
+    return !contains_value(operand, value);
+  }
+  if (op == "ARRAY_CONTAINS_ANY") {
+    const auto values
+      = operand.to_object().at("arrayValue").to_object().at("values");
+    for (u32 i = 0; values.is_array() && i < values.to_array().count(); i++) {
+      if (contains_value(value, values.to_array().at(i))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const bool is_comparable
+    = get_type_order(get_type(value)) == get_type_order(get_type(operand));
+  const int comparison = compare_values(value, operand);
+  if (op == "EQUAL") {
+    return comparison == 0;
+  }
+  if (op == "NOT_EQUAL") {
+    return comparison != 0;
+  }
+  if (!is_comparable) {
+    return false;
+  }
+  if (op == "LESS_THAN") {
+    return comparison < 0;
+  }
+  if (op == "LESS_THAN_OR_EQUAL") {
+    return comparison <= 0;
+  }
+  if (op == "GREATER_THAN") {
+    return comparison > 0;
+  }
+  if (op == "GREATER_THAN_OR_EQUAL") {
+    return comparison >= 0;
+  }
+  return false;
+}
+
+// only the top level fields named in field_paths are kept
+json::JsonObject
+select_fields(const json::JsonObject &document, const var::StringList &paths) {
+  if (paths.count() == 0) {
+    return document;
+  }
+
+  const auto fields = document.at("fields").to_object();
+  json::JsonObject selected;
+  for (const auto &path : paths) {
+    auto remaining = path.string_view();
+    const auto field = pop_segment(remaining, ".");
+    if (fields.at(field).is_valid()) {
+      selected.insert(field, fields.at(field));
+    }
+  }
+
+  return json::JsonObject()
+    .insert("name", document.at("name"))
+    .insert("fields", selected)
+    .insert("createTime", document.at("createTime"))
+    .insert("updateTime", document.at("updateTime"));
+}
+
+var::StringList get_select_paths(const json::JsonObject &query) {
+  var::StringList result;
+  const auto fields = query.at("select").is_object()
+                        ? query.at("select").to_object().at("fields")
+                        : json::JsonValue();
+  for (u32 i = 0; fields.is_array() && i < fields.to_array().count(); i++) {
+    result.push_back(var::String(
+      fields.to_array().at(i).to_object().at("fieldPath").to_string_view()));
+  }
+  return result;
+}
+
+} // namespace
+
+inet::Http::Status Emulator::execute(const Request &request) {
+  // the request and response files belong to the caller and are only
+  // accessed outside of the lock
+  var::String body;
+  if (request.body()) {
+    fs::DataFile body_file;
+    body_file.write(*request.body());
+    const var::View data(body_file.data());
+    body = var::String(var::StringView(data.to_const_char(), data.size()));
+  }
+
+  const Fault fault
+    = m_fault_callback ? m_fault_callback(request) : Fault::none;
+  const bool is_body_truncated = fault == Fault::truncate && body.length();
+  if (is_body_truncated) {
+    body = var::String(
+      body.string_view().get_substring_with_length(body.length() / 2));
+  }
+
+  if (latency().microseconds() > 0) {
+    chrono::wait(latency());
+  }
+
+  Response response;
+  {
+    thread::Mutex::Scope mutex_scope(m_mutex);
+    m_request_count++;
+    const auto host = request.host();
+    if (fault == Fault::unavailable) {
+      response = create_error(
+        inet::Http::Status::service_unavailable,
+        "UNAVAILABLE",
+        "the fault callback failed the request");
+    } else if (ends_with(host, ".firebaseio.com")) {
+      response = execute_database(request, body);
+    } else if (host == "firestore.googleapis.com") {
+      response = execute_firestore(request, body);
+    } else if (host == "securetoken.googleapis.com") {
+      response = execute_token();
+    } else if (host == "www.googleapis.com") {
+      response = starts_with(request.url(), "/identitytoolkit/")
+                   ? execute_identity(request, body)
+                 : starts_with(request.url(), "/batch/storage/v1")
+                   ? execute_batch(request, body)
+                   : execute_storage(request, body);
+    } else {
+      response = create_error(
+        inet::Http::Status::not_found,
+        "NOT_FOUND",
+        "the host is not emulated");
+    }
+  }
+
+  if (fault == Fault::truncate && !is_body_truncated) {
+    response.body = var::String(
+      response.body.string_view().get_substring_with_length(
+        response.body.length() / 2));
+  }
+
+  if (request.response_status()) {
+    *request.response_status() = response.status;
+  }
+  if (request.response() && response.body.length()) {
+    request.response()->write(var::View(response.body.string_view()));
+  }
+  if (request.response_header_fields()) {
+    *request.response_header_fields() = std::move(response.header_fields);
+  }
+  return response.status;
+}
+
+u32 Emulator::request_count() const {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  return m_request_count;
+}
+
+Emulator &Emulator::clear() {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  m_database = json::JsonObject();
+  m_documents = json::JsonObject();
+  m_objects.clear();
+  m_upload_sessions.clear();
+  return *this;
+}
+
+var::String Emulator::get_header_field(
+  var::StringView header_fields,
+  var::StringView key) {
+  auto remaining = header_fields;
+  while (remaining.length()) {
+    const auto line = pop_segment(remaining, "\n");
+    const size_t colon = line.find(":");
+    if (
+      colon != key.length()
+      || ::strncasecmp(line.data(), key.data(), key.length()) != 0) {
+      continue;
+    }
+
+    auto value = line.get_substring_at_position(colon + 1);
+    while (value.length() && value.front() == ' ') {
+      value.pop_front();
+    }
+    while (value.length() && value.data()[value.length() - 1] == '\r') {
+      value = value.get_substring_with_length(value.length() - 1);
+    }
+    return var::String(value);
+  }
+  return var::String();
+}
+
+Emulator::Response
+Emulator::execute_identity(const Request &request, var::StringView body) {
+  if (!ends_with(get_url_path(request.url()), "/verifyPassword")) {
+    return create_error(
+      inet::Http::Status::not_found,
+      "NOT_FOUND",
+      "only verifyPassword is emulated");
+  }
+
+  const auto credentials = parse(body).to_object();
+  const auto email = credentials.at("email").to_string_view();
+  // the same email always gets the same uid
+  u32 hash = 2166136261;
+  for (size_t i = 0; i < email.length(); i++) {
+    hash = (hash ^ u8(email.data()[i])) * 16777619;
+  }
+
+  const auto uid = var::String().format("emulator%08lx", (unsigned long)hash);
+  const auto token = var::String("emulator-token-") + generate_id();
+  return create_response(
+    json::JsonObject()
+      .insert("localId", json::JsonString(uid.cstring()))
+      .insert("email", json::JsonString(var::String(email).cstring()))
+      .insert("idToken", json::JsonString(token.cstring()))
+      .insert("refreshToken", json::JsonString(uid.cstring()))
+      .insert("expiresIn", json::JsonString("3600")));
+}
+
+Emulator::Response Emulator::execute_token() {
+  const auto token = var::String("emulator-token-") + generate_id();
+  return create_response(
+    json::JsonObject()
+      .insert("id_token", json::JsonString(token.cstring()))
+      .insert("refresh_token", json::JsonString("emulator-refresh"))
+      .insert("expires_in", json::JsonString("3600")));
+}
+
+Emulator::Response
+Emulator::execute_database(const Request &request, var::StringView body) {
+  auto path = get_url_path(request.url());
+  if (ends_with(path, ".json")) {
+    path = path.get_substring_with_length(path.length() - 5);
+  }
+
+  using Method = inet::Http::Method;
+  switch (request.method()) {
+  case Method::get: {
+    const auto value = get_database_value(path);
+    if (request.header_fields().find("text/event-stream")
+        != var::StringView::npos) {
+      const auto event = json::JsonObject()
+                           .insert("path", json::JsonString("/"))
+                           .insert("data", value.is_valid() ? value
+                                                            : json::JsonNull());
+      return {
+        inet::Http::Status::ok,
+        var::String("event: put\ndata: ") + to_json_string(event) + "\n\n"};
+    }
+
+    if (
+      get_query_value(request.url(), "shallow") == "true"
+      && value.is_object()) {
+      json::JsonObject result;
+      for (const auto &key : value.to_object().get_key_list()) {
+        result.insert(key, json::JsonTrue());
+      }
+      return create_response(result);
+    }
+    return create_response(value);
+  }
+
+  case Method::put:
+    set_database_value(path, parse(body));
+    return {inet::Http::Status::ok, var::String(body)};
+
+  case Method::post: {
+    const auto key = var::String("-") + generate_id();
+    set_database_value(
+      (var::PathString(path) / key).string_view(),
+      parse(body));
+    return create_response(
+      json::JsonObject().insert("name", json::JsonString(key.cstring())));
+  }
+
+  case Method::patch: {
+    const auto object = parse(body).to_object();
+    for (const auto &key : object.get_key_list()) {
+      set_database_value(
+        (var::PathString(path) / key).string_view(),
+        object.at(key));
+    }
+    return {inet::Http::Status::ok, var::String(body)};
+  }
+
+  case Method::delete_:
+    set_database_value(path, json::JsonValue());
+    return {inet::Http::Status::ok, var::String("null")};
+
+  default:
+    return create_error(
+      inet::Http::Status::bad_request,
+      "INVALID_ARGUMENT",
+      "method is not supported");
+  }
+}
+
+Emulator::Response
+Emulator::execute_firestore(const Request &request, var::StringView body) {
+  const auto path = get_url_path(request.url());
+  const var::StringView documents = "/documents";
+  const size_t documents_position = path.find(documents);
+  if (
+    !starts_with(path, "/v1/")
+    || documents_position == var::StringView::npos) {
+    return create_error(
+      inet::Http::Status::not_found,
+      "NOT_FOUND",
+      "not a document path");
+  }
+
+  // projects/{project}/databases/(default)/documents
+  const auto root = path.get_substring_with_length(
+    documents_position + documents.length()).get_substring_at_position(4);
+  const auto rest
+    = path.get_substring_at_position(documents_position + documents.length());
+
+  const size_t colon = rest.find(":");
+  if (colon != var::StringView::npos) {
+    const auto action = rest.get_substring_at_position(colon + 1);
+    const auto parent
+      = var::String(root) + rest.get_substring_with_length(colon);
+    if (action == "commit") {
+      return commit(body);
+    }
+    if (action == "batchGet") {
+      return batch_get(body);
+    }
+    if (action == "runQuery") {
+      return run_query(parent, body);
+    }
+    if (action == "runAggregationQuery") {
+      return run_aggregation_query(parent, body);
+    }
+    return create_error(
+      inet::Http::Status::not_found,
+      "NOT_FOUND",
+      "the method is not emulated");
+  }
+
+  size_t segment_count = 0;
+  for (size_t i = 0; i < rest.length(); i++) {
+    segment_count += rest.at(i) == '/';
+  }
+  const bool is_collection = segment_count % 2 == 1;
+  const auto name = var::String(root) + rest;
+
+  using Method = inet::Http::Method;
+  switch (request.method()) {
+  case Method::get:
+    if (is_collection) {
+      return list_documents(name, request.url());
+    }
+    if (!m_documents.at(name).is_valid()) {
+      return create_error(
+        inet::Http::Status::not_found,
+        "NOT_FOUND",
+        "document not found");
+    }
+    return create_response(select_fields(
+      m_documents.at(name).to_object(),
+      get_query_values(request.url(), "mask.fieldPaths")));
+
+  case Method::post:
+    return create_document(name, request.url(), body);
+
+  case Method::patch:
+    return patch_document(name, request.url(), body);
+
+  case Method::delete_:
+    m_documents.remove(name);
+    return create_response(json::JsonObject());
+
+  default:
+    return create_error(
+      inet::Http::Status::bad_request,
+      "INVALID_ARGUMENT",
+      "method is not supported");
+  }
+}
+
+Emulator::Response
+Emulator::execute_batch(const Request &request, var::StringView body) {
+  // multipart/mixed; boundary=...
+  const auto content_type
+    = get_header_field(request.header_fields(), "Content-Type");
+  const var::StringView boundary_key = "boundary=";
+  const size_t boundary_position
+    = content_type.string_view().find(boundary_key);
+  if (boundary_position == var::StringView::npos) {
+    return create_error(
+      inet::Http::Status::bad_request,
+      "INVALID_ARGUMENT",
+      "the batch boundary is missing");
+  }
+  const auto delimiter = var::String("--").append(
+    content_type.string_view().get_substring_at_position(
+      boundary_position + boundary_key.length()));
+
+  const var::StringView response_boundary = "batch_emulator";
+  var::String result;
+  size_t position = body.find(delimiter);
+  while (position != var::StringView::npos) {
+    const size_t part_start = position + delimiter.length();
+    position = body.find(delimiter, part_start);
+    const auto part = position == var::StringView::npos
+                        ? body.get_substring_at_position(part_start)
+                        : body.get_substring_at_position(part_start)
+                            .get_substring_with_length(position - part_start);
+
+    // the part headers, a blank line and then "DELETE /path HTTP/1.1"
+    const size_t request_line = part.find("\r\n\r\n");
+    if (request_line == var::StringView::npos) {
+      continue;
+    }
+    const auto content_id = get_header_field(part, "Content-ID");
+    auto line = part.get_substring_at_position(request_line + 4);
+    const auto method = pop_segment(line, " ");
+    const auto url = pop_segment(line, " ");
+
+    Request sub_request;
+    sub_request.set_host(request.host()).set_url(url);
+    if (method == "DELETE") {
+      sub_request.set_method(inet::Http::Method::delete_);
+    } else if (method != "GET") {
+      continue;
+    }
+    const auto response = execute_storage(sub_request, var::StringView());
+
+    // <1> is answered as <response-1>
+    auto id = content_id.string_view();
+    if (id.length() && id.front() == '<') {
+      id.pop_front();
+    }
+    result.append("--")
+      .append(response_boundary)
+      .append("\r\nContent-Type: application/http\r\nContent-ID: <response-")
+      .append(id)
+      .append("\r\n\r\n")
+      .append(var::String().format("HTTP/1.1 %d\r\n\r\n", int(response.status)))
+      .append(response.body)
+      .append("\r\n");
+  }
+  result.append("--").append(response_boundary).append("--\r\n");
+
+  return {
+    inet::Http::Status::ok,
+    result,
+    var::String("Content-Type: multipart/mixed; boundary=")
+      .append(response_boundary)
+      .append("\r\n")};
+}
+
+Emulator::Response
+Emulator::execute_storage(const Request &request, var::StringView body) {
+  const auto path = get_url_path(request.url());
+
+  const var::StringView upload = "/upload/storage/v1/b/";
+  const var::StringView download = "/download/storage/v1/b/";
+  const var::StringView storage = "/storage/v1/b/";
+
+  auto remaining = starts_with(path, upload)
+                     ? path.get_substring_at_position(upload.length())
+                   : starts_with(path, download)
+                     ? path.get_substring_at_position(download.length())
+                   : starts_with(path, storage)
+                     ? path.get_substring_at_position(storage.length())
+                     : var::StringView();
+
+  const auto bucket = pop_segment(remaining, "/");
+  if (bucket.is_empty() || pop_segment(remaining, "/") != "o") {
+    return create_error(
+      inet::Http::Status::not_found,
+      "NOT_FOUND",
+      "not an object path");
+  }
+
+  if (starts_with(path, upload)) {
+    if (!get_query_value(request.url(), "upload_id").is_empty()) {
+      return continue_upload_session(request, body);
+    }
+    if (get_query_value(request.url(), "uploadType") == "resumable") {
+      return start_upload_session(request, bucket);
+    }
+    return upload_object(bucket, request.url(), body);
+  }
+
+  while (remaining.length() && remaining.front() == '/') {
+    remaining.pop_front();
+  }
+
+  if (remaining.is_empty()) {
+    return list_objects(bucket, request.url());
+  }
+
+  const var::StringView compose = "/compose";
+  if (
+    request.method() == inet::Http::Method::post
+    && ends_with(remaining, compose)) {
+    return compose_object(
+      bucket,
+      inet::Url::decode(
+        remaining.get_substring_with_length(
+          remaining.length() - compose.length())),
+      body);
+  }
+
+  const auto name = inet::Url::decode(remaining);
+  const size_t index = find_object(bucket, name);
+  const auto generation = get_query_value(request.url(), "generation");
+  if (
+    index == m_objects.count()
+    || (!generation.is_empty()
+        && generation.string_view()
+             != var::String()
+                  .format(
+                    "%llu",
+                    static_cast<unsigned long long>(
+                      m_objects.at(index).generation))
+                  .string_view())) {
+    return create_error(
+      inet::Http::Status::not_found,
+      "NOT_FOUND",
+      "No such object");
+  }
+
+  if (request.method() == inet::Http::Method::delete_) {
+    m_objects.remove(index);
+    return {inet::Http::Status::no_content, var::String()};
+  }
+
+  if (
+    starts_with(path, download)
+    || get_query_value(request.url(), "alt") == "media") {
+    const auto data = m_objects.at(index).data.string_view();
+    const auto range = get_header_field(request.header_fields(), "Range");
+    const size_t equal = range.string_view().find("=");
+    if (equal == var::StringView::npos) {
+      const auto details = get_object_details(m_objects.at(index));
+      var::String hashes("x-goog-hash: crc32c=");
+      hashes.append(details.at("crc32c").to_string_view())
+        .append(",md5=")
+        .append(details.at("md5Hash").to_string_view())
+        .append("\r\n");
+      return {inet::Http::Status::ok, var::String(data), hashes};
+    }
+
+    // "bytes=first-last", last is optional
+    auto spec = range.string_view().get_substring_at_position(equal + 1);
+    const size_t first = size_t(pop_segment(spec, "-").to_integer());
+    const size_t last
+      = spec.is_empty() || size_t(spec.to_integer()) >= data.length()
+          ? data.length() - 1
+          : size_t(spec.to_integer());
+    if (first > last || first >= data.length()) {
+      return create_error(
+        inet::Http::Status::bad_request,
+        "INVALID_ARGUMENT",
+        "the range is not satisfiable");
+    }
+
+    return {
+      inet::Http::Status::partial_content,
+      var::String(data.get_substring_at_position(first)
+                    .get_substring_with_length(last - first + 1)),
+      var::String().format(
+        "Content-Range: bytes %lu-%lu/%lu\r\n",
+        static_cast<unsigned long>(first),
+        static_cast<unsigned long>(last),
+        static_cast<unsigned long>(data.length()))};
+  }
+
+  return create_response(get_object_details(m_objects.at(index)));
+}
+
+json::JsonValue Emulator::get_database_value(var::StringView path) const {
+  json::JsonValue node = m_database;
+  auto remaining = path;
+  while (node.is_valid()) {
+    const auto segment = pop_segment(remaining, "/");
+    if (segment.is_empty()) {
+      return node;
+    }
+    if (!node.is_object()) {
+      break;
+    }
+    node = node.to_object().at(segment);
+  }
+  return json::JsonValue();
+}
+
+void Emulator::set_database_value(
+  var::StringView path,
+  const json::JsonValue &value) {
+  const bool is_remove = !value.is_valid() || value.is_null();
+  auto remaining = path;
+  auto segment = pop_segment(remaining, "/");
+  if (segment.is_empty()) {
+    m_database = value.is_object() ? value.to_object() : json::JsonObject();
+    return;
+  }
+
+  json::JsonObject node = m_database;
+  while (true) {
+    const auto next = pop_segment(remaining, "/");
+    if (next.is_empty()) {
+      if (is_remove) {
+        node.remove(segment);
+      } else {
+        node.insert(segment, value);
+      }
+      return;
+    }
+
+    json::JsonValue child = node.at(segment);
+    if (!child.is_object()) {
+      if (is_remove) {
+        return;
+      }
+      child = json::JsonObject();
+      node.insert(segment, child);
+    }
+    node = child.to_object();
+    segment = next;
+  }
+}
+
+Emulator::Response Emulator::create_document(
+  var::StringView collection,
+  var::StringView url,
+  var::StringView body) {
+  auto id = get_query_value(url, "documentId");
+  if (id.is_empty()) {
+    id = generate_id();
+  }
+
+  const auto name = var::String(collection) + "/" + id;
+  if (m_documents.at(name).is_valid()) {
+    return create_error(
+      inet::Http::Status::conflict,
+      "ALREADY_EXISTS",
+      "Document already exists");
+  }
+
+  const auto fields = parse(body).to_object().at("fields");
+  update_document(
+    name,
+    fields.is_object() ? fields.to_object() : json::JsonObject(),
+    json::JsonValue());
+  return create_response(m_documents.at(name));
+}
+
+Emulator::Response Emulator::patch_document(
+  var::StringView name,
+  var::StringView url,
+  var::StringView body) {
+  const auto exists = get_query_value(url, "currentDocument.exists");
+  const bool is_existing = m_documents.at(name).is_valid();
+  if (!exists.is_empty() && (exists == "true") != is_existing) {
+    return is_existing ? create_error(
+             inet::Http::Status::conflict,
+             "ALREADY_EXISTS",
+             "Document already exists")
+                       : create_error(
+                         inet::Http::Status::not_found,
+                         "NOT_FOUND",
+                         "No document to update");
+  }
+
+  const auto mask = get_query_values(url, "updateMask.fieldPaths");
+  const auto fields = parse(body).to_object().at("fields");
+  update_document(
+    name,
+    fields.is_object() ? fields.to_object() : json::JsonObject(),
+    mask.count() ? json::JsonValue(to_array(mask)) : json::JsonValue());
+  return create_response(m_documents.at(name));
+}
+
+Emulator::Response
+Emulator::list_documents(var::StringView collection, var::StringView url) {
+  json::JsonObject query;
+  query.insert(
+    "from",
+    json::JsonArray().append(json::JsonObject().insert(
+      "collectionId",
+      json::JsonString(
+        var::String(fs::Path::name(collection)).cstring()))));
+
+  const auto parent
+    = collection.get_substring_with_length(collection.reverse_find("/"));
+  const auto documents = get_query_documents(parent, query);
+
+  const auto page_size_value = get_query_value(url, "pageSize");
+  const u32 page_size = page_size_value.is_empty()
+                          ? u32(documents.count())
+                          : page_size_value.string_view().to_integer();
+  const u32 start
+    = get_query_value(url, "pageToken").string_view().to_integer();
+  const auto mask = get_query_values(url, "mask.fieldPaths");
+
+  json::JsonArray page;
+  for (u32 i = start; i < documents.count() && i < start + page_size; i++) {
+    page.append(select_fields(documents.at(i), mask));
+  }
+
+  json::JsonObject result;
+  if (page.count()) {
+    result.insert("documents", page);
+  }
+  if (start + page_size < documents.count()) {
+    // the page token is the index of the next document
+    result.insert(
+      "nextPageToken",
+      json::JsonString(var::NumberString(start + page_size).cstring()));
+  }
+  return create_response(result);
+}
+
+Emulator::Response Emulator::commit(var::StringView body) {
+  const auto writes = parse(body).to_object().at("writes").to_array();
+
+  // the preconditions are checked first so that the commit is atomic
+  for (u32 i = 0; i < writes.count(); i++) {
+    const auto write = writes.at(i).to_object();
+    const auto current = write.at("currentDocument");
+    if (!write.at("update").is_object() || !current.is_object()) {
+      continue;
+    }
+
+    const auto name
+      = write.at("update").to_object().at("name").to_string_view();
+    const bool is_existing = m_documents.at(name).is_valid();
+    if (current.to_object().at("exists").to_bool() != is_existing) {
+      return is_existing ? create_error(
+               inet::Http::Status::conflict,
+               "ALREADY_EXISTS",
+               "Document already exists")
+                         : create_error(
+                           inet::Http::Status::not_found,
+                           "NOT_FOUND",
+                           "No document to update");
+    }
+  }
+
+  const auto timestamp = get_timestamp();
+  json::JsonArray write_results;
+  for (u32 i = 0; i < writes.count(); i++) {
+    const auto write = writes.at(i).to_object();
+    if (write.at("update").is_object()) {
+      const auto document = write.at("update").to_object();
+      const auto name = document.at("name").to_string_view();
+      const auto fields = document.at("fields");
+      update_document(
+        name,
+        fields.is_object() ? fields.to_object() : json::JsonObject(),
+        write.at("updateMask").is_object()
+          ? write.at("updateMask").to_object().at("fieldPaths")
+          : json::JsonValue());
+      if (write.at("updateTransforms").is_array()) {
+        transform_document(name, write.at("updateTransforms").to_array());
+      }
+    } else if (write.at("delete").is_string()) {
+      m_documents.remove(write.at("delete").to_string_view());
+    } else if (write.at("transform").is_object()) {
+      const auto transform = write.at("transform").to_object();
+      transform_document(
+        transform.at("document").to_string_view(),
+        transform.at("fieldTransforms").to_array());
+    }
+    write_results.append(json::JsonObject().insert("updateTime", timestamp));
+  }
+
+  return create_response(json::JsonObject()
+                           .insert("writeResults", write_results)
+                           .insert("commitTime", timestamp));
+}
+
+Emulator::Response Emulator::batch_get(var::StringView body) {
+  const auto request = parse(body).to_object();
+  const auto names = request.at("documents").to_array();
+  const auto mask = request.at("mask").is_object()
+                      ? to_list(request.at("mask").to_object().at("fieldPaths"))
+                      : var::StringList();
+  const auto timestamp = get_timestamp();
+
+  json::JsonArray result;
+  for (u32 i = 0; i < names.count(); i++) {
+    const auto name = names.at(i).to_string_view();
+    const auto document = m_documents.at(name);
+    result.append(
+      document.is_valid()
+        ? json::JsonObject()
+            .insert("found", select_fields(document.to_object(), mask))
+            .insert("readTime", timestamp)
+        : json::JsonObject()
+            .insert("missing", names.at(i))
+            .insert("readTime", timestamp));
+  }
+  return create_response(result);
+}
+
+Emulator::Response
+Emulator::run_query(var::StringView parent, var::StringView body) {
+  const auto query = parse(body).to_object().at("structuredQuery").to_object();
+  const auto documents = get_query_documents(parent, query);
+  const auto select_paths = get_select_paths(query);
+  const auto timestamp = get_timestamp();
+
+  json::JsonArray result;
+  for (const auto &document : documents) {
+    result.append(
+      json::JsonObject()
+        .insert("document", select_fields(document, select_paths))
+        .insert("readTime", timestamp));
+  }
+
+  if (result.count() == 0) {
+    result.append(json::JsonObject().insert("readTime", timestamp));
+  }
+  return create_response(result);
+}
+
+Emulator::Response
+Emulator::run_aggregation_query(var::StringView parent, var::StringView body) {
+  const auto aggregation_query
+    = parse(body).to_object().at("structuredAggregationQuery").to_object();
+  const auto documents = get_query_documents(
+    parent,
+    aggregation_query.at("structuredQuery").to_object());
+  const auto aggregations = aggregation_query.at("aggregations").to_array();
+
+  json::JsonObject aggregate_fields;
+  for (u32 i = 0; i < aggregations.count(); i++) {
+    const auto aggregation = aggregations.at(i).to_object();
+    const auto alias = aggregation.at("alias").to_string_view();
+
+    if (aggregation.at("count").is_object()) {
+      const auto up_to = aggregation.at("count").to_object().at("upTo");
+      u64 count = documents.count();
+      if (up_to.is_valid() && u64(to_integer(up_to)) < count) {
+        count = u64(to_integer(up_to));
+      }
+      aggregate_fields.insert(
+        alias,
+        json::JsonObject().insert(
+          "integerValue",
+          json::JsonString(
+            var::String()
+              .format("%llu", static_cast<unsigned long long>(count))
+              .cstring())));
+      continue;
+    }
+
+    const bool is_sum = aggregation.at("sum").is_object();
+    const auto field_path = aggregation.at(is_sum ? "sum" : "avg")
+                              .to_object()
+                              .at("field")
+                              .to_object()
+                              .at("fieldPath")
+                              .to_string_view();
+
+    s64 integer_total = 0;
+    double total = 0.0;
+    u32 count = 0;
+    bool is_double = false;
+    for (const auto &document : documents) {
+      const auto value
+        = get_field(document.at("fields").to_object(), field_path);
+      const auto type = get_type(value);
+      if (type == "integerValue") {
+        integer_total += to_integer(value.to_object().at(type));
+      } else if (type == "doubleValue") {
+        is_double = true;
+      } else {
+        continue;
+      }
+      total += to_number(value.to_object().at(type));
+      count++;
+    }
+
+    if (is_sum && !is_double) {
+      aggregate_fields.insert(
+        alias,
+        json::JsonObject().insert(
+          "integerValue",
+          json::JsonString(
+            var::String()
+              .format("%lld", static_cast<long long>(integer_total))
+              .cstring())));
+    } else if (is_sum) {
+      aggregate_fields.insert(
+        alias,
+        json::JsonObject().insert("doubleValue", create_real(total)));
+    } else if (count == 0) {
+      aggregate_fields.insert(
+        alias,
+        json::JsonObject().insert("nullValue", json::JsonNull()));
+    } else {
+      aggregate_fields.insert(
+        alias,
+        json::JsonObject().insert("doubleValue", create_real(total / count)));
+    }
+  }
+
+  return create_response(json::JsonArray().append(
+    json::JsonObject()
+      .insert(
+        "result",
+        json::JsonObject().insert("aggregateFields", aggregate_fields))
+      .insert("readTime", get_timestamp())));
+}
+
+void Emulator::update_document(
+  var::StringView name,
+  const json::JsonObject &fields,
+  const json::JsonValue &update_mask) {
+  const auto timestamp = get_timestamp();
+  const auto existing = m_documents.at(name);
+
+  json::JsonObject document;
+  if (existing.is_object()) {
+    document = existing.to_object();
+  } else {
+    document.insert("name", json::JsonString(var::String(name).cstring()))
+      .insert("fields", json::JsonObject())
+      .insert("createTime", timestamp);
+  }
+
+  if (update_mask.is_array()) {
+    // only the masked fields change, masked fields without a value are removed
+    json::JsonObject document_fields = document.at("fields").to_object();
+    for (const auto &field_path : to_list(update_mask)) {
+      if (fields.at(field_path).is_valid()) {
+        document_fields.insert(field_path, fields.at(field_path));
+      } else {
+        document_fields.remove(field_path);
+      }
+    }
+  } else {
+    document.insert("fields", fields);
+  }
+
+  document.insert("updateTime", timestamp);
+  m_documents.insert(name, document);
+}
+
+void Emulator::transform_document(
+  var::StringView name,
+  const json::JsonArray &field_transforms) {
+  if (!m_documents.at(name).is_object()) {
+    update_document(name, json::JsonObject(), json::JsonValue());
+  }
+
+  json::JsonObject fields
+    = m_documents.at(name).to_object().at("fields").to_object();
+  for (u32 i = 0; i < field_transforms.count(); i++) {
+    const auto transform = field_transforms.at(i).to_object();
+    const auto field = transform.at("fieldPath").to_string_view();
+    const auto current = fields.at(field);
+
+    if (transform.at("setToServerValue").is_valid()) {
+      fields.insert(
+        field,
+        json::JsonObject().insert("timestampValue", get_timestamp()));
+    } else if (transform.at("increment").is_object()) {
+      const auto increment = transform.at("increment");
+      const auto current_type = get_type(current);
+      const auto increment_type = get_type(increment);
+      const bool is_integer
+        = increment_type == "integerValue"
+          && (current_type == "integerValue" || !current.is_valid());
+      const auto increment_value = increment.to_object().at(increment_type);
+      const auto current_value = current.is_valid()
+                                   ? current.to_object().at(current_type)
+                                   : json::JsonValue();
+      if (is_integer) {
+        const s64 total
+          = to_integer(increment_value)
+            + (current_value.is_valid() ? to_integer(current_value) : 0);
+        fields.insert(
+          field,
+          json::JsonObject().insert(
+            "integerValue",
+            json::JsonString(
+              var::String()
+                .format("%lld", static_cast<long long>(total))
+                .cstring())));
+      } else {
+        const bool is_number = current_type == "integerValue"
+                               || current_type == "doubleValue";
+        const double total
+          = to_number(increment_value)
+            + (is_number ? to_number(current_value) : 0.0);
+        fields.insert(
+          field,
+          json::JsonObject().insert("doubleValue", create_real(total)));
+      }
+    } else if (transform.at("maximum").is_object()) {
+      if (
+        !current.is_valid()
+        || compare_values(transform.at("maximum"), current) > 0) {
+        fields.insert(field, transform.at("maximum"));
+      }
+    } else if (transform.at("minimum").is_object()) {
+      if (
+        !current.is_valid()
+        || compare_values(transform.at("minimum"), current) < 0) {
+        fields.insert(field, transform.at("minimum"));
+      }
+    } else {
+      const bool is_append = transform.at("appendMissingElements").is_object();
+      const auto values = transform
+                            .at(
+                              is_append ? "appendMissingElements"
+                                        : "removeAllFromArray")
+                            .to_object()
+                            .at("values");
+
+      json::JsonArray result;
+      if (get_type(current) == "arrayValue") {
+        const auto current_values
+          = current.to_object().at("arrayValue").to_object().at("values");
+        for (u32 j = 0; current_values.is_array()
+                        && j < current_values.to_array().count();
+             j++) {
+          const auto element = current_values.to_array().at(j);
+          const auto remove = json::JsonObject().insert(
+            "arrayValue",
+            json::JsonObject().insert("values", values));
+          if (is_append || !contains_value(remove, element)) {
+            result.append(element);
+          }
+        }
+      }
+
+      if (is_append) {
+        for (u32 j = 0; values.is_array() && j < values.to_array().count();
+             j++) {
+          const auto element = values.to_array().at(j);
+          const auto existing = json::JsonObject().insert(
+            "arrayValue",
+            json::JsonObject().insert("values", result));
+          if (!contains_value(existing, element)) {
+            result.append(element);
+          }
+        }
+      }
+
+      fields.insert(
+        field,
+        json::JsonObject().insert(
+          "arrayValue",
+          json::JsonObject().insert("values", result)));
+    }
+  }
+
+  m_documents.at(name).to_object().insert("updateTime", get_timestamp());
+}
+
+var::Vector<json::JsonObject> Emulator::get_query_documents(
+  var::StringView parent,
+  const json::JsonObject &query) const {
+  const auto from = query.at("from").to_array().at(0).to_object();
+  const auto collection_id = from.at("collectionId").to_string_view();
+  const bool is_all_descendants = from.at("allDescendants").to_bool();
+  const auto filter = query.at("where");
+  const auto orders = query.at("orderBy");
+  const auto prefix = var::String(parent) + "/";
+
+  var::Vector<json::JsonObject> result;
+  for (const auto &key : m_documents.get_key_list()) {
+    const var::StringView name = key;
+    if (!starts_with(name, prefix)) {
+      continue;
+    }
+
+    // {collection}/{id} relative to the parent
+    const auto relative = name.get_substring_at_position(prefix.length());
+    const size_t id_slash = relative.reverse_find("/");
+    const auto collection_path = relative.get_substring_with_length(id_slash);
+    const bool is_child = collection_path.find("/") == var::StringView::npos;
+    if (
+      fs::Path::name(collection_path) != collection_id
+      || (!is_child && !is_all_descendants)) {
+      continue;
+    }
+
+    const auto document = m_documents.at(key).to_object();
+    const auto fields = document.at("fields").to_object();
+    if (filter.is_object() && !is_match(fields, filter.to_object())) {
+      continue;
+    }
+
+    bool is_ordered = true;
+    for (u32 i = 0; orders.is_array() && i < orders.to_array().count(); i++) {
+      const auto field_path = orders.to_array()
+                                .at(i)
+                                .to_object()
+                                .at("field")
+                                .to_object()
+                                .at("fieldPath")
+                                .to_string_view();
+      // documents without an order by field are not returned
+      is_ordered = is_ordered && get_field(fields, field_path).is_valid();
+    }
+
+    if (is_ordered) {
+      result.push_back(document);
+    }
+  }
+
+  std::sort(
+    result.begin(),
+    result.end(),
+    [&](const json::JsonObject &a, const json::JsonObject &b) {
+      for (u32 i = 0; orders.is_array() && i < orders.to_array().count();
+           i++) {
+        const auto order = orders.to_array().at(i).to_object();
+        const auto field_path
+          = order.at("field").to_object().at("fieldPath").to_string_view();
+        int comparison = compare_values(
+          get_field(a.at("fields").to_object(), field_path),
+          get_field(b.at("fields").to_object(), field_path));
+        if (order.at("direction").to_string_view() == "DESCENDING") {
+          comparison = -comparison;
+        }
+        if (comparison != 0) {
+          return comparison < 0;
+        }
+      }
+      return ::strcmp(a.at("name").to_cstring(), b.at("name").to_cstring())
+             < 0;
+    });
+
+  const u32 offset = query.at("offset").is_valid()
+                       ? u32(to_integer(query.at("offset")))
+                       : 0;
+  const u32 limit = query.at("limit").is_valid()
+                      ? u32(to_integer(query.at("limit")))
+                      : u32(result.count());
+
+  var::Vector<json::JsonObject> page;
+  for (u32 i = offset; i < result.count() && i < offset + limit; i++) {
+    page.push_back(result.at(i));
+  }
+  return page;
+}
+
+Emulator::Response Emulator::upload_object(
+  var::StringView bucket,
+  var::StringView url,
+  var::StringView body) {
+  const auto name = get_query_value(url, "name");
+  if (name.is_empty()) {
+    return create_error(
+      inet::Http::Status::bad_request,
+      "INVALID_ARGUMENT",
+      "the object name is missing");
+  }
+
+  return store_object(bucket, name, body);
+}
+
+Emulator::Response
+Emulator::start_upload_session(const Request &request, var::StringView bucket) {
+  const auto name = get_query_value(request.url(), "name");
+  const auto size
+    = get_header_field(request.header_fields(), "X-Upload-Content-Length");
+  if (name.is_empty() || size.is_empty()) {
+    return create_error(
+      inet::Http::Status::bad_request,
+      "INVALID_ARGUMENT",
+      "the object name or size is missing");
+  }
+
+  const auto id = generate_id();
+  m_upload_sessions.push_back(
+    {id,
+     var::String(bucket),
+     name,
+     size_t(size.string_view().to_integer()),
+     var::String()});
+
+  const auto location = var::String(storage_media_host)
+                        + "/upload/storage/v1/b/" + bucket + "/o?uploadType=resumable&name="
+                        + inet::Url::encode(name) + "&upload_id=" + id;
+  return {
+    inet::Http::Status::ok,
+    var::String(),
+    var::String("Location: ") + location + "\r\n"};
+}
+
+Emulator::Response Emulator::continue_upload_session(
+  const Request &request,
+  var::StringView body) {
+  const auto id = get_query_value(request.url(), "upload_id");
+  size_t index = 0;
+  while (index < m_upload_sessions.count()
+         && m_upload_sessions.at(index).id != id) {
+    index++;
+  }
+
+  if (index == m_upload_sessions.count()) {
+    return create_error(
+      inet::Http::Status::not_found,
+      "NOT_FOUND",
+      "No such upload session");
+  }
+
+  auto &session = m_upload_sessions.at(index);
+
+  // "bytes 0-99/200" sends data, "bytes */200" asks for the committed size
+  // (or finishes the upload) and "bytes 100-199/*" leaves the total open
+  const auto range
+    = get_header_field(request.header_fields(), "Content-Range");
+  auto remaining = range.string_view();
+  pop_segment(remaining, " ");
+  const bool is_total_open = remaining.length() > 0
+                             && remaining.get_substring_at_position(
+                                  remaining.length() - 1)
+                                  == "*";
+  if (remaining.length() && remaining.front() != '*') {
+    const size_t first = size_t(pop_segment(remaining, "-").to_integer());
+    if (first > session.data.length()) {
+      return create_error(
+        inet::Http::Status::bad_request,
+        "INVALID_ARGUMENT",
+        "the range starts after the committed bytes");
+    }
+
+    // a chunk that does not end the upload is cut to the granularity
+    size_t length = body.length();
+    if (is_total_open || first + length < session.size) {
+      length -= length % upload_chunk_granularity();
+    }
+
+    // bytes that were already committed are not stored again
+    const size_t overlap = session.data.length() - first;
+    if (overlap < length) {
+      session.data.append(
+        body.get_substring_with_length(length).get_substring_at_position(
+          overlap));
+    }
+  }
+
+  if (session.data.length() >= session.size && !is_total_open) {
+    // the last request may carry checksums of the whole object
+    const auto hashes
+      = get_header_field(request.header_fields(), "X-Goog-Hash");
+    const auto crc32c = get_hash(hashes, "crc32c");
+    const auto md5 = get_hash(hashes, "md5");
+    const auto data = var::View(session.data.string_view());
+    if (
+      (!crc32c.is_empty()
+       && crc32c != Crc32c().update(data).to_base64().string_view())
+      || (!md5.is_empty()
+          && md5 != Md5().update(data).to_base64().string_view())) {
+      m_upload_sessions.remove(index);
+      return create_error(
+        inet::Http::Status::bad_request,
+        "INVALID_ARGUMENT",
+        "the checksum does not match the uploaded data");
+    }
+
+    auto response = store_object(session.bucket, session.name, session.data);
+    m_upload_sessions.remove(index);
+    return response;
+  }
+
+  // 308 means the upload is incomplete
+  return {
+    inet::Http::Status::permanent_redirect,
+    var::String(),
+    session.data.length()
+      ? var::String().format(
+        "Range: bytes=0-%lu\r\n",
+        static_cast<unsigned long>(session.data.length() - 1))
+      : var::String()};
+}
+
+Emulator::Response Emulator::compose_object(
+  var::StringView bucket,
+  var::StringView name,
+  var::StringView body) {
+  const auto request = parse(body).to_object();
+  const auto source_objects = request.at("sourceObjects").to_array();
+
+  var::String data;
+  for (u32 i = 0; i < source_objects.count(); i++) {
+    const auto source_name
+      = source_objects.at(i).to_object().at("name").to_string_view();
+    const size_t index = find_object(bucket, source_name);
+    if (index == m_objects.count()) {
+      return create_error(
+        inet::Http::Status::not_found,
+        "NOT_FOUND",
+        "a source object was not found");
+    }
+    data.append(m_objects.at(index).data.string_view());
+  }
+
+  return store_object(bucket, name, data);
+}
+
+Emulator::Response Emulator::store_object(
+  var::StringView bucket,
+  var::StringView name,
+  var::StringView data) {
+  const size_t index = find_object(bucket, name);
+  if (index == m_objects.count()) {
+    m_objects.push_back(
+      {var::String(bucket),
+       var::String(name),
+       var::String(data),
+       ++m_id_count});
+    return create_response(get_object_details(m_objects.back()));
+  }
+
+  auto &object = m_objects.at(index);
+  object.data = var::String(data);
+  object.generation = ++m_id_count;
+  return create_response(get_object_details(object));
+}
+
+Emulator::Response
+Emulator::list_objects(var::StringView bucket, var::StringView url) const {
+  const auto prefix = get_query_value(url, "prefix");
+  const auto delimiter = get_query_value(url, "delimiter");
+  const auto max_results_value = get_query_value(url, "maxResults");
+  const u32 max_results = max_results_value.is_empty()
+                            ? 1000
+                            : max_results_value.string_view().to_integer();
+  const u32 start
+    = get_query_value(url, "pageToken").string_view().to_integer();
+
+  // prefixes are all on the first page
+  json::JsonArray items;
+  var::StringList prefixes;
+  u32 match_count = 0;
+  for (const auto &object : m_objects) {
+    if (
+      object.bucket.string_view() != bucket
+      || !starts_with(object.name, prefix)) {
+      continue;
+    }
+
+    const size_t position
+      = delimiter.is_empty()
+          ? var::StringView::npos
+          : object.name.string_view().find(delimiter, prefix.length());
+    if (position != var::StringView::npos) {
+      const auto directory = var::String(
+        object.name.string_view().get_substring_with_length(
+          position + delimiter.length()));
+      if (
+        start == 0
+        && std::find(prefixes.begin(), prefixes.end(), directory)
+             == prefixes.end()) {
+        prefixes.push_back(directory);
+      }
+      continue;
+    }
+
+    if (match_count >= start && match_count < start + max_results) {
+      items.append(get_object_details(object));
+    }
+    match_count++;
+  }
+
+  json::JsonObject result
+    = json::JsonObject().insert("kind", json::JsonString("storage#objects"));
+  if (items.count()) {
+    result.insert("items", items);
+  }
+  if (prefixes.count()) {
+    json::JsonArray prefix_array;
+    for (const auto &directory : prefixes) {
+      prefix_array.append(json::JsonString(directory.cstring()));
+    }
+    result.insert("prefixes", prefix_array);
+  }
+  if (start + max_results < match_count) {
+    result.insert(
+      "nextPageToken",
+      json::JsonString(var::NumberString(start + max_results).cstring()));
+  }
+  return create_response(result);
+}
+
+size_t
+Emulator::find_object(var::StringView bucket, var::StringView name) const {
+  for (size_t i = 0; i < m_objects.count(); i++) {
+    const auto &object = m_objects.at(i);
+    if (
+      object.bucket.string_view() == bucket
+      && object.name.string_view() == name) {
+      return i;
+    }
+  }
+  return m_objects.count();
+}
+
+json::JsonObject
+Emulator::get_object_details(const StorageObject &object) const {
+  const auto generation = var::String().format(
+    "%llu",
+    static_cast<unsigned long long>(object.generation));
+  const auto size = var::String().format(
+    "%lu",
+    static_cast<unsigned long>(object.data.length()));
+  const auto media_link = var::String(storage_media_host)
+                          + "/download/storage/v1/b/" + object.bucket + "/o/"
+                          + inet::Url::encode(object.name) + "?generation="
+                          + generation + "&alt=media";
+  const auto data = var::View(object.data.string_view());
+  const auto crc32c = Crc32c().update(data).to_base64();
+  const auto md5 = Md5().update(data).to_base64();
+
+  return json::JsonObject()
+    .insert("kind", json::JsonString("storage#object"))
+    .insert("name", json::JsonString(object.name.cstring()))
+    .insert("bucket", json::JsonString(object.bucket.cstring()))
+    .insert("generation", json::JsonString(generation.cstring()))
+    .insert("size", json::JsonString(size.cstring()))
+    .insert("contentType", json::JsonString("application/octet-stream"))
+    .insert("updated", get_timestamp())
+    .insert("mediaLink", json::JsonString(media_link.cstring()))
+    .insert("crc32c", json::JsonString(crc32c.cstring()))
+    .insert("md5Hash", json::JsonString(md5.cstring()));
+}
+
+var::String Emulator::generate_id() {
+  // ids sort in the order they were created, like push ids
+  return var::String().format(
+    "emulator%012llu",
+    static_cast<unsigned long long>(++m_id_count));
+}
+
+Emulator::Response Emulator::create_response(const json::JsonValue &value) {
+  return {inet::Http::Status::ok, to_json_string(value)};
+}
+
+Emulator::Response Emulator::create_error(
+  inet::Http::Status status,
+  var::StringView code,
+  var::StringView message) {
+  return {
+    status,
+    to_json_string(json::JsonObject().insert(
+      "error",
+      json::JsonObject()
+        .insert("code", json::JsonInteger(int(status)))
+        .insert("message", json::JsonString(var::String(message).cstring()))
+        .insert("status", json::JsonString(var::String(code).cstring()))))};
+}
@@ -0,0 +1,317 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <cstring>
+
+#include <var.hpp>
+
+#include "cloud/EventStream.hpp"
+
+using namespace cloud;
+
+namespace {
+
+bool is_whitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+size_t skip_whitespace(var::StringView text, size_t offset) {
+  while (offset < text.length() && is_whitespace(text.at(offset))) {
+    offset++;
+  }
+  return offset;
+}
+
+// returns the offset after the closing quote of the string at offset
+size_t skip_string(var::StringView text, size_t offset) {
+  offset++;
+  while (offset < text.length()) {
+    const char c = text.at(offset);
+    if (c == '\\') {
+      offset += 2;
+    } else if (c == '"') {
+      return offset + 1;
+    } else {
+      offset++;
+    }
+  }
+  return var::StringView::npos;
+}
+
+// returns the offset after the JSON value at offset
+size_t skip_value(var::StringView text, size_t offset) {
+  int depth = 0;
+  while (offset < text.length()) {
+    const char c = text.at(offset);
+    if (c == '"') {
+      offset = skip_string(text, offset);
+      if (offset == var::StringView::npos) {
+        return offset;
+      }
+      if (depth == 0) {
+        return offset;
+      }
+      continue;
+    }
+
+    if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) {
+        return offset;
+      }
+      depth--;
+    } else if (c == ',' && depth == 0) {
+      return offset;
+    }
+
+    offset++;
+    if (depth == 0 && (c == '}' || c == ']')) {
+      return offset;
+    }
+  }
+  return depth == 0 ? offset : var::StringView::npos;
+}
+
+var::StringView trim_back(var::StringView text) {
+  while (text.length() && is_whitespace(text.back())) {
+    text.pop_back();
+  }
+  return text;
+}
+
+} // namespace
+
+EventStreamParser::Event::Type
+EventStreamParser::Event::get_type(var::StringView name) {
+  if (name == "put") {
+    return Type::put;
+  }
+  if (name == "patch") {
+    return Type::patch;
+  }
+  if (name == "keep-alive") {
+    return Type::keep_alive;
+  }
+  if (name == "cancel") {
+    return Type::cancel;
+  }
+  if (name == "auth_revoked") {
+    return Type::auth_revoked;
+  }
+  return Type::unknown;
+}
+
+EventStreamParser::EventStreamParser(Callback callback, size_t capacity)
+  : m_callback(std::move(callback)), m_buffer(capacity) {}
+
+EventStreamParser &EventStreamParser::reset() {
+  m_head = m_line = m_scan = m_tail = 0;
+  m_name = m_data = Range();
+  m_data_count = 0;
+  m_data_lines.clear();
+  return *this;
+}
+
+int EventStreamParser::feed(var::View chunk) {
+  const char *input = chunk.to_const_char();
+  size_t remaining = chunk.size();
+
+  while (remaining) {
+    if (m_tail == m_buffer.size()) {
+      make_room();
+    }
+
+    const size_t copy_size = remaining < m_buffer.size() - m_tail
+                               ? remaining
+                               : m_buffer.size() - m_tail;
+    char *buffer = reinterpret_cast<char *>(m_buffer.data_u8());
+    ::memcpy(buffer + m_tail, input, copy_size);
+    m_tail += copy_size;
+    input += copy_size;
+    remaining -= copy_size;
+
+    // process each complete line
+    while (m_scan < m_tail) {
+      const void *line_end = ::memchr(buffer + m_scan, '\n', m_tail - m_scan);
+      if (line_end == nullptr) {
+        m_scan = m_tail;
+        break;
+      }
+
+      const size_t end = size_t(reinterpret_cast<const char *>(line_end) - buffer);
+      const size_t begin = m_line;
+      m_line = m_scan = end + 1;
+      const int result = process_line(begin, end);
+      if (result < 0) {
+        return result;
+      }
+    }
+  }
+
+  return int(chunk.size());
+}
+
+int EventStreamParser::process_line(size_t begin, size_t end) {
+  const char *buffer = reinterpret_cast<const char *>(m_buffer.data_u8());
+  if (end > begin && buffer[end - 1] == '\r') {
+    end--;
+  }
+
+  if (end == begin) {
+    // a blank line ends the event
+    const int result = dispatch();
+    m_head = m_line;
+    return result;
+  }
+
+  const auto line = var::StringView(buffer + begin, end - begin);
+  if (line.at(0) == ':') {
+    // comment
+    return 0;
+  }
+
+  const size_t colon = line.find(":");
+  const auto field = colon == var::StringView::npos
+                       ? line
+                       : line.get_substring_with_length(colon);
+  size_t value_offset = colon == var::StringView::npos ? end : begin + colon + 1;
+  if (value_offset < end && buffer[value_offset] == ' ') {
+    value_offset++;
+  }
+  const Range value = {value_offset, end - value_offset};
+
+  if (field == "event") {
+    m_name = value;
+  } else if (field == "data") {
+    if (m_data_count == 0) {
+      m_data = value;
+    } else {
+      // multiple data lines are joined with a newline
+      if (m_data_count == 1) {
+        m_data_lines = var::String(get_view(m_data));
+      }
+      m_data_lines.append("\n");
+      m_data_lines.append(get_view(value));
+    }
+    m_data_count++;
+  }
+
+  return 0;
+}
+
+int EventStreamParser::dispatch() {
+  if (m_name.length == 0 && m_data_count == 0) {
+    return 0;
+  }
+
+  Event event;
+  event.m_name = get_view(m_name);
+  event.m_data
+    = m_data_count > 1 ? m_data_lines.string_view() : get_view(m_data);
+  event.m_type = Event::get_type(event.m_name);
+
+  int result = 0;
+  if (
+    (event.m_type == Event::Type::put || event.m_type == Event::Type::patch)
+    && split_payload(event.m_data, event.m_path, event.m_value) < 0) {
+    event.m_type = Event::Type::unknown;
+  }
+
+  if (m_callback) {
+    result = m_callback(event);
+  }
+
+  m_name = m_data = Range();
+  m_data_count = 0;
+  return result;
+}
+
+void EventStreamParser::make_room() {
+  if (m_head > 0) {
+    // drop the events that have already been dispatched
+    char *buffer = reinterpret_cast<char *>(m_buffer.data_u8());
+    ::memmove(buffer, buffer + m_head, m_tail - m_head);
+    m_tail -= m_head;
+    m_line -= m_head;
+    m_scan -= m_head;
+    if (m_name.offset >= m_head) {
+      m_name.offset -= m_head;
+    }
+    if (m_data.offset >= m_head) {
+      m_data.offset -= m_head;
+    }
+    m_head = 0;
+    return;
+  }
+
+  // the current event is bigger than the buffer
+  m_buffer.resize(m_buffer.size() * 2);
+}
+
+var::StringView EventStreamParser::get_view(const Range &range) const {
+  return var::StringView(
+    reinterpret_cast<const char *>(m_buffer.data_u8()) + range.offset,
+    range.length);
+}
+
+int EventStreamParser::split_payload(
+  var::StringView payload,
+  var::StringView &path,
+  var::StringView &value) {
+  size_t offset = skip_whitespace(payload, 0);
+  if (offset == payload.length() || payload.at(offset) != '{') {
+    return -1;
+  }
+  offset++;
+
+  while (true) {
+    offset = skip_whitespace(payload, offset);
+    if (offset == payload.length() || payload.at(offset) != '"') {
+      return -1;
+    }
+
+    const size_t key_end = skip_string(payload, offset);
+    if (key_end == var::StringView::npos) {
+      return -1;
+    }
+    const auto key
+      = payload.get_substring_at_position(offset + 1).get_substring_with_length(
+        key_end - offset - 2);
+
+    offset = skip_whitespace(payload, key_end);
+    if (offset == payload.length() || payload.at(offset) != ':') {
+      return -1;
+    }
+    offset = skip_whitespace(payload, offset + 1);
+
+    const size_t value_end = skip_value(payload, offset);
+    if (value_end == var::StringView::npos) {
+      return -1;
+    }
+    const auto member = trim_back(
+      payload.get_substring_at_position(offset).get_substring_with_length(
+        value_end - offset));
+
+    if (key == "path") {
+      // strip the quotes
+      path = member.length() >= 2 ? member.get_substring_at_position(1)
+                                      .get_substring_with_length(
+                                        member.length() - 2)
+                                  : member;
+    } else if (key == "data") {
+      value = member;
+    }
+
+    offset = skip_whitespace(payload, value_end);
+    if (offset == payload.length()) {
+      return -1;
+    }
+    if (payload.at(offset) == '}') {
+      return 0;
+    }
+    if (payload.at(offset) != ',') {
+      return -1;
+    }
+    offset++;
+  }
+}
@@ -0,0 +1,622 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <json.hpp>
+#include <var.hpp>
+
+#include "cloud/JsonStream.hpp"
+
+using namespace cloud;
+
+namespace {
+
+bool is_whitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+bool is_number_character(char c) {
+  return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e'
+         || c == 'E';
+}
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+} // namespace
+
+int JsonStreamParser::feed(var::View chunk) {
+  if (m_state == State::error) {
+    return -1;
+  }
+
+  const char *data = chunk.to_const_char();
+  const size_t size = chunk.size();
+  size_t offset = 0;
+
+  while (offset < size) {
+    int result = 0;
+    switch (m_token) {
+    case Token::string:
+      result = parse_string(data, size, offset);
+      break;
+    case Token::number:
+      result = parse_number(data, size, offset);
+      break;
+    case Token::literal:
+      result = parse_literal(data, size, offset);
+      break;
+    case Token::none: {
+      const char c = data[offset];
+      offset++;
+      if (!is_whitespace(c)) {
+        result = parse_structure(c);
+      }
+    } break;
+    }
+
+    if (result < 0) {
+      return fail();
+    }
+  }
+
+  return int(size);
+}
+
+int JsonStreamParser::finish() {
+  if (m_state == State::error) {
+    return -1;
+  }
+
+  if (m_token == Token::number && m_stack.count() == 0) {
+    // a top level number has no delimiter
+    m_token = Token::none;
+    if (complete_number(m_buffer.string_view()) < 0) {
+      return fail();
+    }
+    m_buffer.clear();
+  }
+
+  if (m_token != Token::none) {
+    return fail();
+  }
+
+  if (m_state == State::done) {
+    return 0;
+  }
+
+  // empty input is not an error
+  return (m_state == State::value && m_stack.count() == 0) ? 0 : fail();
+}
+
+JsonStreamParser &JsonStreamParser::reset() {
+  m_state = State::value;
+  m_token = Token::none;
+  m_stack.clear();
+  m_buffer.clear();
+  m_is_key = false;
+  m_is_escape = false;
+  m_unicode_count = 0;
+  m_unicode_value = 0;
+  m_high_surrogate = 0;
+  m_literal_position = 0;
+  m_is_stopped = false;
+  return *this;
+}
+
+int JsonStreamParser::parse_structure(char c) {
+  switch (c) {
+  case '{':
+    if (!is_value_expected()) {
+      return -1;
+    }
+    m_stack.push_back(Container::object);
+    m_state = State::key_or_end_object;
+    return handle(m_handler->begin_object());
+
+  case '[':
+    if (!is_value_expected()) {
+      return -1;
+    }
+    m_stack.push_back(Container::array);
+    m_state = State::value_or_end_array;
+    return handle(m_handler->begin_array());
+
+  case '}':
+    if (
+      (m_state != State::key_or_end_object && m_state != State::comma_or_end)
+      || m_stack.count() == 0 || m_stack.back() != Container::object) {
+      return -1;
+    }
+    m_stack.pop_back();
+    return complete_value(m_handler->end_object());
+
+  case ']':
+    if (
+      (m_state != State::value_or_end_array && m_state != State::comma_or_end)
+      || m_stack.count() == 0 || m_stack.back() != Container::array) {
+      return -1;
+    }
+    m_stack.pop_back();
+    return complete_value(m_handler->end_array());
+
+  case ':':
+    if (m_state != State::colon) {
+      return -1;
+    }
+    m_state = State::value;
+    return 0;
+
+  case ',':
+    if (m_state != State::comma_or_end) {
+      return -1;
+    }
+    m_state
+      = m_stack.back() == Container::object ? State::key : State::value;
+    return 0;
+
+  case '"':
+    if (m_state == State::key || m_state == State::key_or_end_object) {
+      m_is_key = true;
+    } else if (is_value_expected()) {
+      m_is_key = false;
+    } else {
+      return -1;
+    }
+    m_token = Token::string;
+    return 0;
+
+  case 't':
+    m_literal = "true";
+    break;
+  case 'f':
+    m_literal = "false";
+    break;
+  case 'n':
+    m_literal = "null";
+    break;
+
+  default:
+    if (is_number_character(c) && is_value_expected()) {
+      m_token = Token::number;
+      m_buffer.append(var::StringView(&c, 1));
+      return 0;
+    }
+    return -1;
+  }
+
+  if (!is_value_expected()) {
+    return -1;
+  }
+  m_token = Token::literal;
+  m_literal_position = 1;
+  return 0;
+}
+
+int JsonStreamParser::parse_string(
+  const char *data,
+  size_t size,
+  size_t &offset) {
+  while (offset < size) {
+    const char c = data[offset];
+
+    if (m_unicode_count) {
+      const int value = hex_value(c);
+      if (value < 0) {
+        return -1;
+      }
+      m_unicode_value = (m_unicode_value << 4) | u32(value);
+      offset++;
+      if (--m_unicode_count == 0) {
+        append_code_point(m_unicode_value);
+      }
+      continue;
+    }
+
+    if (m_is_escape) {
+      m_is_escape = false;
+      offset++;
+      char decoded = c;
+      switch (c) {
+      case 'b':
+        decoded = '\b';
+        break;
+      case 'f':
+        decoded = '\f';
+        break;
+      case 'n':
+        decoded = '\n';
+        break;
+      case 'r':
+        decoded = '\r';
+        break;
+      case 't':
+        decoded = '\t';
+        break;
+      case 'u':
+        m_unicode_count = 4;
+        m_unicode_value = 0;
+        continue;
+      case '"':
+      case '\\':
+      case '/':
+        break;
+      default:
+        return -1;
+      }
+      m_buffer.append(var::StringView(&decoded, 1));
+      continue;
+    }
+
+    // consume a run of plain characters
+    const size_t start = offset;
+    while (offset < size && data[offset] != '"' && data[offset] != '\\') {
+      offset++;
+    }
+
+    const auto run = var::StringView(data + start, offset - start);
+    if (offset == size) {
+      m_buffer.append(run);
+      return 0;
+    }
+
+    if (data[offset] == '\\') {
+      m_buffer.append(run);
+      m_is_escape = true;
+      offset++;
+      continue;
+    }
+
+    // closing quote
+    offset++;
+    m_token = Token::none;
+    int result;
+    if (m_buffer.is_empty() && m_high_surrogate == 0) {
+      // the whole string is in this chunk
+      result = complete_string(run);
+    } else {
+      m_buffer.append(run);
+      result = complete_string(m_buffer.string_view());
+      m_buffer.clear();
+    }
+    m_high_surrogate = 0;
+    return result;
+  }
+  return 0;
+}
+
+int JsonStreamParser::parse_number(
+  const char *data,
+  size_t size,
+  size_t &offset) {
+  const size_t start = offset;
+  while (offset < size && is_number_character(data[offset])) {
+    offset++;
+  }
+
+  const auto run = var::StringView(data + start, offset - start);
+  if (offset == size) {
+    m_buffer.append(run);
+    return 0;
+  }
+
+  // the delimiter is left for parse_structure()
+  m_token = Token::none;
+  m_buffer.append(run);
+  const int result = complete_number(m_buffer.string_view());
+  m_buffer.clear();
+  return result;
+}
+
+int JsonStreamParser::parse_literal(
+  const char *data,
+  size_t size,
+  size_t &offset) {
+  while (offset < size && m_literal_position < m_literal.length()) {
+    if (data[offset] != m_literal.at(m_literal_position)) {
+      return -1;
+    }
+    offset++;
+    m_literal_position++;
+  }
+
+  if (m_literal_position < m_literal.length()) {
+    return 0;
+  }
+
+  m_token = Token::none;
+  switch (m_literal.at(0)) {
+  case 't':
+    return complete_value(m_handler->boolean(true));
+  case 'f':
+    return complete_value(m_handler->boolean(false));
+  default:
+    return complete_value(m_handler->null());
+  }
+}
+
+int JsonStreamParser::complete_string(var::StringView value) {
+  if (m_is_key) {
+    m_state = State::colon;
+    return handle(m_handler->key(value));
+  }
+  return complete_value(m_handler->string(value));
+}
+
+int JsonStreamParser::complete_number(var::StringView value) {
+  return complete_value(m_handler->number(value));
+}
+
+int JsonStreamParser::complete_value(int handler_result) {
+  m_state = m_stack.count() == 0 ? State::done : State::comma_or_end;
+  return handle(handler_result);
+}
+
+int JsonStreamParser::handle(int handler_result) {
+  if (handler_result < 0) {
+    m_is_stopped = true;
+  }
+  return handler_result;
+}
+
+void JsonStreamParser::append_code_point(u32 code_point) {
+  if (code_point >= 0xd800 && code_point <= 0xdbff) {
+    // wait for the low surrogate
+    m_high_surrogate = code_point;
+    return;
+  }
+
+  if (code_point >= 0xdc00 && code_point <= 0xdfff && m_high_surrogate) {
+    code_point
+      = 0x10000 + ((m_high_surrogate - 0xd800) << 10) + (code_point - 0xdc00);
+  }
+  m_high_surrogate = 0;
+
+  char encoded[4];
+  size_t length;
+  if (code_point < 0x80) {
+    encoded[0] = char(code_point);
+    length = 1;
+  } else if (code_point < 0x800) {
+    encoded[0] = char(0xc0 | (code_point >> 6));
+    encoded[1] = char(0x80 | (code_point & 0x3f));
+    length = 2;
+  } else if (code_point < 0x10000) {
+    encoded[0] = char(0xe0 | (code_point >> 12));
+    encoded[1] = char(0x80 | ((code_point >> 6) & 0x3f));
+    encoded[2] = char(0x80 | (code_point & 0x3f));
+    length = 3;
+  } else {
+    encoded[0] = char(0xf0 | (code_point >> 18));
+    encoded[1] = char(0x80 | ((code_point >> 12) & 0x3f));
+    encoded[2] = char(0x80 | ((code_point >> 6) & 0x3f));
+    encoded[3] = char(0x80 | (code_point & 0x3f));
+    length = 4;
+  }
+  m_buffer.append(var::StringView(encoded, length));
+}
+
+int JsonTreeBuilder::begin_object() { return begin_container(JsonObject()); }
+
+int JsonTreeBuilder::begin_array() { return begin_container(JsonArray()); }
+
+int JsonTreeBuilder::key(var::StringView key) {
+  m_key = var::String(key);
+  return 0;
+}
+
+int JsonTreeBuilder::string(var::StringView value) {
+  return add_value(JsonString(var::String(value).cstring()));
+}
+
+int JsonTreeBuilder::number(var::StringView value) {
+  const auto result = create_number(value);
+  if (!result.is_valid()) {
+    return -1;
+  }
+  return add_value(result);
+}
+
+json::JsonValue JsonTreeBuilder::create_number(var::StringView token) {
+  const var::String text(token);
+  const bool is_real = token.find(".") != var::StringView::npos
+                       || token.find("e") != var::StringView::npos
+                       || token.find("E") != var::StringView::npos;
+  char *end = nullptr;
+  errno = 0;
+  const s64 integer = is_real ? 0 : ::strtoll(text.cstring(), &end, 10);
+  const double real = is_real ? ::strtod(text.cstring(), &end) : 0.0;
+  if (text.is_empty() || *end != '\0' || errno == ERANGE) {
+    return json::JsonValue();
+  }
+  return is_real ? create_real(real) : create_integer(integer);
+}
+
+json::JsonValue JsonTreeBuilder::create_integer(s64 value) {
+  json_t *integer = json_integer(json_int_t(value));
+  // the value takes its own reference
+  const json::JsonValue result(integer);
+  json_decref(integer);
+  return result;
+}
+
+json::JsonValue JsonTreeBuilder::create_real(double value) {
+  json_t *real = json_real(value);
+  const json::JsonValue result(real);
+  json_decref(real);
+  return result;
+}
+
+int JsonTreeBuilder::boolean(bool value) {
+  if (value) {
+    return add_value(JsonTrue());
+  }
+  return add_value(JsonFalse());
+}
+
+int JsonTreeBuilder::null() { return add_value(JsonNull()); }
+
+int JsonTreeBuilder::add_value(const json::JsonValue &value) {
+  const size_t depth = m_stack.count();
+  if (is_element(depth)) {
+    return m_element_callback(value);
+  }
+
+  if (depth == 0) {
+    m_value = value;
+    return 0;
+  }
+
+  auto &parent = m_stack.back();
+  if (parent.is_object()) {
+    parent.to_object().insert(m_key, value);
+  } else {
+    parent.to_array().append(value);
+  }
+  return 0;
+}
+
+int JsonTreeBuilder::begin_container(const json::JsonValue &container) {
+  // elements are handed to the callback once they are complete
+  if (!is_element(m_stack.count()) && add_value(container) < 0) {
+    return -1;
+  }
+  m_stack.push_back(container);
+  return 0;
+}
+
+int JsonTreeBuilder::end_container() {
+  const json::JsonValue container = m_stack.back();
+  m_stack.pop_back();
+  if (is_element(m_stack.count())) {
+    return m_element_callback(container);
+  }
+  return 0;
+}
+
+int JsonWriter::begin_object() {
+  begin_value();
+  m_output->append("{");
+  m_is_first.push_back(1);
+  return 0;
+}
+
+int JsonWriter::end_object() {
+  m_is_first.pop_back();
+  m_output->append("}");
+  return 0;
+}
+
+int JsonWriter::begin_array() {
+  begin_value();
+  m_output->append("[");
+  m_is_first.push_back(1);
+  return 0;
+}
+
+int JsonWriter::end_array() {
+  m_is_first.pop_back();
+  m_output->append("]");
+  return 0;
+}
+
+int JsonWriter::key(var::StringView key) {
+  begin_value();
+  append_string(*m_output, key);
+  m_output->append(":");
+  m_is_after_key = true;
+  return 0;
+}
+
+int JsonWriter::string(var::StringView value) {
+  begin_value();
+  append_string(*m_output, value);
+  return 0;
+}
+
+int JsonWriter::number(var::StringView value) {
+  begin_value();
+  m_output->append(value);
+  return 0;
+}
+
+int JsonWriter::boolean(bool value) {
+  begin_value();
+  m_output->append(value ? "true" : "false");
+  return 0;
+}
+
+int JsonWriter::null() {
+  begin_value();
+  m_output->append("null");
+  return 0;
+}
+
+void JsonWriter::append_string(var::String &output, var::StringView value) {
+  static constexpr auto hex = "0123456789abcdef";
+  output.append("\"");
+
+  // copy runs of characters that do not need to be escaped
+  size_t start = 0;
+  for (size_t i = 0; i < value.length(); i++) {
+    const auto c = static_cast<unsigned char>(value.at(i));
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    output.append(value.get_substring_at_position(start)
+                    .get_substring_with_length(i - start));
+    start = i + 1;
+    switch (c) {
+    case '"':
+      output.append("\\\"");
+      break;
+    case '\\':
+      output.append("\\\\");
+      break;
+    case '\n':
+      output.append("\\n");
+      break;
+    case '\r':
+      output.append("\\r");
+      break;
+    case '\t':
+      output.append("\\t");
+      break;
+    default: {
+      const char escaped[6]
+        = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0f]};
+      output.append(var::StringView(escaped, sizeof(escaped)));
+    } break;
+    }
+  }
+
+  output.append(value.get_substring_at_position(start));
+  output.append("\"");
+}
+
+void JsonWriter::begin_value() {
+  if (m_is_after_key) {
+    // the key already wrote the separator
+    m_is_after_key = false;
+    return;
+  }
+
+  if (m_is_first.count()) {
+    if (!m_is_first.back()) {
+      m_output->append(",");
+    }
+    m_is_first.back() = 0;
+  }
+}
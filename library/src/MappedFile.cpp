@@ -0,0 +1,116 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <cstdint>
+
+#include <var.hpp>
+
+#include "cloud/MappedFile.hpp"
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__StratifyOS__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CLOUD_API_IS_MMAP 1
+#endif
+
+using namespace cloud;
+
+MappedFile::MappedFile(var::StringView path)
+  : m_view(map(path, 0, false)), m_file(m_view) {}
+
+MappedFile::MappedFile(var::StringView path, size_t size)
+  : m_view(map(path, size, true)), m_file(m_view) {}
+
+MappedFile::~MappedFile() {
+#if CLOUD_API_IS_MMAP
+  if (m_address) {
+    // shared mappings are written back by the system
+    ::munmap(m_address, m_size);
+  }
+#endif
+}
+
+bool MappedFile::is_supported() {
+#if CLOUD_API_IS_MMAP
+  return true;
+#else
+  return false;
+#endif
+}
+
+var::View MappedFile::map(var::StringView path, size_t size, bool is_write) {
+#if CLOUD_API_IS_MMAP
+  if (is_error()) {
+    return var::View();
+  }
+
+  // failures are not errors, is_mapped() stays false
+  const var::PathString file_path(path);
+  const int fd = is_write ? ::open(
+                   file_path.cstring(),
+                   O_RDWR | O_CREAT | O_TRUNC,
+                   0666)
+                          : ::open(file_path.cstring(), O_RDONLY);
+  if (fd < 0) {
+    return var::View();
+  }
+
+  size_t file_size = size;
+  if (is_write) {
+    if (::ftruncate(fd, off_t(size)) < 0) {
+      ::close(fd);
+      return var::View();
+    }
+  } else {
+    struct stat info;
+    if (
+      ::fstat(fd, &info) < 0
+      || static_cast<unsigned long long>(info.st_size) > SIZE_MAX) {
+      ::close(fd);
+      return var::View();
+    }
+    file_size = size_t(info.st_size);
+  }
+
+  if (file_size == 0) {
+    // an empty file cannot be mapped and has nothing to transfer
+    ::close(fd);
+    m_is_mapped = true;
+    return var::View();
+  }
+
+  void *address = ::mmap(
+    nullptr,
+    file_size,
+    is_write ? PROT_READ | PROT_WRITE : PROT_READ,
+    MAP_SHARED,
+    fd,
+    0);
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (address == MAP_FAILED) {
+    // for example, a file larger than the free address space of a 32-bit
+    // process, the caller uses fs::File instead
+    return var::View();
+  }
+
+  if (!is_write) {
+    // transfers read the file once from start to end
+    ::madvise(address, file_size, MADV_SEQUENTIAL);
+  }
+
+  m_address = address;
+  m_size = file_size;
+  m_is_mapped = true;
+  if (is_write) {
+    return var::View(address, file_size);
+  }
+  return var::View(static_cast<const void *>(address), file_size);
+#else
+  MCU_UNUSED_ARGUMENT(path);
+  MCU_UNUSED_ARGUMENT(size);
+  MCU_UNUSED_ARGUMENT(is_write);
+  return var::View();
+#endif
+}
@@ -0,0 +1,83 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <json.hpp>
+#include <var.hpp>
+
+#include "cloud/MetadataCache.hpp"
+
+using namespace cloud;
+
+MetadataCache::MetadataCache(size_t capacity)
+  : m_capacity(capacity ? capacity : 1) {}
+
+json::JsonObject
+MetadataCache::get(var::StringView path, var::StringView generation) const {
+  var::String details;
+  {
+    thread::Mutex::Scope mutex_scope(m_mutex);
+    const size_t index = find(path);
+    if (
+      index == m_entries.count()
+      || (!generation.is_empty()
+          && m_entries.at(index).generation.string_view() != generation)) {
+      return json::JsonObject();
+    }
+
+    // move the entry to the back as the most recently used
+    Entry entry = std::move(m_entries.at(index));
+    m_entries.remove(index);
+    details = entry.details;
+    m_entries.push_back(std::move(entry));
+  }
+
+  return json::JsonDocument().from_string(details).to_object();
+}
+
+MetadataCache &
+MetadataCache::insert(var::StringView path, const json::JsonObject &details) {
+  Entry entry{
+    var::String(path),
+    var::String(details.at("generation").to_string_view()),
+    json::JsonDocument()
+      .set_flags(json::JsonDocument::Flags::compact)
+      .to_string(details)};
+
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  const size_t index = find(path);
+  if (index < m_entries.count()) {
+    m_entries.remove(index);
+  } else if (m_entries.count() == m_capacity) {
+    m_entries.remove(0);
+  }
+  m_entries.push_back(std::move(entry));
+  return *this;
+}
+
+MetadataCache &MetadataCache::remove(var::StringView path) {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  const size_t index = find(path);
+  if (index < m_entries.count()) {
+    m_entries.remove(index);
+  }
+  return *this;
+}
+
+MetadataCache &MetadataCache::clear() {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  m_entries.clear();
+  return *this;
+}
+
+size_t MetadataCache::count() const {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  return m_entries.count();
+}
+
+size_t MetadataCache::find(var::StringView path) const {
+  for (size_t i = 0; i < m_entries.count(); i++) {
+    if (m_entries.at(i).path.string_view() == path) {
+      return i;
+    }
+  }
+  return m_entries.count();
+}
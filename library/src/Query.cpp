@@ -0,0 +1,197 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <json.hpp>
+#include <var.hpp>
+
+#include "cloud/Cloud.hpp"
+#include "cloud/Query.hpp"
+
+using namespace cloud;
+
+namespace {
+
+json::JsonObject create_field_reference(var::StringView field) {
+  return json::JsonObject().insert(
+    "fieldPath",
+    json::JsonString(var::String(field).cstring()));
+}
+
+} // namespace
+
+Query::Query(var::StringView path) {
+  const size_t slash = path.reverse_find("/");
+  if (slash == var::StringView::npos) {
+    m_collection_id = var::String(path);
+  } else {
+    m_parent = var::String(path.get_substring_with_length(slash));
+    m_collection_id = var::String(path.get_substring_at_position(slash + 1));
+  }
+}
+
+Query &Query::where(
+  var::StringView field,
+  Operator operation,
+  const json::JsonValue &value) {
+
+  if (
+    value.is_null()
+    && (operation == Operator::equal || operation == Operator::not_equal)) {
+    // comparisons with null use a unary filter
+    m_filters.append(json::JsonObject().insert(
+      "unaryFilter",
+      json::JsonObject()
+        .insert(
+          "op",
+          json::JsonString(
+            operation == Operator::equal ? "IS_NULL" : "IS_NOT_NULL"))
+        .insert("field", create_field_reference(field))));
+    return *this;
+  }
+
+  m_filters.append(json::JsonObject().insert(
+    "fieldFilter",
+    json::JsonObject()
+      .insert("field", create_field_reference(field))
+      .insert(
+        "op",
+        json::JsonString(var::String(to_string(operation)).cstring()))
+      .insert("value", CloudMap::from_json_value(value))));
+  return *this;
+}
+
+Query &Query::order_by(var::StringView field, Direction direction) {
+  m_orders.append(
+    json::JsonObject()
+      .insert("field", create_field_reference(field))
+      .insert(
+        "direction",
+        json::JsonString(
+          direction == Direction::ascending ? "ASCENDING" : "DESCENDING")));
+  return *this;
+}
+
+Query &Query::start_at(const json::JsonArray &values) {
+  m_start_at = create_cursor(values, true);
+  return *this;
+}
+
+Query &Query::start_after(const json::JsonArray &values) {
+  m_start_at = create_cursor(values, false);
+  return *this;
+}
+
+Query &Query::end_at(const json::JsonArray &values) {
+  m_end_at = create_cursor(values, false);
+  return *this;
+}
+
+Query &Query::end_before(const json::JsonArray &values) {
+  m_end_at = create_cursor(values, true);
+  return *this;
+}
+
+Query &Query::select(const var::StringList &fields) {
+  m_fields = json::JsonArray();
+  for (const auto &field : fields) {
+    m_fields.append(create_field_reference(field));
+  }
+  return *this;
+}
+
+json::JsonObject Query::get_filter() const {
+  if (m_filters.count() == 0) {
+    return json::JsonObject();
+  }
+
+  if (m_filters.count() == 1) {
+    return m_filters.at(0).to_object();
+  }
+
+  return json::JsonObject().insert(
+    "compositeFilter",
+    json::JsonObject()
+      .insert("op", json::JsonString("AND"))
+      .insert("filters", m_filters));
+}
+
+json::JsonObject Query::to_object() const {
+  json::JsonObject result;
+
+  if (m_fields.count()) {
+    result.insert("select", json::JsonObject().insert("fields", m_fields));
+  }
+
+  auto from = json::JsonObject().insert(
+    "collectionId",
+    json::JsonString(m_collection_id.cstring()));
+  if (is_all_descendants()) {
+    from.insert("allDescendants", json::JsonTrue());
+  }
+  result.insert("from", json::JsonArray().append(from));
+
+  if (m_filters.count()) {
+    result.insert("where", get_filter());
+  }
+
+  if (m_orders.count()) {
+    result.insert("orderBy", m_orders);
+  }
+
+  if (m_start_at.count()) {
+    result.insert("startAt", m_start_at);
+  }
+
+  if (m_end_at.count()) {
+    result.insert("endAt", m_end_at);
+  }
+
+  if (offset()) {
+    result.insert("offset", json::JsonInteger(offset()));
+  }
+
+  if (limit()) {
+    result.insert("limit", json::JsonInteger(limit()));
+  }
+
+  return result;
+}
+
+var::StringView Query::to_string(Operator value) {
+  switch (value) {
+  case Operator::less_than:
+    return "LESS_THAN";
+  case Operator::less_than_or_equal:
+    return "LESS_THAN_OR_EQUAL";
+  case Operator::greater_than:
+    return "GREATER_THAN";
+  case Operator::greater_than_or_equal:
+    return "GREATER_THAN_OR_EQUAL";
+  case Operator::equal:
+    return "EQUAL";
+  case Operator::not_equal:
+    return "NOT_EQUAL";
+  case Operator::array_contains:
+    return "ARRAY_CONTAINS";
+  case Operator::in:
+    return "IN";
+  case Operator::array_contains_any:
+    return "ARRAY_CONTAINS_ANY";
+  case Operator::not_in:
+    return "NOT_IN";
+  }
+  return "OPERATOR_UNSPECIFIED";
+}
+
+json::JsonObject
+Query::create_cursor(const json::JsonArray &values, bool is_before) {
+  json::JsonArray cursor_values;
+  for (u32 i = 0; i < values.count(); i++) {
+    cursor_values.append(CloudMap::from_json_value(values.at(i)));
+  }
+
+  json::JsonObject result = json::JsonObject().insert("values", cursor_values);
+  if (is_before) {
+    result.insert("before", json::JsonTrue());
+  }
+  return result;
+}
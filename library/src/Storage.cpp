@@ -1,61 +1,428 @@
+#include <cstdlib>
+#include <memory>
+
+#include <chrono.hpp>
 #include <fs.hpp>
 #include <inet.hpp>
 #include <json.hpp>
+#include <thread.hpp>
 #include <var.hpp>
 
+#include "cloud/MappedFile.hpp"
 #include "cloud/Storage.hpp"
 
 using namespace cloud;
 
+namespace {
+
+// https://host/path?query to /path?query
+var::StringView get_url_path(var::StringView url) {
+  const size_t scheme = url.find("://");
+  if (scheme == var::StringView::npos) {
+    return url;
+  }
+  const size_t path = url.find("/", scheme + 3);
+  return path == var::StringView::npos ? var::StringView()
+                                       : url.get_substring_at_position(path);
+}
+
+// the value of name in "crc32c=...,md5=..."
+var::StringView get_hash(var::StringView hashes, var::StringView name) {
+  auto remaining = hashes;
+  while (remaining.length()) {
+    const size_t comma = remaining.find(",");
+    auto pair = comma == var::StringView::npos
+                  ? remaining
+                  : remaining.get_substring_with_length(comma);
+    remaining.pop_front(
+      comma == var::StringView::npos ? remaining.length() : comma + 1);
+    while (pair.length() && pair.front() == ' ') {
+      pair.pop_front();
+    }
+    const size_t equal = pair.find("=");
+    if (
+      equal != var::StringView::npos
+      && pair.get_substring_with_length(equal) == name) {
+      return pair.get_substring_at_position(equal + 1);
+    }
+  }
+  return var::StringView();
+}
+
+// shared by the threads of a ranged download
+struct RangeDownload {
+  Storage *storage;
+  var::StringView url;
+  const fs::FileObject *destination;
+  const api::ProgressCallback *progress_callback;
+  size_t size;
+  size_t range_size;
+  u8 retry_count;
+
+  thread::Mutex mutex;
+  size_t next_offset = 0;
+  size_t received = 0;
+  // the CRC32C of each range
+  var::Vector<u32> range_crc32c;
+  var::String error_message;
+  int error_number = 0;
+};
+
+// seek() takes an int, larger locations are reached in steps
+const fs::FileObject &seek_to(const fs::FileObject &file, size_t location) {
+  constexpr size_t step = 0x40000000;
+  if (location <= step) {
+    return file.seek(int(location));
+  }
+
+  file.seek(0);
+  size_t remaining = location;
+  while (remaining > step) {
+    file.seek(int(step), fs::FileObject::Whence::current);
+    remaining -= step;
+  }
+  return file.seek(int(remaining), fs::FileObject::Whence::current);
+}
+
+// sizes are decimal strings, as in the object details
+size_t to_size(const json::JsonValue &value) {
+  if (value.is_string()) {
+    return size_t(::strtoull(value.to_cstring(), nullptr, 10));
+  }
+  // sessions saved before sizes were strings
+  return size_t(value.to_integer());
+}
+
+var::String from_size(size_t value) {
+  return var::String().format("%llu", static_cast<unsigned long long>(value));
+}
+
+bool is_retryable(inet::Http::Status status) {
+  // server errors and 429 (too many requests)
+  return int(status) >= 500 || int(status) == 429;
+}
+
+// requests [offset, end) until it arrives, resuming from the last byte
+bool download_range(RangeDownload &download, size_t offset, size_t end) {
+  size_t position = offset;
+  u8 retry_count = 0;
+  // bytes arrive in order, a retry continues from position
+  Crc32c crc32c;
+  while (position < end) {
+    const size_t start = position;
+    auto connection = download.storage->checkout();
+    download.storage->add_header_field(
+      connection,
+      "Range",
+      String().format(
+        "bytes=%lu-%lu",
+        static_cast<unsigned long>(position),
+        static_cast<unsigned long>(end - 1)));
+
+    String error_body;
+    auto response_file = fs::LambdaFile().set_write_callback(
+      [&](int location, const var::View view) -> int {
+        MCU_UNUSED_ARGUMENT(location);
+        if (
+          download.storage->get_status(connection)
+          != Http::Status::partial_content) {
+          // an error (or a whole object) body is not part of the range
+          error_body.append(
+            var::StringView(view.to_const_char(), view.size()));
+          return int(view.size());
+        }
+        const size_t size
+          = position + view.size() > end ? end - position : view.size();
+        crc32c.update(var::View(view.to_const_u8(), size));
+        thread::Mutex::Scope mutex_scope(download.mutex);
+        seek_to(*download.destination, position)
+          .write(var::View(view.to_const_u8(), size));
+        position += size;
+        download.received += size;
+        if (download.progress_callback) {
+          download.progress_callback->update(
+            int(download.received),
+            int(download.size));
+        }
+        return int(view.size());
+      });
+
+    const auto status = download.storage->execute_request(
+      connection,
+      Http::Method::get,
+      download.url,
+      HttpClient::ExecuteMethod().set_response(&response_file));
+
+    const bool is_partial = status == Http::Status::partial_content;
+    if (!download.storage->is_error()) {
+      if (is_partial && position > start) {
+        // a short response is continued from position
+        retry_count = 0;
+        continue;
+      }
+
+      // an empty 206 is retried rather than repeated forever
+      if (!is_partial && !is_retryable(status)) {
+        if (status == Http::Status::ok) {
+          API_RETURN_VALUE_ASSIGN_ERROR(false, "range was ignored", EBADMSG);
+        }
+        download.storage->assign_error_from_status(
+          status,
+          error_body.string_view());
+        return false;
+      }
+    }
+
+    if (retry_count == download.retry_count) {
+      if (download.storage->is_error()) {
+        return false;
+      }
+      if (is_partial) {
+        API_RETURN_VALUE_ASSIGN_ERROR(false, "range response is empty", EIO);
+      }
+      download.storage->assign_error_from_status(
+        status,
+        error_body.string_view());
+      return false;
+    }
+
+    retry_count++;
+    API_RESET_ERROR();
+  }
+
+  thread::Mutex::Scope mutex_scope(download.mutex);
+  download.range_crc32c.at(offset / download.range_size) = crc32c.value();
+  return true;
+}
+
+void *download_ranges(void *args) {
+  auto *download = reinterpret_cast<RangeDownload *>(args);
+  while (true) {
+    size_t offset = 0;
+    {
+      thread::Mutex::Scope mutex_scope(download->mutex);
+      if (download->error_number || download->next_offset >= download->size) {
+        return nullptr;
+      }
+      offset = download->next_offset;
+      download->next_offset += download->range_size;
+    }
+
+    const size_t end = offset + download->range_size < download->size
+                         ? offset + download->range_size
+                         : download->size;
+    if (!download_range(*download, offset, end)) {
+      // errors belong to this thread, pass the first one to the caller
+      thread::Mutex::Scope mutex_scope(download->mutex);
+      if (download->error_number == 0) {
+        download->error_message = api::ExecutionContext::error().message();
+        download->error_number = api::ExecutionContext::error().error_number();
+      }
+      API_RESET_ERROR();
+      return nullptr;
+    }
+  }
+}
+
+} // namespace
+
+thread_local bool Storage::m_is_async_transfer = false;
+
+Storage::UploadSession::UploadSession(const json::JsonObject &object) {
+  set_url(String(object.at("url").to_string_view()))
+    .set_destination(PathString(object.at("destination").to_string_view()))
+    .set_size(to_size(object.at("size")))
+    .set_offset(to_size(object.at("offset")))
+    .set_complete(object.at("isComplete").to_bool())
+    .set_crc32c(u32(object.at("crc32c").to_integer()))
+    .set_crc32c_size(to_size(object.at("crc32cSize")));
+}
+
+json::JsonObject Storage::UploadSession::to_object() const {
+  return JsonObject()
+    .insert("url", JsonString(url().cstring()))
+    .insert("destination", JsonString(destination().cstring()))
+    .insert("size", JsonString(from_size(size()).cstring()))
+    .insert("offset", JsonString(from_size(offset()).cstring()))
+    .insert(
+      "isComplete",
+      is_complete() ? JsonValue(JsonTrue()) : JsonValue(JsonFalse()))
+    .insert("crc32c", JsonInteger(crc32c()))
+    .insert("crc32cSize", JsonString(from_size(crc32c_size()).cstring()));
+}
+
 Storage::Storage(const Cloud &cloud, const var::StringView database_project)
-  : Cloud::SecureClient(cloud, database_project) {}
+  : Cloud::SecureClient(cloud, database_project, storage_host()) {}
 
 json::JsonObject Storage::get_details(var::StringView path) {
-  const auto url = get_storage_path(path);
-
-  if (!http_client().is_connected()) {
-    thread::Mutex::Scope m_scope(mutex());
-    http_client().connect(storage_host());
+  if (metadata_cache()) {
+    const auto details = metadata_cache()->get(path);
+    if (details.count()) {
+      return details;
+    }
   }
 
-  return execute_get_json(url).to_object();
+  const auto url = get_storage_path(path);
+  JsonObject result = execute_get_json(url).to_object();
+  if (metadata_cache() && is_success()) {
+    metadata_cache()->insert(path, result);
+  }
+  return result;
 }
 
 Storage &
 Storage::get_object(var::StringView path, const fs::FileObject &destination) {
-
-  JsonObject details = get_details(path);
   API_RETURN_VALUE_IF_ERROR(*this);
 
-  const StringView url = details.at("mediaLink").to_string_view();
+  set_progress_key("downloading");
 
-  const StringView minimum = "https://..";
-  if (url.length() < minimum.length()) {
-    API_RETURN_VALUE_ASSIGN_ERROR(*this, "mediaLink for object is invalid", EBADMSG);
-  }
+  if (download_range_size()) {
+    // the size is needed to split the object into ranges
+    JsonObject details = get_details(path);
+    API_RETURN_VALUE_IF_ERROR(*this);
 
-  size_t start_pos = url.find("/", minimum.length());
+    // size is a decimal string that can be larger than 32 bits
+    const size_t size
+      = ::strtoull(details.at("size").to_cstring(), nullptr, 10);
+    if (size > download_range_size()) {
+      // every range must come from the same generation of the object
+      get_object_ranges(
+        get_media_path(path, details.at("generation").to_string_view()),
+        size,
+        destination,
+        details.at("crc32c").to_string_view());
+      if (is_error() && metadata_cache()) {
+        // the cached generation may have been replaced
+        metadata_cache()->remove(path);
+      }
+      set_progress_key("progress");
+      return *this;
+    }
+  }
 
-  const StringView path_value = url.get_substring_at_position(start_pos);
-  // strip the https://wwww.host.com
+  Crc32c crc32c;
+  Md5 md5;
+  auto response_file = fs::LambdaFile().set_write_callback(
+    [&](int location, const var::View view) -> int {
+      MCU_UNUSED_ARGUMENT(location);
+      destination.write(view);
+      if (is_verify_crc32c()) {
+        crc32c.update(view);
+      }
+      if (is_verify_md5()) {
+        md5.update(view);
+      }
+      return is_error() ? -1 : int(view.size());
+    });
 
-  // request the media link file
-  printer().set_progress_key("downloading");
+  // alt=media returns the data without a separate metadata request
+  auto connection = checkout();
+  execute(
+    connection,
+    Http::Method::get,
+    get_media_path(path),
+    HttpClient::ExecuteMethod()
+      .set_response(&response_file)
+      .set_progress_callback(get_progress_callback()));
 
-  {
-    thread::Mutex::Scope m_scope(mutex());
-    http_client().get(
-      path_value,
-      HttpClient::Get()
-        .set_response(&destination)
-        .set_progress_callback(printer().progress_callback()));
+  if (is_success()) {
+    // "crc32c=...,md5=...", composite objects have no md5
+    const auto hashes = get_header_field(connection, "x-goog-hash");
+    verify_checksums(
+      get_hash(hashes, "crc32c"),
+      get_hash(hashes, "md5"),
+      crc32c,
+      &md5);
   }
 
-  printer().set_progress_key("progress");
+  set_progress_key("progress");
 
   return *this;
 }
 
+var::String
+Storage::get_media_path(var::StringView path, var::StringView generation) {
+  String result = String(get_storage_path(path).string_view());
+  result.append("?alt=media");
+  if (!generation.is_empty()) {
+    result.append("&generation=").append(generation);
+  }
+  return result;
+}
+
+void Storage::get_object_ranges(
+  var::StringView url,
+  size_t size,
+  const fs::FileObject &destination,
+  var::StringView crc32c) {
+  RangeDownload download;
+  download.storage = this;
+  download.url = url;
+  download.destination = &destination;
+  download.progress_callback = get_progress_callback();
+  download.size = size;
+  download.range_size = download_range_size();
+  download.retry_count = download_retry_count();
+
+  const size_t range_count
+    = (size + download.range_size - 1) / download.range_size;
+  download.range_crc32c.resize(range_count);
+  const size_t thread_count = range_count < download_range_count()
+                                ? range_count
+                                : download_range_count();
+
+  var::Vector<std::unique_ptr<thread::Thread>> threads;
+  for (size_t i = 0; i < thread_count; i++) {
+    threads.push_back(std::make_unique<thread::Thread>(
+      thread::Thread::Attributes()
+        .set_detach_state(thread::Thread::DetachState::joinable)
+        .set_stack_size(download_stack_size()),
+      thread::Thread::Construct().set_argument(&download).set_function(
+        download_ranges)));
+  }
+
+  for (auto &thread : threads) {
+    if (thread->is_joinable()) {
+      thread->join();
+    }
+  }
+
+  if (download.error_number) {
+    API_RETURN_ASSIGN_ERROR(
+      download.error_message.cstring(),
+      download.error_number);
+  }
+
+  u32 value = 0;
+  for (size_t i = 0; i < range_count; i++) {
+    const size_t offset = i * download.range_size;
+    value = Crc32c::combine(
+      value,
+      download.range_crc32c.at(i),
+      offset + download.range_size < size ? download.range_size
+                                          : size - offset);
+  }
+  verify_checksums(crc32c, var::StringView(), Crc32c(value), nullptr);
+}
+
+void Storage::verify_checksums(
+  var::StringView expected_crc32c,
+  var::StringView expected_md5,
+  const Crc32c &crc32c,
+  const Md5 *md5) {
+  if (
+    is_verify_crc32c() && !expected_crc32c.is_empty()
+    && crc32c.to_base64().string_view() != expected_crc32c) {
+    API_RETURN_ASSIGN_ERROR("crc32c does not match the object", EIO);
+  }
+
+  if (
+    md5 && is_verify_md5() && !expected_md5.is_empty()
+    && md5->to_base64().string_view() != expected_md5) {
+    API_RETURN_ASSIGN_ERROR("md5Hash does not match the object", EIO);
+  }
+}
+
 Storage &Storage::create_object(
   var::StringView destination,
   const fs::FileObject &source,
@@ -64,36 +431,817 @@ Storage &Storage::create_object(
   const String url = "/upload/storage/v1/b/" + storage_bucket()
                      + "/o?uploadType=media&name=" + Url::encode(destination);
 
-  http_client().add_header_field("Content-Type", "application/octet-stream");
   fs::DataFile response_file(fs::OpenMode::append_write_only());
 
-  {
-    thread::Mutex::Scope mg(mutex());
+  PathString progress_key = "uploading";
+  if (!count_description.is_empty()) {
+    progress_key.append("|").append(count_description);
+  }
+  set_progress_key(progress_key.string_view());
+
+  if (metadata_cache()) {
+    metadata_cache()->remove(destination);
+  }
+
+  if (
+    composite_upload_part_count() > 1
+    && source.size() >= composite_upload_part_count()) {
+    create_composite_object(destination, source);
+    set_progress_key("progress");
+    return *this;
+  }
+
+  if (upload_chunk_size()) {
+    auto session = start_upload(destination, source.size());
+    resume_upload(session, source);
+    set_progress_key("progress");
+    return *this;
+  }
+
+  auto connection = checkout();
+  add_header_field(connection, "Content-Type", "application/octet-stream");
+
+  Crc32c crc32c;
+  Md5 md5;
+  auto request_file
+    = fs::LambdaFile().set_size(source.size()).set_read_callback(
+      [&](int location, var::View view) -> int {
+        MCU_UNUSED_ARGUMENT(location);
+        const int result = source.read(view).return_value();
+        if (result > 0) {
+          const auto data = var::View(view.to_const_u8(), size_t(result));
+          if (is_verify_crc32c()) {
+            crc32c.update(data);
+          }
+          if (is_verify_md5()) {
+            md5.update(data);
+          }
+        }
+        return result;
+      });
+
+  execute(
+    connection,
+    Http::Method::post,
+    url,
+    HttpClient::ExecuteMethod()
+      .set_request(&request_file)
+      .set_response(&response_file)
+      .set_progress_callback(get_progress_callback()));
+
+  if (is_success()) {
+    // the response is the metadata of the new object
+    const String response(response_file.data());
+    const auto details = JsonDocument().from_string(response).to_object();
+    verify_checksums(
+      details.at("crc32c").to_string_view(),
+      details.at("md5Hash").to_string_view(),
+      crc32c,
+      &md5);
+    if (metadata_cache() && is_success()) {
+      metadata_cache()->insert(destination, details);
+    }
+  }
+
+  set_progress_key("progress");
+
+  return *this;
+}
+
+// shared by the threads of a composite upload
+struct Storage::CompositeUpload {
+  const fs::FileObject *source;
+  const api::ProgressCallback *progress_callback;
+  var::StringList part_list;
+  size_t size;
+  size_t part_size;
+
+  thread::Mutex mutex;
+  thread::Mutex source_mutex;
+  Storage *storage;
+  size_t next_part = 0;
+  // the CRC32C of each part, valid if every part was sent from the start
+  var::Vector<u32> part_crc32c;
+  bool is_crc32c_known = true;
+  size_t sent = 0;
+  var::String error_message;
+  int error_number = 0;
+};
 
-    if (!http_client().is_connected()) {
-      http_client().connect(storage_host());
+void Storage::create_composite_object(
+  var::StringView destination,
+  const fs::FileObject &source) {
+  const u8 part_limit = composite_upload_part_count() < compose_source_limit
+                          ? composite_upload_part_count()
+                          : compose_source_limit;
+
+  CompositeUpload upload;
+  upload.storage = this;
+  upload.source = &source;
+  upload.progress_callback = get_progress_callback();
+  upload.size = source.size();
+  upload.part_size = (upload.size + part_limit - 1) / part_limit;
+
+  // parts of uploads that run at the same time must not collide
+  const auto token = String().format(
+    "%lx%p",
+    static_cast<unsigned long>(chrono::DateTime::get_system_time().ctime()),
+    static_cast<void *>(&upload));
+  const size_t part_count
+    = (upload.size + upload.part_size - 1) / upload.part_size;
+  for (size_t i = 0; i < part_count; i++) {
+    upload.part_list.push_back(
+      String(destination) + "." + token + ".part" + NumberString(i));
+  }
+
+  upload.part_crc32c.resize(part_count);
+
+  var::Vector<std::unique_ptr<thread::Thread>> threads;
+  for (size_t i = 0; i < part_count; i++) {
+    threads.push_back(std::make_unique<thread::Thread>(
+      thread::Thread::Attributes()
+        .set_detach_state(thread::Thread::DetachState::joinable)
+        .set_stack_size(download_stack_size()),
+      thread::Thread::Construct().set_argument(&upload).set_function(
+        upload_parts)));
+  }
+
+  for (auto &thread : threads) {
+    if (thread->is_joinable()) {
+      thread->join();
+    }
+  }
+
+  String error_message = upload.error_message;
+  int error_number = upload.error_number;
+  if (error_number == 0) {
+    const auto details = compose_object(destination, upload.part_list);
+    if (is_success() && upload.is_crc32c_known) {
+      // the checksum of the parts in order
+      u32 value = 0;
+      for (size_t i = 0; i < part_count; i++) {
+        const size_t offset = i * upload.part_size;
+        value = Crc32c::combine(
+          value,
+          upload.part_crc32c.at(i),
+          offset + upload.part_size < upload.size ? upload.part_size
+                                                  : upload.size - offset);
+      }
+      verify_checksums(
+        details.at("crc32c").to_string_view(),
+        var::StringView(),
+        Crc32c(value),
+        nullptr);
+    }
+    if (is_error()) {
+      error_message = error().message();
+      error_number = error().error_number();
+      API_RESET_ERROR();
+    }
+  }
+
+  // the parts are removed even if the upload failed
+  for (const auto &part : upload.part_list) {
+    delete_object(part);
+    API_RESET_ERROR();
+  }
+
+  if (error_number) {
+    API_RETURN_ASSIGN_ERROR(error_message.cstring(), error_number);
+  }
+}
+
+void *Storage::upload_parts(void *args) {
+  auto *upload = reinterpret_cast<CompositeUpload *>(args);
+  while (true) {
+    size_t index = 0;
+    {
+      thread::Mutex::Scope mutex_scope(upload->mutex);
+      if (
+        upload->error_number
+        || upload->next_part >= upload->part_list.count()) {
+        return nullptr;
+      }
+      index = upload->next_part++;
     }
 
-    PathString progress_key = "uploading";
-    if (!count_description.is_empty()) {
-      progress_key.append("|").append(count_description);
+    const size_t offset = index * upload->part_size;
+    const size_t size = offset + upload->part_size < upload->size
+                          ? upload->part_size
+                          : upload->size - offset;
+    auto session
+      = upload->storage->start_upload(upload->part_list.at(index), size);
+    upload->storage->upload_chunks(
+      session,
+      *upload->source,
+      offset,
+      &upload->source_mutex,
+      [&](size_t sent) {
+        thread::Mutex::Scope mutex_scope(upload->mutex);
+        upload->sent += sent;
+        if (upload->progress_callback) {
+          upload->progress_callback->update(
+            int(upload->sent),
+            int(upload->size));
+        }
+      });
+
+    if (upload->storage->is_success()) {
+      thread::Mutex::Scope mutex_scope(upload->mutex);
+      if (session.crc32c_size() == size) {
+        upload->part_crc32c.at(index) = session.crc32c();
+      } else {
+        upload->is_crc32c_known = false;
+      }
+    }
+
+    if (upload->storage->is_error()) {
+      // errors belong to this thread, pass the first one to the caller
+      thread::Mutex::Scope mutex_scope(upload->mutex);
+      if (upload->error_number == 0) {
+        upload->error_message = api::ExecutionContext::error().message();
+        upload->error_number = api::ExecutionContext::error().error_number();
+      }
+      API_RESET_ERROR();
+      return nullptr;
     }
-    printer().set_progress_key(progress_key.string_view());
+  }
+}
+
+json::JsonObject Storage::compose_object(
+  var::StringView destination,
+  const var::StringList &source_list) {
+  JsonArray source_objects;
+  for (const auto &source : source_list) {
+    source_objects.append(
+      JsonObject().insert("name", JsonString(source.cstring())));
+  }
+
+  const auto request = JsonDocument()
+                         .set_flags(JsonDocument::Flags::compact)
+                         .to_string(
+                           JsonObject()
+                             .insert("sourceObjects", source_objects)
+                             .insert(
+                               "destination",
+                               JsonObject().insert(
+                                 "contentType",
+                                 JsonString("application/octet-stream"))));
+
+  auto connection = checkout();
+  add_header_field(connection, "Content-Type", "application/json");
+
+  fs::DataFile response_file(fs::OpenMode::append_write_only());
+  auto request_file = fs::ViewFile(View(request));
+  execute(
+    connection,
+    Http::Method::post,
+    get_storage_path(destination) / "compose",
+    HttpClient::ExecuteMethod()
+      .set_request(&request_file)
+      .set_response(&response_file));
+  API_RETURN_VALUE_IF_ERROR({});
 
-    http_client().post(
-      url,
-      HttpClient::Post()
-        .set_request(&source)
-        .set_response(&response_file)
-        .set_progress_callback(printer().progress_callback()));
+  // the details of the composed object
+  const String response(response_file.data());
+  return JsonDocument().from_string(response).to_object();
+}
+
+void Storage::delete_object(var::StringView path) {
+  if (metadata_cache()) {
+    metadata_cache()->remove(path);
   }
-  assign_error_from_status();
-  printer().set_progress_key("progress");
+
+  fs::DataFile response_file(fs::OpenMode::append_write_only());
+  execute(
+    Http::Method::delete_,
+    get_storage_path(path),
+    HttpClient::ExecuteMethod().set_response(&response_file));
+}
+
+Storage::UploadSession
+Storage::start_upload(var::StringView destination, size_t size) {
+  API_RETURN_VALUE_IF_ERROR({});
+
+  const String url = "/upload/storage/v1/b/" + storage_bucket()
+                     + "/o?uploadType=resumable&name="
+                     + Url::encode(destination);
+  const auto metadata = JsonDocument()
+                          .set_flags(JsonDocument::Flags::compact)
+                          .to_string(JsonObject().insert(
+                            "name",
+                            JsonString(String(destination).cstring())));
+
+  auto connection = checkout();
+  add_header_field(
+    connection,
+    "Content-Type",
+    "application/json; charset=UTF-8")
+    .add_header_field(
+      connection,
+      "X-Upload-Content-Type",
+      "application/octet-stream")
+    .add_header_field(
+      connection,
+      "X-Upload-Content-Length",
+      NumberString(size).string_view());
+
+  fs::DataFile response_file(fs::OpenMode::append_write_only());
+  auto request_file = fs::ViewFile(View(metadata));
+  execute(
+    connection,
+    Http::Method::post,
+    url,
+    HttpClient::ExecuteMethod()
+      .set_request(&request_file)
+      .set_response(&response_file));
+  API_RETURN_VALUE_IF_ERROR({});
+
+  // the session URI is the Location of the response
+  const auto location = get_header_field(connection, "Location");
+  if (get_url_path(location).is_empty()) {
+    API_RETURN_VALUE_ASSIGN_ERROR(
+      {},
+      "upload session location is missing",
+      EBADMSG);
+  }
+
+  return UploadSession()
+    .set_url(String(get_url_path(location)))
+    .set_destination(PathString(destination))
+    .set_size(size);
+}
+
+Storage &
+Storage::resume_upload(UploadSession &session, const fs::FileObject &source) {
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  if (!session.is_valid()) {
+    API_RETURN_VALUE_ASSIGN_ERROR(*this, "upload session is not valid", EINVAL);
+  }
+
+  const auto *progress_callback = get_progress_callback();
+  upload_chunks(session, source, 0, nullptr, [&](size_t sent) {
+    MCU_UNUSED_ARGUMENT(sent);
+    if (progress_callback) {
+      progress_callback->update(int(session.offset()), int(session.size()));
+    }
+  });
 
   return *this;
 }
 
+void Storage::upload_chunks(
+  UploadSession &session,
+  const fs::FileObject &source,
+  size_t source_offset,
+  thread::Mutex *source_lock,
+  const SentCallback &sent_callback) {
+  const size_t chunk_size
+    = upload_chunk_size() ? upload_chunk_size() : default_upload_chunk_size;
+
+  if (session.offset() && !session.is_complete()) {
+    // a saved session may be behind the server
+    query_upload(session);
+  }
+
+  u8 retry_count = 0;
+  while (!session.is_complete()) {
+    if (is_error()) {
+      // an expired session is not found and cannot be resumed
+      if (
+        retry_count == upload_retry_count()
+        || error().error_number() == ENOENT) {
+        return;
+      }
+      retry_count++;
+      API_RESET_ERROR();
+      query_upload(session);
+      continue;
+    }
+
+    const size_t offset = session.offset();
+    send_upload_chunk(session, source, chunk_size, source_offset, source_lock);
+    if (is_error()) {
+      continue;
+    }
+
+    if (session.offset() > offset) {
+      retry_count = 0;
+      sent_callback(session.offset() - offset);
+    } else if (!session.is_complete()) {
+      // nothing was committed, the attempt failed without an error
+      if (retry_count == upload_retry_count()) {
+        API_RETURN_ASSIGN_ERROR("upload chunk was not committed", EIO);
+      }
+      retry_count++;
+    }
+  }
+}
+
+void Storage::send_upload_chunk(
+  UploadSession &session,
+  const fs::FileObject &source,
+  size_t chunk_size,
+  size_t source_offset,
+  thread::Mutex *source_lock) {
+  API_RETURN_IF_ERROR();
+  const size_t offset = session.offset();
+  const size_t length = session.size() - offset < chunk_size
+                          ? session.size() - offset
+                          : chunk_size;
+
+  // the checksum is only known if every committed byte went through it
+  const bool is_crc32c_known
+    = is_verify_crc32c() && session.crc32c_size() == offset;
+  const bool is_last = offset + length == session.size();
+  Crc32c crc32c(session.crc32c());
+  size_t crc32c_position = 0;
+
+  // the chunk is read from source as it is sent rather than all at once,
+  // so a throttled source (see TransferManager) limits the send rate
+  auto request_file = fs::LambdaFile().set_size(length).set_read_callback(
+    [&](int location, var::View view) -> int {
+      // other parts may be reading the same source
+      thread::Mutex::Scope mutex_scope(source_lock);
+      const int result
+        = seek_to(source, source_offset + offset + size_t(location))
+            .read(view)
+            .return_value();
+      if (
+        is_crc32c_known && result > 0
+        && size_t(location) == crc32c_position) {
+        crc32c.update(View(view.to_const_u8(), size_t(result)));
+        crc32c_position += size_t(result);
+      }
+      return result;
+    });
+
+  // a chunk that does not end the upload must be a multiple of 256 KiB, so
+  // the last chunk always has the total
+  auto connection = checkout();
+  const String range
+    = length == 0
+        ? String().format(
+          "bytes */%lu",
+          static_cast<unsigned long>(session.size()))
+        : String().format(
+          "bytes %lu-%lu/%lu",
+          static_cast<unsigned long>(offset),
+          static_cast<unsigned long>(offset + length - 1),
+          static_cast<unsigned long>(session.size()));
+  add_header_field(connection, "Content-Range", range);
+
+  fs::DataFile response_file(fs::OpenMode::append_write_only());
+  const auto status = execute_request(
+    connection,
+    Http::Method::put,
+    session.url(),
+    HttpClient::ExecuteMethod()
+      .set_request(&request_file)
+      .set_response(&response_file));
+  update_upload_session(session, status, connection);
+
+  if (
+    is_last && is_crc32c_known && !is_error() && session.is_complete()
+    && crc32c_position == length) {
+    // the checksum is only known once the last chunk is read, so it is
+    // compared with the object rather than sent with the chunk
+    const auto details
+      = JsonDocument().from_string(String(response_file.data())).to_object();
+    if (details.at("crc32c").to_string_view()
+      != crc32c.to_base64().string_view()) {
+      API_RETURN_ASSIGN_ERROR(
+        "uploaded object does not match its crc32c",
+        EIO);
+    }
+    return;
+  }
+
+  if (!is_crc32c_known || is_error() || session.offset() <= offset) {
+    return;
+  }
+
+  const size_t committed = session.offset() - offset;
+  if (committed != crc32c_position) {
+    // the server committed part of the chunk, read that part again
+    crc32c = Crc32c(session.crc32c());
+    char buffer[256];
+    for (size_t position = 0; position < committed;) {
+      const size_t page = committed - position < sizeof(buffer)
+                            ? committed - position
+                            : sizeof(buffer);
+      thread::Mutex::Scope mutex_scope(source_lock);
+      const int result = seek_to(source, source_offset + offset + position)
+                           .read(View(buffer, page))
+                           .return_value();
+      if (result <= 0) {
+        // the checksum is unknown from here, the session stays behind
+        API_RESET_ERROR();
+        return;
+      }
+      crc32c.update(View(buffer, size_t(result)));
+      position += size_t(result);
+    }
+  }
+  session.set_crc32c(crc32c.value()).set_crc32c_size(session.offset());
+}
+
+void Storage::query_upload(UploadSession &session) {
+  auto connection = checkout();
+  add_header_field(
+    connection,
+    "Content-Range",
+    String().format(
+      "bytes */%lu",
+      static_cast<unsigned long>(session.size())));
+
+  fs::DataFile response_file(fs::OpenMode::append_write_only());
+  auto request_file = fs::ViewFile(View());
+  const auto status = execute_request(
+    connection,
+    Http::Method::put,
+    session.url(),
+    HttpClient::ExecuteMethod()
+      .set_request(&request_file)
+      .set_response(&response_file));
+  update_upload_session(session, status, connection);
+}
+
+void Storage::update_upload_session(
+  UploadSession &session,
+  inet::Http::Status status,
+  ConnectionPool::Lease &connection) {
+  API_RETURN_IF_ERROR();
+
+  if (status == Http::Status::ok || status == Http::Status::created) {
+    session.set_offset(session.size()).set_complete();
+    return;
+  }
+
+  if (status == Http::Status::permanent_redirect) {
+    // 308: "Range: bytes=0-42" is what the server has, no Range is nothing
+    const auto range = get_header_field(connection, "Range");
+    const size_t dash = range.string_view().find("-");
+    const var::String end(
+      dash == var::StringView::npos
+        ? var::StringView()
+        : range.string_view().get_substring_at_position(dash + 1));
+    session.set_offset(
+      end.is_empty() ? 0 : size_t(::strtoull(end.cstring(), nullptr, 10)) + 1);
+    return;
+  }
+
+  assign_error_from_status(status);
+}
+
+Storage &
+Storage::upload_file(var::StringView destination, var::StringView local_path) {
+  API_RETURN_VALUE_IF_ERROR(*this);
+  const MappedFile source(local_path);
+  if (!source.is_mapped()) {
+    return create_object(destination, fs::File(local_path));
+  }
+  return create_object(destination, source.file());
+}
+
+Storage &
+Storage::download_file(var::StringView path, var::StringView local_path) {
+  API_RETURN_VALUE_IF_ERROR(*this);
+  if (!MappedFile::is_supported()) {
+    return get_object(
+      path,
+      fs::File(fs::File::IsOverwrite::yes, local_path));
+  }
+
+  // the file is sized before it is mapped, the details are usually cached
+  const auto details = get_details(path);
+  API_RETURN_VALUE_IF_ERROR(*this);
+  const size_t size = ::strtoull(details.at("size").to_cstring(), nullptr, 10);
+
+  const MappedFile destination(local_path, size);
+  if (!destination.is_mapped()) {
+    return get_object(
+      path,
+      fs::File(fs::File::IsOverwrite::yes, local_path));
+  }
+  return get_object(path, destination.file());
+}
+
 Storage &Storage::remove_object(var::StringView path) {
-  MCU_UNUSED_ARGUMENT(path);
+  API_RETURN_VALUE_IF_ERROR(*this);
+  delete_object(path);
+  return *this;
+}
+
+var::Vector<inet::Http::Status>
+Storage::remove_objects(const var::StringList &path_list) {
+  var::Vector<Http::Status> result;
+  for (size_t offset = 0; offset < path_list.count(); offset += batch_limit) {
+    API_RETURN_VALUE_IF_ERROR(result);
+    const size_t count = path_list.count() - offset < batch_limit
+                           ? path_list.count() - offset
+                           : batch_limit;
+    remove_batch(path_list, offset, count, result);
+  }
+  return result;
+}
+
+void Storage::remove_batch(
+  const var::StringList &path_list,
+  size_t offset,
+  size_t count,
+  var::Vector<inet::Http::Status> &result) {
+  const StringView boundary = "cloud_api_batch";
+
+  // each part is an HTTP request, Content-ID matches it to its response
+  String request;
+  for (size_t i = 0; i < count; i++) {
+    const auto &path = path_list.at(offset + i);
+    if (metadata_cache()) {
+      metadata_cache()->remove(path);
+    }
+    request.append("--")
+      .append(boundary)
+      .append("\r\nContent-Type: application/http\r\nContent-ID: <")
+      .append(NumberString(i))
+      .append(">\r\n\r\nDELETE ")
+      .append(get_storage_path(path).string_view())
+      .append(" HTTP/1.1\r\n\r\n");
+  }
+  request.append("--").append(boundary).append("--\r\n");
+
+  auto connection = checkout();
+  add_header_field(
+    connection,
+    "Content-Type",
+    String("multipart/mixed; boundary=").append(boundary));
+
+  fs::DataFile response_file(fs::OpenMode::append_write_only());
+  auto request_file = fs::ViewFile(View(request));
+  execute(
+    connection,
+    Http::Method::post,
+    "/batch/storage/v1",
+    HttpClient::ExecuteMethod()
+      .set_request(&request_file)
+      .set_response(&response_file));
+  API_RETURN_IF_ERROR();
+
+  // multipart/mixed; boundary=batch_...
+  const auto content_type = get_header_field(connection, "Content-Type");
+  const StringView boundary_key = "boundary=";
+  const size_t boundary_position
+    = content_type.string_view().find(boundary_key);
+  if (boundary_position == StringView::npos) {
+    API_RETURN_ASSIGN_ERROR("batch response has no boundary", EBADMSG);
+  }
+  auto response_boundary
+    = content_type.string_view().get_substring_at_position(
+      boundary_position + boundary_key.length());
+  const size_t end = response_boundary.find(";");
+  if (end != StringView::npos) {
+    response_boundary = response_boundary.get_substring_with_length(end);
+  }
+  const String delimiter = String("--").append(response_boundary);
+
+  // "Content-ID: <response-N>" then "HTTP/1.1 204 No Content"
+  var::Vector<int> status_list(count);
+  const String response(response_file.data());
+  const StringView response_view = response.string_view();
+  const StringView content_id_key = "<response-";
+  const StringView status_key = "HTTP/1.1 ";
+  size_t position = response_view.find(delimiter);
+  while (position != StringView::npos) {
+    const size_t part_start = position + delimiter.length();
+    position = response_view.find(delimiter, part_start);
+    const StringView part
+      = position == StringView::npos
+          ? response_view.get_substring_at_position(part_start)
+          : response_view.get_substring_at_position(part_start)
+              .get_substring_with_length(position - part_start);
+
+    const size_t content_id = part.find(content_id_key);
+    const size_t status = part.find(status_key);
+    if (content_id == StringView::npos || status == StringView::npos) {
+      continue;
+    }
+
+    const auto id
+      = part.get_substring_at_position(content_id + content_id_key.length());
+    const size_t index
+      = size_t(id.get_substring_with_length(id.find(">")).to_integer());
+    if (index < count) {
+      status_list.at(index) = int(
+        part.get_substring_at_position(status + status_key.length())
+          .get_substring_with_length(3)
+          .to_integer());
+    }
+  }
+
+  for (const auto status : status_list) {
+    if (status == 0) {
+      API_RETURN_ASSIGN_ERROR("batch response is missing a result", EBADMSG);
+    }
+    result.push_back(Http::Status(status));
+  }
+}
+
+json::JsonObject Storage::list_objects(
+  var::StringView prefix,
+  var::StringView delimiter,
+  var::StringView page_token) {
+  // page tokens can be longer than a PathString
+  String url = String(get_storage_bucket_path().string_view());
+  url.append("?prefix=").append(Url::encode(prefix));
+  if (!delimiter.is_empty()) {
+    url.append("&delimiter=").append(Url::encode(delimiter));
+  }
+  if (!page_token.is_empty()) {
+    url.append("&pageToken=").append(Url::encode(page_token));
+  }
+  if (list_page_size()) {
+    url.append("&maxResults=").append(NumberString(list_page_size()));
+  }
+  return execute_get_json(url).to_object();
+}
+
+Storage &Storage::for_each_object(
+  var::StringView prefix,
+  var::StringView delimiter,
+  const ObjectCallback &callback) {
+  String page_token;
+  do {
+    API_RETURN_VALUE_IF_ERROR(*this);
+    const auto page = list_objects(prefix, delimiter, page_token);
+    API_RETURN_VALUE_IF_ERROR(*this);
+
+    const auto items = page.at("items").to_array();
+    for (u32 i = 0; i < items.count(); i++) {
+      if (!callback(items.at(i).to_object())) {
+        return *this;
+      }
+    }
+    page_token = String(page.at("nextPageToken").to_string_view());
+  } while (!page_token.is_empty());
+
+  return *this;
+}
+
+Storage &Storage::get_details_async(var::StringView path, JsonCallback callback) {
+  submit([this, path = String(path), callback = std::move(callback)]() {
+    const auto result = get_details(path);
+    if (callback) {
+      callback(result);
+    }
+  });
+  return *this;
+}
+
+Storage &Storage::get_object_async(
+  var::StringView path,
+  const fs::FileObject &destination,
+  Callback callback) {
+  submit([this,
+          path = String(path),
+          destination = &destination,
+          callback = std::move(callback)]() {
+    m_is_async_transfer = true;
+    get_object(path, *destination);
+    m_is_async_transfer = false;
+    if (callback) {
+      callback();
+    }
+  });
+  return *this;
+}
+
+Storage &Storage::create_object_async(
+  var::StringView destination,
+  const fs::FileObject &source,
+  var::StringView count_description,
+  Callback callback) {
+  submit([this,
+          destination = String(destination),
+          source = &source,
+          count_description = String(count_description),
+          callback = std::move(callback)]() {
+    m_is_async_transfer = true;
+    create_object(destination, *source, count_description);
+    m_is_async_transfer = false;
+    if (callback) {
+      callback();
+    }
+  });
+  return *this;
+}
+
+Storage &Storage::remove_object_async(var::StringView path, Callback callback) {
+  submit([this, path = String(path), callback = std::move(callback)]() {
+    remove_object(path);
+    if (callback) {
+      callback();
+    }
+  });
   return *this;
 }
@@ -0,0 +1,278 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <cstdlib>
+#include <memory>
+
+#include <fs.hpp>
+#include <json.hpp>
+#include <thread.hpp>
+#include <var.hpp>
+
+#include "cloud/MappedFile.hpp"
+#include "cloud/StorageSync.hpp"
+
+using namespace cloud;
+
+namespace {
+
+// false if name could point outside of the local directory
+bool is_safe_name(var::StringView name) {
+  if (name.is_empty() || name.front() == '/') {
+    return false;
+  }
+  auto remaining = name;
+  while (true) {
+    const size_t slash = remaining.find("/");
+    const auto segment = slash == var::StringView::npos
+                           ? remaining
+                           : remaining.get_substring_with_length(slash);
+    if (segment.is_empty() || segment == "." || segment == "..") {
+      return false;
+    }
+    if (slash == var::StringView::npos) {
+      return true;
+    }
+    remaining.pop_front(slash + 1);
+  }
+}
+
+} // namespace
+
+StorageSync &StorageSync::sync(const Options &options) {
+  m_transferred_count = 0;
+  m_skipped_count = 0;
+  m_rejected_count = 0;
+  m_transferred_size = 0;
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  const auto local_path = options.local_path().string_view();
+  var::String prefix(options.remote_path().string_view());
+  if (!prefix.is_empty()) {
+    prefix.append("/");
+  }
+
+  // the details of each object by name relative to the prefix
+  json::JsonObject remote;
+  m_storage->for_each_object(
+    prefix,
+    var::StringView(),
+    [&](const json::JsonObject &details) {
+      const auto name = details.at("name").to_string_view();
+      // "dir/" objects are folder placeholders
+      if (
+        name.length() > prefix.length()
+        && name.get_substring_at_position(name.length() - 1) != "/") {
+        remote.insert(
+          name.get_substring_at_position(prefix.length()),
+          details);
+      }
+      return true;
+    });
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  Context context;
+  context.self = this;
+  context.direction = options.direction();
+
+  if (options.direction() == Direction::upload) {
+    const auto entry_list = fs::FileSystem().read_directory(
+      local_path,
+      fs::FileSystem::IsRecursive::yes);
+    API_RETURN_VALUE_IF_ERROR(*this);
+
+    for (const auto &entry : entry_list) {
+      const var::PathString file_path = var::PathString(local_path) / entry;
+      const auto info = fs::FileSystem().get_info(file_path);
+      API_RETURN_VALUE_IF_ERROR(*this);
+      if (info.is_directory()) {
+        continue;
+      }
+
+      if (!is_different(
+            file_path,
+            info.size(),
+            remote.at(entry.string_view()).to_object())) {
+        m_skipped_count++;
+        continue;
+      }
+
+      context.transfers.push_back(
+        {file_path, prefix + var::String(entry.string_view()), info.size()});
+    }
+  } else {
+    for (const auto &key : remote.get_key_list()) {
+      if (!is_safe_name(key)) {
+        // object names are not checked by the server, "a/../../b" is valid
+        m_rejected_count++;
+        continue;
+      }
+
+      const auto details = remote.at(key).to_object();
+      const var::PathString file_path = var::PathString(local_path) / key;
+      const size_t size
+        = ::strtoull(details.at("size").to_cstring(), nullptr, 10);
+
+      if (
+        fs::FileSystem().exists(file_path)
+        && !is_different(
+          file_path,
+          fs::FileSystem().get_info(file_path).size(),
+          details)) {
+        m_skipped_count++;
+        continue;
+      }
+      API_RETURN_VALUE_IF_ERROR(*this);
+
+      context.transfers.push_back(
+        {file_path, prefix + var::String(key), size});
+    }
+
+    // directories are created before the threads start
+    create_directories(context.transfers);
+    API_RETURN_VALUE_IF_ERROR(*this);
+  }
+
+  for (const auto &transfer : context.transfers) {
+    context.total_size += transfer.size;
+  }
+
+  // the transfers share the printer, so the sync reports one total
+  const bool is_report_progress = m_storage->is_report_progress();
+  m_storage->set_report_progress(false);
+
+  const size_t thread_count
+    = context.transfers.count() < options.transfer_count()
+        ? context.transfers.count()
+        : options.transfer_count();
+
+  var::Vector<std::unique_ptr<thread::Thread>> threads;
+  for (size_t i = 0; i < thread_count; i++) {
+    threads.push_back(std::make_unique<thread::Thread>(
+      thread::Thread::Attributes()
+        .set_detach_state(thread::Thread::DetachState::joinable)
+        .set_stack_size(options.stack_size()),
+      thread::Thread::Construct().set_argument(&context).set_function(
+        run_transfers)));
+  }
+
+  for (auto &thread : threads) {
+    if (thread->is_joinable()) {
+      thread->join();
+    }
+  }
+  m_storage->set_report_progress(is_report_progress);
+
+  if (context.error_number) {
+    API_RETURN_VALUE_ASSIGN_ERROR(
+      *this,
+      context.error_message.cstring(),
+      context.error_number);
+  }
+
+  return *this;
+}
+
+var::String StorageSync::get_file_crc32c(var::StringView path) {
+  {
+    const MappedFile file(path);
+    if (file.is_mapped()) {
+      return Crc32c(Crc32c::calculate(file.view())).to_base64();
+    }
+  }
+
+  fs::File file(path);
+  API_RETURN_VALUE_IF_ERROR(var::String());
+
+  Crc32c crc32c;
+  var::Data buffer(64 * 1024);
+  while (true) {
+    const int result = file.read(buffer).return_value();
+    if (result <= 0) {
+      break;
+    }
+    crc32c.update(var::View(var::View(buffer).to_const_u8(), size_t(result)));
+  }
+  API_RETURN_VALUE_IF_ERROR(var::String());
+  return crc32c.to_base64();
+}
+
+bool StorageSync::is_different(
+  var::StringView local_path,
+  size_t local_size,
+  const json::JsonObject &details) const {
+  if (details.count() == 0) {
+    return true;
+  }
+
+  // the size is checked first so most changes do not read the file
+  const size_t size = ::strtoull(details.at("size").to_cstring(), nullptr, 10);
+  const auto crc32c = details.at("crc32c").to_string_view();
+  if (size != local_size || crc32c.is_empty()) {
+    return true;
+  }
+
+  return get_file_crc32c(local_path).string_view() != crc32c;
+}
+
+void StorageSync::create_directories(const var::Vector<Transfer> &transfers) {
+  for (const auto &transfer : transfers) {
+    const auto directory = fs::Path::parent_directory(transfer.local_path);
+    if (!directory.is_empty() && !fs::FileSystem().exists(directory)) {
+      fs::FileSystem().create_directory(
+        directory,
+        fs::FileSystem::IsRecursive::yes);
+      API_RETURN_IF_ERROR();
+    }
+  }
+}
+
+void *StorageSync::run_transfers(void *args) {
+  auto *context = reinterpret_cast<Context *>(args);
+  auto *self = context->self;
+  while (true) {
+    size_t index = 0;
+    {
+      thread::Mutex::Scope mutex_scope(context->mutex);
+      if (
+        context->error_number
+        || context->next_transfer >= context->transfers.count()) {
+        return nullptr;
+      }
+      index = context->next_transfer++;
+    }
+
+    const auto &transfer = context->transfers.at(index);
+    if (context->direction == Direction::upload) {
+      self->m_storage->upload_file(transfer.remote_path, transfer.local_path);
+    } else {
+      // the listing has the size, so download_file() is not needed
+      const MappedFile destination(transfer.local_path, transfer.size);
+      if (destination.is_mapped()) {
+        self->m_storage->get_object(transfer.remote_path, destination.file());
+      } else {
+        self->m_storage->get_object(
+          transfer.remote_path,
+          fs::File(fs::File::IsOverwrite::yes, transfer.local_path));
+      }
+    }
+
+    thread::Mutex::Scope mutex_scope(context->mutex);
+    if (self->is_error()) {
+      // errors belong to this thread, pass the first one to the caller
+      if (context->error_number == 0) {
+        context->error_message = api::ExecutionContext::error().message();
+        context->error_number = api::ExecutionContext::error().error_number();
+      }
+      API_RESET_ERROR();
+      return nullptr;
+    }
+    self->m_transferred_count++;
+    self->m_transferred_size += transfer.size;
+    const auto *progress_callback = self->printer().progress_callback();
+    if (progress_callback) {
+      progress_callback->update(
+        int(self->m_transferred_size),
+        int(context->total_size));
+    }
+  }
+}
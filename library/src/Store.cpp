@@ -1,3 +1,8 @@
+#include <cmath>
+#include <cstdlib>
+#include <random>
+
+#include <chrono.hpp>
 #include <inet.hpp>
 #include <json.hpp>
 #include <var.hpp>
@@ -6,25 +11,81 @@
 
 using namespace cloud;
 
+namespace {
+
+// collects the value of result.aggregateFields.<alias> without building a
+// tree, so large integers and doubles keep their full precision
+class AggregateHandler : public JsonHandler {
+public:
+  int begin_object() override { return 0; }
+  int end_object() override {
+    m_is_alias = false;
+    return 0;
+  }
+  int begin_array() override { return 0; }
+  int end_array() override { return 0; }
+
+  int key(var::StringView key) override {
+    if (m_is_aggregate_fields && !m_is_alias) {
+      // aggregateFields has one member: the alias
+      m_is_alias = true;
+    } else if (m_is_alias) {
+      m_type = var::String(key);
+    }
+    m_is_aggregate_fields = key == "aggregateFields";
+    return 0;
+  }
+
+  int string(var::StringView value) override { return set_value(value); }
+  int number(var::StringView value) override { return set_value(value); }
+  int boolean(bool) override { return 0; }
+  int null() override { return 0; }
+
+  var::StringView value() const { return m_value.string_view(); }
+  var::StringView type() const { return m_type.string_view(); }
+
+private:
+  bool m_is_aggregate_fields = false;
+  bool m_is_alias = false;
+  var::String m_type;
+  var::String m_value;
+
+  int set_value(var::StringView value) {
+    if (m_is_alias) {
+      m_value = var::String(value);
+    }
+    return 0;
+  }
+};
+
+} // namespace
+
 Store::Store(const Cloud &cloud, const var::StringView database_project)
-  : Cloud::SecureClient(cloud, database_project) {}
+  : Cloud::SecureClient(cloud, database_project, m_document_host) {}
 
 var::KeyString Store::create_document(
   const var::StringView path,
   const json::JsonObject &object,
   const var::StringView id) {
+  return create_encoded_document(path, CloudMapEncoder::encode(object), id);
+}
+
+var::KeyString Store::create_encoded_document(
+  var::StringView path,
+  var::StringView request,
+  var::StringView id) {
   const String path_arguments
     = path + (!id.is_empty() ? String("?documentId=") + id : String());
 
   const auto url = get_document_url_path(path_arguments);
-  refresh_http_client_document_headers();
 
-  const String response = execute_method(
-    Http::Method::post,
-    url,
-    JsonDocument()
-      .set_flags(JsonDocument::Flags::compact)
-      .to_string(CloudMap::from_json(object)));
+  if (request.is_empty()) {
+    API_RETURN_VALUE_ASSIGN_ERROR({}, "failed to encode document", EINVAL);
+  }
+
+  const String response = execute_method(Http::Method::post, url, request);
+  // an error response has no name
+  API_RETURN_VALUE_IF_ERROR({});
 
   return KeyString(fs::Path::name(
     JsonDocument().from_string(response).to_object().at("name").to_cstring()));
@@ -34,8 +95,31 @@ Store &Store::patch_document(
   var::StringView path,
   const json::JsonObject &object,
   IsExisting is_existing) {
+  return patch_document_with_mask(
+    path,
+    object,
+    is_existing,
+    create_mask_fields());
+}
+
+Store &Store::patch_document_with_mask(
+  var::StringView path,
+  const json::JsonObject &object,
+  IsExisting is_existing,
+  var::StringView mask_field_arguments) {
+  return patch_encoded_document(
+    path,
+    CloudMapEncoder::encode(object),
+    is_existing,
+    mask_field_arguments);
+}
+
+Store &Store::patch_encoded_document(
+  var::StringView path,
+  var::StringView request,
+  IsExisting is_existing,
+  var::StringView mask_field_arguments) {
 
-  const String mask_field_arguments = create_mask_fields();
   const String path_arguments
     = path + "?currentDocument.exists="
       + (is_existing == IsExisting::yes ? "true" : "false")
@@ -43,16 +127,13 @@ Store &Store::patch_document(
 
   String result;
   int count = 0;
-  CloudMap cloud_map = CloudMap::from_json(object);
+  if (request.is_empty()) {
+    API_RETURN_VALUE_ASSIGN_ERROR(*this, "failed to encode document", EINVAL);
+  }
 
   do {
 
     const var::String url = "/" + document_api_path() + "/" + path_arguments;
-    refresh_http_client_document_headers();
-
-    const String request = JsonDocument()
-                             .set_flags(JsonDocument::Flags::compact)
-                             .to_string(cloud_map);
 
     result = execute_method(Http::Method::patch, url, request);
 
@@ -63,27 +144,301 @@ Store &Store::patch_document(
 }
 
 json::JsonObject Store::get_document(var::StringView path) {
+  JsonTreeBuilder builder;
+  get_document(path, builder);
+  return builder.value().is_object() ? builder.value().to_object()
+                                     : JsonObject();
+}
+
+Store &Store::get_document(var::StringView path, JsonHandler &handler) {
   const auto url = get_document_url_path(path);
-  refresh_http_client_document_headers();
-  return CloudMap(execute_get_json(url).to_object()).to_json();
+  CloudMapDecoder decoder(handler);
+  execute_method(Http::Method::get, url, StringView(), decoder);
+  return *this;
+}
+
+Store &Store::get_documents(
+  const var::StringList &paths,
+  const DocumentResultCallback &callback,
+  const var::StringList &mask) {
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  const auto url = "/" & document_api_path() & ":batchGet";
+
+  JsonArray field_paths;
+  for (const auto &field : mask) {
+    field_paths.append(JsonString(field.cstring()));
+  }
+
+  // each element of the response array is {"found": {...}} or {"missing": ""}
+  bool is_stopped = false;
+  JsonTreeBuilder builder;
+  builder.set_element_callback(1, [&](const JsonValue &element) -> int {
+    const JsonObject result = element.to_object();
+    const JsonValue found = result.at("found");
+    const JsonValue missing = result.at("missing");
+    int callback_result = 0;
+    if (found.is_object()) {
+      const auto document = found.to_object();
+      callback_result = callback(
+        get_document_path(document.at("name").to_cstring()),
+        CloudMap(document).to_json());
+    } else if (missing.is_string()) {
+      callback_result
+        = callback(get_document_path(missing.to_cstring()), JsonNull());
+    } else {
+      API_RETURN_VALUE_ASSIGN_ERROR(-1, "unexpected batchGet result", EBADMSG);
+    }
+    is_stopped = callback_result < 0;
+    return callback_result;
+  });
+
+  const u32 count = paths.count();
+  for (u32 offset = 0; offset < count; offset += batch_get_limit()) {
+    JsonArray documents;
+    for (u32 i = offset; i < count && i < offset + batch_get_limit(); i++) {
+      documents.append(
+        JsonString(get_document_name(paths.at(i)).cstring()));
+    }
+
+    JsonObject request = JsonObject().insert("documents", documents);
+    if (field_paths.count()) {
+      request.insert("mask", JsonObject().insert("fieldPaths", field_paths));
+    }
+
+    execute_method(
+      Http::Method::post,
+      url.string_view(),
+      JsonDocument().set_flags(JsonDocument::Flags::compact).to_string(request),
+      builder);
+    if (is_stopped) {
+      // stopping early is not an error
+      API_RESET_ERROR();
+      return *this;
+    }
+    API_RETURN_VALUE_IF_ERROR(*this);
+  }
+
+  return *this;
+}
+
+json::JsonObject Store::get_documents(
+  const var::StringList &paths,
+  const var::StringList &mask) {
+  JsonObject result;
+  get_documents(
+    paths,
+    [&](var::StringView path, const JsonValue &document) -> int {
+      result.insert(path, document);
+      return 0;
+    },
+    mask);
+  return result;
+}
+
+Store &Store::run_query(
+  const Query &query,
+  const DocumentResultCallback &callback) {
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  const auto url = get_query_url_path(query, ":runQuery");
+  const auto request = JsonDocument()
+                         .set_flags(JsonDocument::Flags::compact)
+                         .to_string(JsonObject().insert(
+                           "structuredQuery",
+                           query.to_object()));
+
+  // elements without a document only report progress (readTime)
+  bool is_stopped = false;
+  JsonTreeBuilder builder;
+  builder.set_element_callback(1, [&](const JsonValue &element) -> int {
+    if (!element.is_object()) {
+      API_RETURN_VALUE_ASSIGN_ERROR(-1, "unexpected runQuery result", EBADMSG);
+    }
+    const JsonValue document = element.to_object().at("document");
+    if (!document.is_object()) {
+      return 0;
+    }
+    const int callback_result = callback(
+      get_document_path(document.to_object().at("name").to_cstring()),
+      CloudMap(document.to_object()).to_json());
+    is_stopped = callback_result < 0;
+    return callback_result;
+  });
+
+  execute_method(Http::Method::post, url.string_view(), request, builder);
+  if (is_stopped) {
+    API_RESET_ERROR();
+  }
+  return *this;
+}
+
+json::JsonArray Store::run_query(const Query &query) {
+  JsonArray result;
+  run_query(query, [&](var::StringView, const JsonValue &document) -> int {
+    result.append(document);
+    return 0;
+  });
+  return result;
+}
+
+u64 Store::count(const Query &query, u64 up_to) {
+  JsonObject count;
+  if (up_to) {
+    // int64 values are sent as strings
+    const auto up_to_string
+      = String().format("%llu", static_cast<unsigned long long>(up_to));
+    count.insert("upTo", JsonString(up_to_string.cstring()));
+  }
+  const auto result = run_aggregation_query(
+    query,
+    JsonObject().insert("alias", JsonString("count")).insert("count", count));
+  return ::strtoull(result.cstring(), nullptr, 10);
+}
+
+double Store::sum(const Query &query, var::StringView field) {
+  const auto result = run_aggregation_query(
+    query,
+    JsonObject()
+      .insert("alias", JsonString("sum"))
+      .insert(
+        "sum",
+        JsonObject().insert(
+          "field",
+          JsonObject().insert(
+            "fieldPath",
+            JsonString(String(field).cstring())))));
+  return ::strtod(result.cstring(), nullptr);
+}
+
+double Store::avg(const Query &query, var::StringView field) {
+  const auto result = run_aggregation_query(
+    query,
+    JsonObject()
+      .insert("alias", JsonString("avg"))
+      .insert(
+        "avg",
+        JsonObject().insert(
+          "field",
+          JsonObject().insert(
+            "fieldPath",
+            JsonString(String(field).cstring())))));
+  return result.is_empty() ? NAN : ::strtod(result.cstring(), nullptr);
+}
+
+var::String Store::run_aggregation_query(
+  const Query &query,
+  const json::JsonObject &aggregation) {
+  API_RETURN_VALUE_IF_ERROR(String());
+
+  const auto url = get_query_url_path(query, ":runAggregationQuery");
+  const auto request
+    = JsonDocument()
+        .set_flags(JsonDocument::Flags::compact)
+        .to_string(JsonObject().insert(
+          "structuredAggregationQuery",
+          JsonObject()
+            .insert("structuredQuery", query.to_object())
+            .insert("aggregations", JsonArray().append(aggregation))));
+
+  AggregateHandler handler;
+  execute_method(Http::Method::post, url.string_view(), request, handler);
+  API_RETURN_VALUE_IF_ERROR(String());
+
+  // nullValue is returned for the average of no values
+  return handler.type() == "nullValue" ? String() : String(handler.value());
 }
 
 Store &Store::remove_document(var::StringView path) {
   const auto url = get_document_url_path(path);
-  refresh_http_client_document_headers();
   execute_method(Http::Method::delete_, url, StringView());
   return *this;
 }
 
 json::JsonObject
 Store::list_documents(var::StringView path, var::StringView mask_options) {
-  const auto url
-    = get_document_url_path(path)
-      & (!mask_options.is_empty() ? String() : String("?") + mask_options);
-  refresh_http_client_document_headers();
+  // page tokens can be longer than a PathString
+  const auto url = String(get_document_url_path(path).string_view())
+                   + (mask_options.is_empty() ? String()
+                                              : String("?") + mask_options);
   return execute_get_json(url).to_object();
 }
 
+Store &Store::create_document_async(
+  var::StringView path,
+  const json::JsonObject &object,
+  var::StringView id,
+  IdCallback callback) {
+  submit([this,
+          path = String(path),
+          object = JsonObject(object),
+          id = String(id),
+          callback = std::move(callback)]() {
+    const auto result = create_document(path, object, id);
+    if (callback) {
+      callback(result.string_view());
+    }
+  });
+  return *this;
+}
+
+Store &Store::patch_document_async(
+  var::StringView path,
+  const json::JsonObject &object,
+  IsExisting is_existing,
+  Callback callback) {
+  // the masks belong to the caller's thread, so they are consumed now
+  submit([this,
+          path = String(path),
+          object = JsonObject(object),
+          is_existing,
+          mask_field_arguments = create_mask_fields(),
+          callback = std::move(callback)]() {
+    patch_document_with_mask(path, object, is_existing, mask_field_arguments);
+    if (callback) {
+      callback();
+    }
+  });
+  return *this;
+}
+
+Store &
+Store::get_document_async(var::StringView path, DocumentCallback callback) {
+  submit([this, path = String(path), callback = std::move(callback)]() {
+    const auto result = get_document(path);
+    if (callback) {
+      callback(result);
+    }
+  });
+  return *this;
+}
+
+Store &Store::remove_document_async(var::StringView path, Callback callback) {
+  submit([this, path = String(path), callback = std::move(callback)]() {
+    remove_document(path);
+    if (callback) {
+      callback();
+    }
+  });
+  return *this;
+}
+
+Store &Store::list_documents_async(
+  var::StringView path,
+  var::StringView mask_options,
+  DocumentCallback callback) {
+  submit([this,
+          path = String(path),
+          mask_options = String(mask_options),
+          callback = std::move(callback)]() {
+    const auto result = list_documents(path, mask_options);
+    if (callback) {
+      callback(result);
+    }
+  });
+  return *this;
+}
+
 var::String Store::create_mask_fields() {
   String result;
   for (const auto &field : document_mask_fields()) {
@@ -104,3 +459,296 @@ var::String Store::create_mask_fields() {
   document_mask_fields().clear();
   return result;
 }
+
+var::StringView Store::get_document_path(var::StringView name) const {
+  const auto root = document_root();
+  if (name.find(root.string_view()) == 0) {
+    name.pop_front(root.length());
+  }
+  while (name.length() && name.front() == '/') {
+    name.pop_front();
+  }
+  return name;
+}
+
+var::KeyString Store::generate_document_id() {
+  // same alphabet and length as the ids created by the Firestore server
+  static constexpr auto alphabet
+    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+  thread_local std::mt19937 generator(
+    u32(ClockTime::get_system_time().nanoseconds())
+    ^ u32(reinterpret_cast<size_t>(&generator)));
+
+  KeyString result;
+  for (int i = 0; i < 20; i++) {
+    const char c = alphabet[generator() % 62];
+    result.append(StringView(&c, 1));
+  }
+  return result;
+}
+
+Store::FieldTransform::FieldTransform(
+  var::StringView field,
+  var::StringView kind,
+  const json::JsonValue &value) {
+  insert("fieldPath", JsonString(String(field).cstring()));
+  insert(kind, value);
+}
+
+Store::FieldTransform
+Store::FieldTransform::server_timestamp(var::StringView field) {
+  return FieldTransform(field, "setToServerValue", JsonString("REQUEST_TIME"));
+}
+
+Store::FieldTransform Store::FieldTransform::increment(
+  var::StringView field,
+  const json::JsonValue &value) {
+  return FieldTransform(field, "increment", CloudMap::from_json_value(value));
+}
+
+Store::FieldTransform Store::FieldTransform::maximum(
+  var::StringView field,
+  const json::JsonValue &value) {
+  return FieldTransform(field, "maximum", CloudMap::from_json_value(value));
+}
+
+Store::FieldTransform Store::FieldTransform::minimum(
+  var::StringView field,
+  const json::JsonValue &value) {
+  return FieldTransform(field, "minimum", CloudMap::from_json_value(value));
+}
+
+Store::FieldTransform Store::FieldTransform::append_missing_elements(
+  var::StringView field,
+  const json::JsonArray &values) {
+  return FieldTransform(
+    field,
+    "appendMissingElements",
+    CloudMap::from_json_value(values).at("arrayValue"));
+}
+
+Store::FieldTransform Store::FieldTransform::remove_all_from_array(
+  var::StringView field,
+  const json::JsonArray &values) {
+  return FieldTransform(
+    field,
+    "removeAllFromArray",
+    CloudMap::from_json_value(values).at("arrayValue"));
+}
+
+Store::WriteBatch &Store::WriteBatch::create(
+  var::StringView path,
+  const json::JsonObject &object,
+  var::StringView id) {
+  const auto document_id
+    = id.is_empty() ? generate_document_id() : KeyString(id);
+
+  JsonObject document = CloudMap::from_json(object);
+  document.insert(
+    "name",
+    JsonString(m_store->get_document_name(path / document_id).cstring()));
+
+  m_writes.append(
+    JsonObject()
+      .insert("update", document)
+      .insert("currentDocument", JsonObject().insert("exists", JsonFalse())));
+  return *this;
+}
+
+Store::WriteBatch &Store::WriteBatch::patch(
+  var::StringView path,
+  const json::JsonObject &object,
+  IsExisting is_existing,
+  const var::StringList &update_mask) {
+  JsonObject document = CloudMap::from_json(object);
+  document.insert(
+    "name",
+    JsonString(m_store->get_document_name(path).cstring()));
+
+  JsonObject write = JsonObject().insert("update", document);
+  if (is_existing == IsExisting::yes) {
+    write.insert("currentDocument", JsonObject().insert("exists", JsonTrue()));
+  }
+
+  if (!update_mask.is_empty()) {
+    JsonArray field_paths;
+    for (const auto &field : update_mask) {
+      field_paths.append(JsonString(field.cstring()));
+    }
+    write.insert("updateMask", JsonObject().insert("fieldPaths", field_paths));
+  }
+
+  m_writes.append(write);
+  return *this;
+}
+
+Store::WriteBatch &Store::WriteBatch::remove(var::StringView path) {
+  m_writes.append(JsonObject().insert(
+    "delete",
+    JsonString(m_store->get_document_name(path).cstring())));
+  return *this;
+}
+
+Store::WriteBatch &Store::WriteBatch::transform(
+  var::StringView path,
+  const FieldTransform &field_transform) {
+  m_writes.append(JsonObject().insert(
+    "transform",
+    JsonObject()
+      .insert(
+        "document",
+        JsonString(m_store->get_document_name(path).cstring()))
+      .insert("fieldTransforms", JsonArray().append(field_transform))));
+  return *this;
+}
+
+Store::WriteBatch &Store::WriteBatch::commit() {
+  API_RETURN_VALUE_IF_ERROR(*this);
+
+  const auto url = "/" & m_store->document_api_path() & ":commit";
+  while (m_writes.count()) {
+    JsonArray writes;
+    JsonArray remaining;
+    for (u32 i = 0; i < m_writes.count(); i++) {
+      if (i < max_write_count()) {
+        writes.append(m_writes.at(i));
+      } else {
+        remaining.append(m_writes.at(i));
+      }
+    }
+
+    const auto response = m_store->execute_method(
+      Http::Method::post,
+      url.string_view(),
+      JsonObject().insert("writes", writes));
+    API_RETURN_VALUE_IF_ERROR(*this);
+
+    // creates and transforms are not idempotent, a committed chunk is not
+    // sent again when commit() is retried after a later chunk fails
+    m_writes = remaining;
+
+    const auto results = response.to_object().at("writeResults").to_array();
+    for (u32 i = 0; i < results.count(); i++) {
+      m_write_results.append(results.at(i));
+    }
+  }
+
+  return *this;
+}
+
+Store::DocumentCursor::DocumentCursor(
+  Store &store,
+  var::StringView path,
+  u16 page_size,
+  const var::StringList &mask)
+  : m_store(&store), m_path(path), m_cond(m_mutex) {
+  m_options = String("pageSize=") + NumberString(page_size).string_view();
+  for (const auto &field : mask) {
+    m_options += String("&mask.fieldPaths=") + field;
+  }
+}
+
+Store::DocumentCursor::~DocumentCursor() {
+  // the prefetch task refers to this object
+  if (m_is_prefetching) {
+    wait_prefetch();
+  }
+}
+
+bool Store::DocumentCursor::next() {
+  API_RETURN_VALUE_IF_ERROR(false);
+
+  while (m_index == m_documents.count()) {
+    if (m_is_started && m_next_page_token.is_empty()) {
+      return false;
+    }
+
+    if (!load_page()) {
+      return false;
+    }
+  }
+
+  const auto document = m_documents.at(m_index++).to_object();
+  m_document_path
+    = String(m_store->get_document_path(document.at("name").to_cstring()));
+  m_document = CloudMap(document).to_json();
+  return true;
+}
+
+Store::DocumentCursor::Page
+Store::DocumentCursor::fetch_page(var::StringView page_token) {
+  Page result;
+  const String options
+    = page_token.is_empty()
+        ? m_options
+        : m_options + "&pageToken=" + inet::Url::encode(page_token);
+
+  result.response = m_store->list_documents(m_path, options);
+  if (is_error()) {
+    // this may run on a worker thread, so the error is carried in the page
+    result.error_message = error().message();
+    result.error_number = error().error_number();
+    API_RESET_ERROR();
+  }
+  return result;
+}
+
+void Store::DocumentCursor::start_prefetch() {
+  auto *pool = m_store->worker_pool();
+  if (pool == nullptr) {
+    return;
+  }
+
+  {
+    thread::Mutex::Scope m_scope(m_mutex);
+    m_is_prefetching = true;
+    m_is_prefetch_ready = false;
+  }
+
+  pool->submit([this, page_token = m_next_page_token]() {
+    Page page = fetch_page(page_token);
+    thread::Mutex::Scope m_scope(m_mutex);
+    m_prefetched = std::move(page);
+    m_is_prefetch_ready = true;
+    m_cond.signal();
+  });
+}
+
+Store::DocumentCursor::Page Store::DocumentCursor::wait_prefetch() {
+  thread::Mutex::Scope m_scope(m_mutex);
+  while (!m_is_prefetch_ready) {
+    m_cond.wait();
+  }
+  m_is_prefetching = false;
+  return std::move(m_prefetched);
+}
+
+bool Store::DocumentCursor::load_page() {
+  const Page page
+    = m_is_prefetching ? wait_prefetch() : fetch_page(m_next_page_token);
+  m_is_started = true;
+
+  if (page.error_number) {
+    API_RETURN_VALUE_ASSIGN_ERROR(
+      false,
+      page.error_message.cstring(),
+      page.error_number);
+  }
+
+  // an empty collection has no documents member
+  const auto documents = page.response.at("documents");
+  m_documents = documents.is_array() ? documents.to_array() : JsonArray();
+  m_index = 0;
+  m_page_count++;
+
+  const auto next_page_token = page.response.at("nextPageToken");
+  m_next_page_token = next_page_token.is_string()
+                        ? String(next_page_token.to_cstring())
+                        : String();
+
+  if (!m_next_page_token.is_empty()) {
+    // overlap the next request with reading this page
+    start_prefetch();
+  }
+  return true;
+}
@@ -0,0 +1,245 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <chrono.hpp>
+#include <fs.hpp>
+#include <thread.hpp>
+#include <var.hpp>
+
+#include "cloud/TransferManager.hpp"
+
+using namespace cloud;
+
+TransferManager::TokenBucket::TokenBucket(u32 rate)
+  : m_rate(rate), m_tokens(rate),
+    m_refill_time(std::chrono::steady_clock::now()) {}
+
+void TransferManager::TokenBucket::consume(size_t count) {
+  if (m_rate == 0) {
+    return;
+  }
+
+  size_t remaining = count;
+  while (remaining) {
+    u32 wait_microseconds = 0;
+    {
+      thread::Mutex::Scope mutex_scope(m_mutex);
+      const auto now = std::chrono::steady_clock::now();
+      const double elapsed
+        = std::chrono::duration<double>(now - m_refill_time).count();
+      m_refill_time = now;
+
+      // an idle bucket fills up to one second of bytes, not more
+      m_tokens += elapsed * m_rate;
+      if (m_tokens > m_rate) {
+        m_tokens = m_rate;
+      }
+
+      // larger requests are taken one bucket at a time
+      const size_t page = remaining < m_rate ? remaining : m_rate;
+      if (m_tokens >= double(page)) {
+        m_tokens -= double(page);
+        remaining -= page;
+        continue;
+      }
+      wait_microseconds = u32((double(page) - m_tokens) * 1000000.0 / m_rate);
+    }
+    chrono::wait(chrono::MicroTime(wait_microseconds));
+  }
+}
+
+TransferManager::TransferManager(Storage &storage, const Construct &options)
+  : m_storage(&storage), m_bucket(options.bandwidth_limit()),
+    m_task_cond(m_mutex), m_idle_cond(m_mutex),
+    m_is_report_progress(storage.is_report_progress()) {
+  // the manager reports the total of all transfers
+  storage.set_report_progress(false);
+
+  for (u8 i = 0; i < options.transfer_count(); i++) {
+    m_threads.push_back(std::make_unique<thread::Thread>(
+      thread::Thread::Attributes()
+        .set_detach_state(thread::Thread::DetachState::joinable)
+        .set_stack_size(options.stack_size()),
+      thread::Thread::Construct().set_argument(this).set_function(
+        work_function)));
+  }
+}
+
+TransferManager::~TransferManager() {
+  {
+    thread::Mutex::Scope mutex_scope(m_mutex);
+    m_is_stopping = true;
+    m_task_cond.broadcast();
+  }
+
+  // queued transfers are completed before the workers exit
+  for (auto &worker : m_threads) {
+    if (worker->is_joinable()) {
+      worker->join();
+    }
+  }
+
+  m_storage->set_report_progress(m_is_report_progress);
+}
+
+TransferManager &
+TransferManager::submit(const Transfer &transfer, Callback callback) {
+  const size_t size = transfer.direction() == Direction::upload
+                          && transfer.file()
+                        ? transfer.file()->size()
+                        : transfer.size();
+
+  if (m_threads.count() == 0) {
+    // no workers: transfer on the caller's thread
+    {
+      thread::Mutex::Scope mutex_scope(m_mutex);
+      m_total_size += size;
+    }
+    execute(transfer);
+    if (callback) {
+      callback();
+    }
+    return *this;
+  }
+
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  m_total_size += size;
+  m_queues[size_t(transfer.priority())].push(
+    Pending{transfer, std::move(callback)});
+  m_task_cond.signal();
+  return *this;
+}
+
+TransferManager &TransferManager::wait() {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  while (!is_queue_empty() || m_active_count > 0) {
+    m_idle_cond.wait();
+  }
+  return *this;
+}
+
+size_t TransferManager::pending_count() const {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  size_t result = m_active_count;
+  for (const auto &queue : m_queues) {
+    result += queue.count();
+  }
+  return result;
+}
+
+u32 TransferManager::error_count() const {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  return m_error_count;
+}
+
+void *TransferManager::work_function(void *args) {
+  reinterpret_cast<TransferManager *>(args)->work();
+  return nullptr;
+}
+
+void TransferManager::work() {
+  while (true) {
+    Pending pending;
+    {
+      thread::Mutex::Scope mutex_scope(m_mutex);
+      while (is_queue_empty() && !m_is_stopping) {
+        m_task_cond.wait();
+      }
+
+      if (is_queue_empty()) {
+        return;
+      }
+
+      // the highest priority first
+      for (size_t i = priority_count; i > 0; i--) {
+        auto &queue = m_queues[i - 1];
+        if (!queue.is_empty()) {
+          pending = std::move(queue.front());
+          queue.pop();
+          break;
+        }
+      }
+      m_active_count++;
+    }
+
+    execute(pending.transfer);
+    if (pending.callback) {
+      pending.callback();
+    }
+
+    {
+      thread::Mutex::Scope mutex_scope(m_mutex);
+      if (is_error()) {
+        m_error_count++;
+      }
+      m_active_count--;
+      if (is_queue_empty() && m_active_count == 0) {
+        // the next batch of transfers starts a new total
+        m_total_size = 0;
+        m_transferred_size = 0;
+        m_idle_cond.broadcast();
+      }
+    }
+    API_RESET_ERROR();
+  }
+}
+
+void TransferManager::execute(const Transfer &transfer) {
+  if (transfer.file() == nullptr) {
+    API_RETURN_ASSIGN_ERROR("transfer has no file", EINVAL);
+  }
+
+  const fs::FileObject &file = *transfer.file();
+  TokenBucket bucket(transfer.bandwidth_limit());
+  const auto throttle = [&](size_t count) {
+    bucket.consume(count);
+    m_bucket.consume(count);
+    update_progress(count);
+  };
+
+  // the wrappers keep the location so ranges and chunks work, Storage
+  // reads uploads (including each resumable chunk) as they are sent, so
+  // throttling the reads limits the send rate
+  if (transfer.direction() == Direction::upload) {
+    auto source = fs::LambdaFile().set_size(file.size()).set_read_callback(
+      [&](int location, var::View view) -> int {
+        const int result = file.seek(location).read(view).return_value();
+        if (result > 0) {
+          throttle(size_t(result));
+        }
+        return result;
+      });
+    m_storage->create_object(transfer.path(), source);
+    return;
+  }
+
+  auto destination = fs::LambdaFile().set_write_callback(
+    [&](int location, const var::View view) -> int {
+      throttle(view.size());
+      file.seek(location).write(view);
+      return is_error() ? -1 : int(view.size());
+    });
+  m_storage->get_object(transfer.path(), destination);
+}
+
+void TransferManager::update_progress(size_t count) {
+  thread::Mutex::Scope mutex_scope(m_mutex);
+  m_transferred_size += count;
+  if (m_transferred_size > m_total_size) {
+    // downloads without a size and retried bytes grow the total
+    m_total_size = m_transferred_size;
+  }
+
+  const auto *progress_callback = printer().progress_callback();
+  if (progress_callback) {
+    progress_callback->update(int(m_transferred_size), int(m_total_size));
+  }
+}
+
+bool TransferManager::is_queue_empty() const {
+  for (const auto &queue : m_queues) {
+    if (!queue.is_empty()) {
+      return false;
+    }
+  }
+  return true;
+}
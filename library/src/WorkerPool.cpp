@@ -0,0 +1,96 @@
+// Copyright 2016-2021 Tyler Gilbert and Stratify Labs, Inc; see LICENSE.md
+
+#include <thread.hpp>
+#include <var.hpp>
+
+#include "cloud/WorkerPool.hpp"
+
+using namespace cloud;
+
+WorkerPool::WorkerPool(const Construct &options)
+  : m_task_cond(m_mutex), m_idle_cond(m_mutex) {
+  for (u16 i = 0; i < options.thread_count(); i++) {
+    m_threads.push_back(std::make_unique<thread::Thread>(
+      thread::Thread::Attributes()
+        .set_detach_state(thread::Thread::DetachState::joinable)
+        .set_stack_size(options.stack_size()),
+      thread::Thread::Construct().set_argument(this).set_function(work_function)));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    thread::Mutex::Scope m_scope(m_mutex);
+    m_is_stopping = true;
+    m_task_cond.broadcast();
+  }
+
+  // queued tasks are completed before the workers exit
+  for (auto &worker : m_threads) {
+    if (worker->is_joinable()) {
+      worker->join();
+    }
+  }
+}
+
+WorkerPool &WorkerPool::submit(Task task) {
+  if (m_threads.count() == 0) {
+    // no workers: run the task on the caller's thread
+    task();
+    return *this;
+  }
+
+  thread::Mutex::Scope m_scope(m_mutex);
+  m_tasks.push(std::move(task));
+  m_task_cond.signal();
+  return *this;
+}
+
+WorkerPool &WorkerPool::wait() {
+  thread::Mutex::Scope m_scope(m_mutex);
+  while (!m_tasks.is_empty() || m_active_count > 0) {
+    m_idle_cond.wait();
+  }
+  return *this;
+}
+
+size_t WorkerPool::pending_count() const {
+  thread::Mutex::Scope m_scope(m_mutex);
+  return m_tasks.count() + m_active_count;
+}
+
+void *WorkerPool::work_function(void *args) {
+  reinterpret_cast<WorkerPool *>(args)->work();
+  return nullptr;
+}
+
+void WorkerPool::work() {
+  while (true) {
+    Task task;
+    {
+      thread::Mutex::Scope m_scope(m_mutex);
+      while (m_tasks.is_empty() && !m_is_stopping) {
+        m_task_cond.wait();
+      }
+
+      if (m_tasks.is_empty()) {
+        return;
+      }
+
+      task = std::move(m_tasks.front());
+      m_tasks.pop();
+      m_active_count++;
+    }
+
+    task();
+    API_RESET_ERROR();
+
+    {
+      thread::Mutex::Scope m_scope(m_mutex);
+      m_active_count--;
+      if (m_tasks.is_empty() && m_active_count == 0) {
+        m_idle_cond.broadcast();
+      }
+    }
+  }
+}
@@ -1,4 +1,6 @@
 ﻿
+#include <cmath>
+
 #include <test/Test.hpp>
 #include <crypto/Random.hpp>
 #include <fs/File.hpp>
@@ -19,6 +21,21 @@ using namespace thread;
 
 //"cloudapitest-2ec81"
 
+struct SchemaPoint {
+  double x = 0.0;
+  double y = 0.0;
+};
+CLOUD_DOCUMENT_FIELDS(SchemaPoint, x, y)
+
+struct SchemaProject {
+  var::String name;
+  u32 version = 0;
+  bool is_public = false;
+  var::Vector<var::String> tags;
+  SchemaPoint origin;
+};
+CLOUD_DOCUMENT_FIELDS(SchemaProject, name, version, is_public, tags, origin)
+
 class UnitTest : public test::Test {
   static constexpr auto database_project = "cloudapitest-2ec81";
 
@@ -31,7 +48,18 @@ public:
   bool execute_class_api_case() {
     Cloud::set_default_printer(printer());
 
+    TEST_ASSERT_RESULT(json_stream_case());
+    TEST_ASSERT_RESULT(event_stream_case());
+    TEST_ASSERT_RESULT(database_mirror_case());
+    TEST_ASSERT_RESULT(query_case());
+    TEST_ASSERT_RESULT(cloud_map_stream_case());
+    TEST_ASSERT_RESULT(base64_case());
+    TEST_ASSERT_RESULT(checksum_case());
+    TEST_ASSERT_RESULT(emulator_case());
+    TEST_ASSERT_RESULT(async_case());
+    TEST_ASSERT_RESULT(document_schema_case());
     TEST_ASSERT_RESULT(credentials_case());
+    TEST_ASSERT_RESULT(connection_pool_case());
     TEST_ASSERT_RESULT(storage_case());
     TEST_ASSERT_RESULT(document_case());
     TEST_ASSERT_RESULT(database_case());
@@ -40,6 +68,922 @@ public:
     return true;
   }
 
+  bool json_stream_case() {
+    Printer::Object po(printer(), "jsonStream");
+
+    const StringView input
+      = R"({"name":"str\"eam","list":[1,-2.5e1,true,false,null,{"a":"\u00e9"}],"empty":{}})";
+
+    // every split point must give the same tree
+    for (size_t split = 0; split <= input.length(); split++) {
+      JsonTreeBuilder builder;
+      JsonStreamParser parser(builder);
+      TEST_ASSERT(parser.feed(View(input.get_substring_with_length(split))) >= 0);
+      TEST_ASSERT(parser.feed(View(input.get_substring_at_position(split))) >= 0);
+      TEST_ASSERT(parser.finish() == 0);
+
+      const auto object = builder.value().to_object();
+      TEST_ASSERT(object.at("name").to_string_view() == "str\"eam");
+      const auto list = object.at("list").to_array();
+      TEST_ASSERT(list.count() == 6);
+      TEST_ASSERT(list.at(0).to_integer() == 1);
+      TEST_ASSERT(list.at(1).to_real() == -25.0f);
+      TEST_ASSERT(list.at(2).to_bool());
+      TEST_ASSERT(list.at(4).is_null());
+      TEST_ASSERT(
+        list.at(5).to_object().at("a").to_string_view() == "\xc3\xa9");
+      TEST_ASSERT(object.at("empty").to_object().count() == 0);
+    }
+
+    {
+      JsonTreeBuilder builder;
+      JsonStreamParser parser(builder);
+      TEST_ASSERT(parser.feed(View(StringView("{\"a\":[1,}"))) < 0);
+      TEST_ASSERT(parser.is_error());
+      TEST_ASSERT(parser.is_stopped() == false);
+    }
+    API_RESET_ERROR();
+
+    {
+      // a handler that returns a negative value stops without a parse error
+      JsonTreeBuilder builder;
+      builder.set_element_callback(1, [](const JsonValue &) { return -1; });
+      JsonStreamParser parser(builder);
+      TEST_ASSERT(parser.feed(View(StringView("[1,2]"))) < 0);
+      TEST_ASSERT(parser.is_stopped());
+    }
+
+    {
+      // 64-bit integers and doubles keep the precision of the text
+      const StringView numbers = R"({"time":1700000000000,"ratio":0.1})";
+      JsonTreeBuilder builder;
+      JsonStreamParser parser(builder);
+      TEST_ASSERT(parser.feed(View(numbers)) >= 0);
+      TEST_ASSERT(parser.finish() == 0);
+      const auto compact = JsonDocument::Flags::compact;
+      TEST_ASSERT(
+        JsonDocument().set_flags(compact).to_string(builder.value())
+        == JsonDocument().set_flags(compact).to_string(
+          JsonDocument().from_string(numbers)));
+      TEST_ASSERT(
+        JsonDocument()
+          .to_string(builder.value())
+          .string_view()
+          .find("1700000000000")
+        != StringView::npos);
+      TEST_ASSERT(
+        JsonDocument().set_flags(compact).to_string(JsonArray().append(
+          JsonTreeBuilder::create_number("-9007199254740993")))
+        == "[-9007199254740993]");
+      TEST_ASSERT(!JsonTreeBuilder::create_number("1e999").is_valid());
+      TEST_ASSERT(
+        !JsonTreeBuilder::create_number("99999999999999999999").is_valid());
+    }
+
+    return true;
+  }
+
+  bool event_stream_case() {
+    Printer::Object po(printer(), "eventStream");
+
+    const StringView input
+      = "event: put\r\ndata: {\"path\":\"/a\",\"data\":{\"b\":[1,\"}\"]}}\r\n\r\n"
+        ": comment\n"
+        "event: keep-alive\ndata: null\n\n"
+        "event: patch\ndata: {\"path\": \"/c\", \"data\": 5}\n\n";
+
+    struct Counts {
+      int put = 0;
+      int patch = 0;
+      int keep_alive = 0;
+      bool is_valid = true;
+    };
+
+    // deliver the stream one byte at a time
+    Counts counts;
+    EventStreamParser parser(
+      [&](const EventStreamParser::Event &event) -> int {
+        using Type = EventStreamParser::Event::Type;
+        switch (event.type()) {
+        case Type::put:
+          counts.put++;
+          counts.is_valid = counts.is_valid && event.path() == "/a"
+                            && event.value() == "{\"b\":[1,\"}\"]}";
+          break;
+        case Type::patch:
+          counts.patch++;
+          counts.is_valid
+            = counts.is_valid && event.path() == "/c" && event.value() == "5";
+          break;
+        case Type::keep_alive:
+          counts.keep_alive++;
+          break;
+        default:
+          counts.is_valid = false;
+        }
+        return 0;
+      },
+      16);
+
+    for (size_t i = 0; i < input.length(); i++) {
+      TEST_ASSERT(
+        parser.feed(View(input.get_substring_at_position(i)
+                           .get_substring_with_length(1)))
+        == 1);
+    }
+
+    TEST_ASSERT(counts.is_valid);
+    TEST_ASSERT(counts.put == 1);
+    TEST_ASSERT(counts.patch == 1);
+    TEST_ASSERT(counts.keep_alive == 1);
+    return true;
+  }
+
+  bool database_mirror_case() {
+    Printer::Object po(printer(), "databaseMirror");
+
+    // events are applied locally without starting the listener
+    DatabaseMirror mirror(database, "devices");
+    int change_count = 0;
+    mirror.add_change_callback(
+      [&](StringView, const JsonValue &) { change_count++; });
+
+    mirror.put(
+      "/",
+      JsonObject().insert(
+        "device0",
+        JsonObject().insert("status", JsonString("offline"))));
+    TEST_ASSERT(
+      mirror.get_value("device0/status").to_string_view() == "offline");
+
+    mirror.patch(
+      "/device0",
+      JsonObject()
+        .insert("status", JsonString("online"))
+        .insert("count", JsonInteger(2)));
+    TEST_ASSERT(
+      mirror.get_value("/device0/status").to_string_view() == "online");
+    TEST_ASSERT(mirror.get_value("device0/count").to_integer() == 2);
+
+    // read_value() passes the mirrored value itself rather than a copy
+    u32 key_count = 0;
+    mirror.read_value("device0", [&](const JsonValue &value) {
+      key_count = value.to_object().count();
+    });
+    TEST_ASSERT(key_count == 2);
+    bool is_missing_valid = true;
+    mirror.read_value("device1", [&](const JsonValue &value) {
+      is_missing_valid = value.is_valid();
+    });
+    TEST_ASSERT(!is_missing_valid);
+
+    mirror.put("/device0/status", JsonNull());
+    TEST_ASSERT(!mirror.get_value("device0/status").is_valid());
+    TEST_ASSERT(mirror.get_value("device1").is_valid() == false);
+    TEST_ASSERT(change_count == 4);
+
+    return true;
+  }
+
+  bool query_case() {
+    Printer::Object po(printer(), "query");
+
+    Query query("projects/abc/tasks");
+    query.where("owner", Query::Operator::equal, JsonString("tyler"))
+      .where("deleted", Query::Operator::equal, JsonNull())
+      .order_by("created", Query::Direction::descending)
+      .start_after(JsonArray().append(JsonInteger(100)))
+      .set_limit(10);
+
+    TEST_ASSERT(query.parent() == "projects/abc");
+    TEST_ASSERT(query.collection_id() == "tasks");
+
+    const auto object = query.to_object();
+    printer().object("structuredQuery", object);
+    const auto from = object.at("from").to_array().at(0).to_object();
+    TEST_ASSERT(from.at("collectionId").to_string_view() == "tasks");
+
+    const auto filters
+      = object.at("where").to_object().at("compositeFilter").to_object();
+    TEST_ASSERT(filters.at("filters").to_array().count() == 2);
+    TEST_ASSERT(
+      filters.at("filters")
+        .to_array()
+        .at(0)
+        .to_object()
+        .at("fieldFilter")
+        .to_object()
+        .at("value")
+        .to_object()
+        .at("stringValue")
+        .to_string_view()
+      == "tyler");
+    TEST_ASSERT(object.at("limit").to_integer() == 10);
+    TEST_ASSERT(!object.at("startAt").to_object().at("before").is_valid());
+
+    return true;
+  }
+
+  bool cloud_map_stream_case() {
+    Printer::Object po(printer(), "cloudMapStream");
+
+    const StringView input
+      = R"({"name":"a\"b","count":5,"ratio":0.5,"ok":true,"none":null,)"
+        R"("list":[1,"x"],"map":{"k":"v"}})";
+
+    const StringView expected
+      = R"({"fields":{"name":{"stringValue":"a\"b"},)"
+        R"("count":{"integerValue":"5"},"ratio":{"doubleValue":0.5},)"
+        R"("ok":{"booleanValue":true},"none":{"nullValue":null},)"
+        R"("list":{"arrayValue":{"values":[{"integerValue":"1"},)"
+        R"({"stringValue":"x"}]}},)"
+        R"("map":{"mapValue":{"fields":{"k":{"stringValue":"v"}}}}}})";
+
+    const auto output = CloudMapEncoder::encode(input);
+    printer().key("encoded", output);
+    TEST_ASSERT(output.string_view() == expected);
+
+    // Firestore does not allow arrays in arrays
+    TEST_ASSERT(CloudMapEncoder::encode(R"({"list":[[1]]})").is_empty());
+    TEST_ASSERT(CloudMapEncoder::encode("[1]").is_empty());
+
+    // decoding the encoded document (with a name) gives back the input
+    const auto decoded = CloudMapDecoder::decode(
+      String(R"({"name":"projects/p/databases/(default)/documents/c/d",)")
+      + output.string_view().get_substring_at_position(1));
+    printer().key("decoded", decoded);
+    TEST_ASSERT(decoded.string_view() == input);
+
+    // CloudMap exports integers with the same type as CloudMapDecoder
+    const auto exported
+      = CloudMap(JsonDocument().from_string(output).to_object()).to_json();
+    TEST_ASSERT(exported.at("count").is_integer());
+    TEST_ASSERT(exported.at("count").to_integer() == 5);
+    TEST_ASSERT(exported.at("list").to_array().at(0).is_integer());
+
+    TEST_ASSERT(
+      CloudMapDecoder::decode(
+        R"({"fields":{"t":{"timestampValue":"2021-01-01T00:00:00Z"},)"
+        R"("g":{"geoPointValue":{"latitude":1.5,"longitude":-2}},)"
+        R"("m":{"mapValue":{}},"a":{"arrayValue":{}}}})")
+        .string_view()
+      == R"({"t":{"timestampValue":"2021-01-01T00:00:00Z"},)"
+         R"("g":{"geoPointValue":{"latitude":1.5,"longitude":-2}},)"
+         R"("m":{},"a":[]})");
+
+    // typed values survive a round trip
+    const StringView typed
+      = R"({"b":{"bytesValue":"AAE="},)"
+        R"("r":[{"referenceValue":)"
+        R"("projects/p/databases/(default)/documents/c/d"}],)"
+        R"("e":{}})";
+    const auto typed_output = CloudMapEncoder::encode(typed);
+    printer().key("typed", typed_output);
+    TEST_ASSERT(
+      typed_output.string_view()
+      == R"({"fields":{"b":{"bytesValue":"AAE="},)"
+         R"("r":{"arrayValue":{"values":[{"referenceValue":)"
+         R"("projects/p/databases/(default)/documents/c/d"}]}},)"
+         R"("e":{"mapValue":{"fields":{}}}}})");
+    TEST_ASSERT(
+      CloudMapDecoder::decode(typed_output).string_view() == typed);
+
+    // a type name with other keys is an ordinary map, as in CloudMap
+    TEST_ASSERT(
+      CloudMapEncoder::encode(
+        R"({"t":{"timestampValue":"x","y":1},)"
+        R"("g":{"geoPointValue":{"latitude":1},"n":null}})")
+        .string_view()
+      == R"({"fields":{"t":{"mapValue":{"fields":{)"
+         R"("timestampValue":{"stringValue":"x"},)"
+         R"("y":{"integerValue":"1"}}}},)"
+         R"("g":{"mapValue":{"fields":{)"
+         R"("geoPointValue":{"mapValue":{"fields":{)"
+         R"("latitude":{"integerValue":"1"}}}},)"
+         R"("n":{"nullValue":null}}}}}})");
+
+    return true;
+  }
+
+  bool base64_case() {
+    Printer::Object po(printer(), "base64");
+
+    String encoded;
+    Base64Codec::encode(View(StringView("foobar")), encoded);
+    TEST_ASSERT(encoded.string_view() == "Zm9vYmFy");
+
+    encoded = String();
+    Base64Codec::Encoder(encoded)
+      .feed(View(StringView("fo")))
+      .feed(View(StringView("ob")))
+      .finish();
+    TEST_ASSERT(encoded.string_view() == "Zm9vYg==");
+
+    Data decoded;
+    TEST_ASSERT(Base64Codec::decode("Zm9vYg==", decoded) == 4);
+    TEST_ASSERT(View(decoded) == View(StringView("foob")));
+    // padding is optional
+    TEST_ASSERT(Base64Codec::decode("Zm9vYmE", decoded) == 5);
+    TEST_ASSERT(Base64Codec::decode("Zm9v!A==", decoded) < 0);
+
+    const auto bytes
+      = CloudMap::get_bytes(CloudMap::create_bytes(View(StringView("abc"))));
+    TEST_ASSERT(View(bytes) == View(StringView("abc")));
+
+    return true;
+  }
+
+  bool checksum_case() {
+    Printer::Object po(printer(), "checksum");
+
+    const StringView check = "123456789";
+    TEST_ASSERT(Crc32c::calculate(View(check)) == 0xe3069283);
+    TEST_ASSERT(Crc32c().update(View(check)).to_base64().string_view()
+                == "4waSgw==");
+    // continue from a saved value or combine the parts
+    const u32 first = Crc32c::calculate(View(StringView("1234")));
+    TEST_ASSERT(
+      Crc32c(first).update(View(StringView("56789"))).value() == 0xe3069283);
+    TEST_ASSERT(
+      Crc32c::combine(first, Crc32c::calculate(View(StringView("56789"))), 5)
+      == 0xe3069283);
+
+    TEST_ASSERT(Md5().to_base64().string_view() == "1B2M2Y8AsgTpgAmY7PhCfg==");
+    TEST_ASSERT(
+      Md5().update(View(StringView("a"))).update(View(StringView("bc")))
+        .to_base64()
+        .string_view()
+      == "kAFQmDzST7DWlj99KOF/cg==");
+
+    return true;
+  }
+
+  bool emulator_case() {
+    Printer::Object po(printer(), "emulator");
+
+    Emulator emulator;
+    Cloud cloud("emulator");
+    cloud.set_emulator(&emulator);
+    TEST_ASSERT(cloud.login("test@example.com", "password").is_success());
+
+    Database database(cloud, "emulator");
+    TEST_ASSERT(database
+                  .patch_object(
+                    "users/a",
+                    JsonObject().insert("name", JsonString("tyler")))
+                  .is_success());
+    TEST_ASSERT(
+      database.get_value("users/a").to_object().at("name").to_string_view()
+      == "tyler");
+    // emulated requests still lease connections from the pool
+    TEST_ASSERT(cloud.connection_pool().is_emulated());
+    TEST_ASSERT(cloud.connection_pool().connection_count() == 2);
+
+    Store store(cloud, "emulator");
+    TEST_ASSERT(
+      store
+        .create_document(
+          "projects",
+          JsonObject().insert("stars", JsonInteger(5)),
+          "one")
+        .string_view()
+      == "one");
+    TEST_ASSERT(store
+                  .create_document(
+                    "projects",
+                    JsonObject().insert("stars", JsonInteger(9)),
+                    "two")
+                  .is_empty()
+                == false);
+
+    u32 count = 0;
+    Query query("projects");
+    query.where("stars", Query::Operator::greater_than, JsonInteger(6));
+    TEST_ASSERT(store
+                  .run_query(
+                    query,
+                    [&](StringView path, const JsonValue &document) {
+                      count++;
+                      const auto stars
+                        = document.to_object().at("stars").to_integer();
+                      return path == "projects/two" && stars == 9 ? 0 : -1;
+                    })
+                  .is_success());
+    TEST_ASSERT(count == 1);
+
+    // an error response is not passed to the handler
+    JsonTreeBuilder error_builder;
+    TEST_ASSERT(
+      store.get_document("projects/none", error_builder).is_error());
+    API_RESET_ERROR();
+    TEST_ASSERT(!error_builder.value().is_valid());
+
+    // a second create with the same id is rejected
+    TEST_ASSERT(store
+                  .create_document(
+                    "projects",
+                    JsonObject().insert("stars", JsonInteger(1)),
+                    "one")
+                  .is_empty());
+    TEST_ASSERT(is_error());
+    API_RESET_ERROR();
+
+    // committed chunks are not sent again after a later chunk fails
+    auto batch = store.write_batch();
+    batch.set_max_write_count(1);
+    batch
+      .transform(
+        "projects/one",
+        Store::FieldTransform::increment("stars", JsonInteger(1)))
+      .create("projects", JsonObject(), "two")
+      .create("projects", JsonObject(), "three");
+    TEST_ASSERT(batch.commit().is_error());
+    API_RESET_ERROR();
+    TEST_ASSERT(batch.count() == 2 && batch.write_results().count() == 1);
+    TEST_ASSERT(batch.commit().is_error());
+    API_RESET_ERROR();
+    TEST_ASSERT(
+      store.get_document("projects/one").at("stars").to_integer() == 6);
+
+    // missing documents are null and the paths are sent in batches
+    StringList document_list;
+    document_list.push_back("projects/one");
+    document_list.push_back("projects/missing");
+    document_list.push_back("projects/two");
+    store.set_batch_get_limit(2);
+    const u32 batch_get_request_count = emulator.request_count();
+    const auto documents = store.get_documents(document_list);
+    store.set_batch_get_limit(100);
+    TEST_ASSERT(is_success());
+    TEST_ASSERT(emulator.request_count() == batch_get_request_count + 2);
+    TEST_ASSERT(documents.count() == 3);
+    TEST_ASSERT(documents.at("projects/missing").is_null());
+    TEST_ASSERT(
+      documents.at("projects/one").to_object().at("stars").to_integer() == 6);
+    TEST_ASSERT(
+      documents.at("projects/two").to_object().at("stars").to_integer() == 9);
+
+    // stopping early is not an error and skips the remaining batches
+    store.set_batch_get_limit(2);
+    u32 stop_count = 0;
+    const u32 stop_request_count = emulator.request_count();
+    store.get_documents(
+      document_list,
+      [&](StringView, const JsonValue &) -> int {
+        stop_count++;
+        return -1;
+      });
+    store.set_batch_get_limit(100);
+    TEST_ASSERT(is_success());
+    TEST_ASSERT(stop_count == 1);
+    TEST_ASSERT(emulator.request_count() == stop_request_count + 1);
+
+    // the next page is fetched on the worker pool while a page is read
+    for (u32 i = 0; i < 5; i++) {
+      TEST_ASSERT(store
+                    .create_document(
+                      "pages",
+                      JsonObject().insert("index", JsonInteger(i)),
+                      String().format("page%d", int(i)))
+                    .is_empty()
+                  == false);
+    }
+    {
+      WorkerPool worker_pool(WorkerPool::Construct().set_thread_count(1));
+      store.set_worker_pool(&worker_pool);
+      const u32 cursor_request_count = emulator.request_count();
+      u32 index_total = 0;
+      u32 document_count = 0;
+      {
+        Store::DocumentCursor cursor(store, "pages", 2);
+        while (cursor.next()) {
+          TEST_ASSERT(cursor.path().find("pages/page") == 0);
+          index_total += cursor.document().at("index").to_integer();
+          document_count++;
+        }
+        TEST_ASSERT(is_success());
+        TEST_ASSERT(cursor.page_count() == 3);
+      }
+      store.set_worker_pool(nullptr);
+      TEST_ASSERT(document_count == 5 && index_total == 10);
+      TEST_ASSERT(emulator.request_count() == cursor_request_count + 3);
+    }
+
+    // aggregations, an average of no values is NaN
+    TEST_ASSERT(store.count(Query("pages")) == 5);
+    TEST_ASSERT(store.count(Query("pages"), 3) == 3);
+    TEST_ASSERT(store.sum(Query("pages"), "index") == 10.0);
+    TEST_ASSERT(store.avg(Query("pages"), "index") == 2.0);
+    TEST_ASSERT(std::isnan(store.avg(Query("pages"), "missing")));
+    Query empty_query("pages");
+    empty_query.where("index", Query::Operator::greater_than, JsonInteger(9));
+    TEST_ASSERT(store.count(empty_query) == 0);
+    TEST_ASSERT(std::isnan(store.avg(empty_query, "index")));
+    TEST_ASSERT(is_success());
+
+    Storage storage(cloud, "emulator");
+    TEST_ASSERT(storage
+                  .create_object(
+                    "files/hello.txt",
+                    fs::ViewFile(View(StringView("hello world"))))
+                  .is_success());
+    fs::DataFile destination;
+    storage.set_verify_md5();
+    TEST_ASSERT(
+      storage.get_object("files/hello.txt", destination).is_success());
+    TEST_ASSERT(View(destination.data()) == View(StringView("hello world")));
+    TEST_ASSERT(
+      storage.get_details("files/hello.txt").at("crc32c").to_string_view()
+      == Crc32c().update(View(destination.data())).to_base64().string_view());
+    storage.set_verify_md5(false);
+
+    // smaller chunks than GCS allows, the 1 byte tail is not aligned
+    const StringView chunked = "sent four bytes at a time";
+    emulator.set_upload_chunk_granularity(4);
+    storage.set_upload_chunk_size(4);
+    TEST_ASSERT(
+      storage.create_object("files/chunked.txt", fs::ViewFile(View(chunked)))
+        .is_success());
+    fs::DataFile chunked_destination;
+    TEST_ASSERT(storage.get_object("files/chunked.txt", chunked_destination)
+                  .is_success());
+    TEST_ASSERT(View(chunked_destination.data()) == View(chunked));
+
+    // ranges are written at their own offsets
+    storage.set_download_range_size(4);
+    fs::DataFile ranged_destination(fs::OpenMode::read_write());
+    ranged_destination.data().resize(chunked.length());
+    TEST_ASSERT(storage.get_object("files/chunked.txt", ranged_destination)
+                  .is_success());
+    TEST_ASSERT(View(ranged_destination.data()) == View(chunked));
+
+    // dropped and failed chunks and ranges are resumed from the server
+    u32 fault_count = 0;
+    emulator.set_fault_callback([&](const Emulator::Request &request) {
+      const bool is_chunk = request.url().find("upload_id=") != StringView::npos
+                            && request.body() && request.body()->size();
+      const bool is_range
+        = !Emulator::get_header_field(request.header_fields(), "Range")
+             .is_empty();
+      if (!is_chunk && !is_range) {
+        return Emulator::Fault::none;
+      }
+      fault_count++;
+      return fault_count % 3 == 1   ? Emulator::Fault::truncate
+             : fault_count % 3 == 2 ? Emulator::Fault::unavailable
+                                    : Emulator::Fault::none;
+    });
+    TEST_ASSERT(
+      storage.create_object("files/faulted.txt", fs::ViewFile(View(chunked)))
+        .is_success());
+    TEST_ASSERT(fault_count > 3);
+    // one range at a time keeps the order of the faults
+    storage.set_download_range_count(1);
+    fs::DataFile faulted_destination(fs::OpenMode::read_write());
+    faulted_destination.data().resize(chunked.length());
+    TEST_ASSERT(storage.get_object("files/faulted.txt", faulted_destination)
+                  .is_success());
+    emulator.set_fault_callback(Emulator::FaultCallback());
+    storage.set_download_range_count(4);
+    TEST_ASSERT(View(faulted_destination.data()) == View(chunked));
+    TEST_ASSERT(storage.remove_object("files/faulted.txt").is_success());
+    storage.set_download_range_size(0);
+
+    // a saved session continues from the server's offset
+    const auto session = storage.start_upload("files/resumed.txt", 11);
+    TEST_ASSERT(session.is_valid());
+    Storage::UploadSession restored(session.to_object());
+    TEST_ASSERT(storage
+                  .resume_upload(
+                    restored,
+                    fs::ViewFile(View(StringView("hello world"))))
+                  .is_success());
+    TEST_ASSERT(restored.is_complete() && restored.offset() == 11);
+
+    // sizes are saved as strings so images over 2 GiB keep their offset
+    const auto large = Storage::UploadSession()
+                         .set_url("/upload/large")
+                         .set_size(size_t(3) << 30)
+                         .set_offset((size_t(5) << 29) + 1);
+    const Storage::UploadSession large_restored(large.to_object());
+    TEST_ASSERT(large.to_object().at("size").to_string_view() == "3221225472");
+    TEST_ASSERT(large_restored.size() == large.size());
+    TEST_ASSERT(large_restored.offset() == large.offset());
+
+    // the parts are uploaded at the same time and then composed
+    storage.set_composite_upload_part_count(4);
+    TEST_ASSERT(
+      storage.create_object("files/composite.txt", fs::ViewFile(View(chunked)))
+        .is_success());
+    storage.set_composite_upload_part_count(0).set_upload_chunk_size(0);
+    fs::DataFile composite_destination;
+    TEST_ASSERT(storage.get_object("files/composite.txt", composite_destination)
+                  .is_success());
+    TEST_ASSERT(View(composite_destination.data()) == View(chunked));
+
+    // local files are mapped in place where mmap() is available
+    TEST_ASSERT(
+      storage.download_file("files/composite.txt", "mapped.txt").is_success());
+    TEST_ASSERT(
+      fs::FileSystem().get_info("mapped.txt").size() == chunked.size());
+    TEST_ASSERT(
+      storage.upload_file("files/mapped.txt", "mapped.txt").is_success());
+    fs::DataFile mapped_destination;
+    TEST_ASSERT(storage.get_object("files/mapped.txt", mapped_destination)
+                  .is_success());
+    TEST_ASSERT(View(mapped_destination.data()) == View(chunked));
+    TEST_ASSERT(storage.remove_object("files/mapped.txt").is_success());
+    TEST_ASSERT(fs::FileSystem().remove("mapped.txt").is_success());
+
+    // a second sync finds nothing to transfer in either direction
+    TEST_ASSERT(fs::FileSystem()
+                  .create_directory(
+                    "sync_upload/nested",
+                    fs::FileSystem::IsRecursive::yes)
+                  .is_success());
+    fs::File(fs::File::IsOverwrite::yes, "sync_upload/a.txt")
+      .write(View(StringView("first")));
+    fs::File(fs::File::IsOverwrite::yes, "sync_upload/nested/b.txt")
+      .write(View(chunked));
+    TEST_ASSERT(is_success());
+    StorageSync storage_sync(storage);
+    const auto upload_options = StorageSync::Options()
+                                  .set_local_path("sync_upload")
+                                  .set_remote_path("sync")
+                                  .set_transfer_count(2);
+    TEST_ASSERT(storage_sync.sync(upload_options).is_success());
+    TEST_ASSERT(
+      storage_sync.transferred_count() == 2
+      && storage_sync.skipped_count() == 0);
+    TEST_ASSERT(storage.is_report_progress());
+    TEST_ASSERT(storage_sync.sync(upload_options).is_success());
+    TEST_ASSERT(
+      storage_sync.transferred_count() == 0
+      && storage_sync.skipped_count() == 2);
+
+    const auto download_options
+      = StorageSync::Options()
+          .set_local_path("sync_download")
+          .set_remote_path("sync")
+          .set_direction(StorageSync::Direction::download);
+    TEST_ASSERT(storage_sync.sync(download_options).is_success());
+    TEST_ASSERT(
+      storage_sync.transferred_count() == 2
+      && storage_sync.transferred_size() == chunked.length() + 5);
+    TEST_ASSERT(storage_sync.sync(download_options).is_success());
+    TEST_ASSERT(storage_sync.skipped_count() == 2);
+    TEST_ASSERT(
+      StorageSync::get_file_crc32c("sync_download/nested/b.txt")
+      == storage.get_details("sync/nested/b.txt").at("crc32c").to_string());
+
+    // an object name cannot put a download outside of the local path
+    TEST_ASSERT(storage
+                  .create_object(
+                    "sync/../escaped.txt",
+                    fs::ViewFile(View(StringView("escaped"))))
+                  .is_success());
+    TEST_ASSERT(storage_sync.sync(download_options).is_success());
+    TEST_ASSERT(storage_sync.rejected_count() == 1);
+    TEST_ASSERT(storage_sync.skipped_count() == 2);
+    TEST_ASSERT(fs::FileSystem().exists("escaped.txt") == false);
+
+    StringList sync_objects;
+    sync_objects.push_back("sync/a.txt");
+    sync_objects.push_back("sync/nested/b.txt");
+    sync_objects.push_back("sync/../escaped.txt");
+    api::ignore = storage.remove_objects(sync_objects);
+    for (const auto directory : {"sync_upload", "sync_download"}) {
+      TEST_ASSERT(fs::FileSystem()
+                    .remove_directory(
+                      directory,
+                      fs::FileSystem::IsRecursive::yes)
+                    .is_success());
+    }
+
+    // objects under a deeper "/" are listed once as a prefix
+    TEST_ASSERT(
+      storage.create_object("files/deep/one.txt", fs::ViewFile(View(chunked)))
+        .is_success());
+    storage.set_list_page_size(1);
+    const auto page = storage.list_objects("files/", "/");
+    TEST_ASSERT(page.at("items").to_array().count() == 1);
+    TEST_ASSERT(
+      page.at("prefixes").to_array().at(0).to_string_view() == "files/deep/");
+    TEST_ASSERT(page.at("nextPageToken").to_string_view().is_empty() == false);
+    u32 object_count = 0;
+    TEST_ASSERT(storage
+                  .for_each_object(
+                    "files/",
+                    "",
+                    [&](const JsonObject &details) {
+                      object_count++;
+                      return details.at("size").to_string_view() != "";
+                    })
+                  .is_success());
+    TEST_ASSERT(object_count == 5);
+    storage.set_list_page_size(0);
+
+    // each delete has its own result in one batch request
+    StringList remove_list;
+    remove_list.push_back("files/deep/one.txt");
+    remove_list.push_back("files/missing.txt");
+    const u32 batch_request_count = emulator.request_count();
+    const auto remove_result = storage.remove_objects(remove_list);
+    TEST_ASSERT(is_success());
+    TEST_ASSERT(emulator.request_count() == batch_request_count + 1);
+    TEST_ASSERT(remove_result.count() == 2);
+    TEST_ASSERT(remove_result.at(0) == inet::Http::Status::no_content);
+    TEST_ASSERT(remove_result.at(1) == inet::Http::Status::not_found);
+    TEST_ASSERT(storage.remove_object("files/resumed.txt").is_success());
+    TEST_ASSERT(storage.get_details("files/resumed.txt").count() == 0);
+    TEST_ASSERT(is_error());
+    API_RESET_ERROR();
+
+    {
+      // queued transfers run one at a time at up to 1 MB/s
+      TransferManager manager(
+        storage,
+        TransferManager::Construct().set_transfer_count(1).set_bandwidth_limit(
+          1024 * 1024));
+      const auto managed_source = fs::ViewFile(View(chunked));
+      fs::DataFile managed_destination;
+      u32 callback_count = 0;
+      manager
+        .submit(
+          TransferManager::Transfer()
+            .set_path("files/managed.txt")
+            .set_file(&managed_source)
+            .set_priority(TransferManager::Priority::high),
+          [&]() { callback_count++; })
+        .wait()
+        .submit(
+          TransferManager::Transfer()
+            .set_direction(TransferManager::Direction::download)
+            .set_path("files/managed.txt")
+            .set_file(&managed_destination)
+            .set_bandwidth_limit(16),
+          [&]() { callback_count++; })
+        .wait();
+      TEST_ASSERT(callback_count == 2 && manager.error_count() == 0);
+      TEST_ASSERT(View(managed_destination.data()) == View(chunked));
+      TEST_ASSERT(storage.remove_object("files/managed.txt").is_success());
+      TEST_ASSERT(storage.is_report_progress() == false);
+    }
+    // the manager gives progress reports back to storage
+    TEST_ASSERT(storage.is_report_progress());
+
+    // a download is one request and cached details need no request
+    MetadataCache metadata_cache(2);
+    storage.set_metadata_cache(&metadata_cache);
+    u32 request_count = emulator.request_count();
+    fs::DataFile direct_destination;
+    TEST_ASSERT(storage.get_object("files/hello.txt", direct_destination)
+                  .is_success());
+    TEST_ASSERT(emulator.request_count() == request_count + 1);
+    TEST_ASSERT(storage.get_details("files/hello.txt").count());
+    request_count = emulator.request_count();
+    TEST_ASSERT(
+      storage.get_details("files/hello.txt").at("size").to_string_view()
+      == "11");
+    TEST_ASSERT(emulator.request_count() == request_count);
+    TEST_ASSERT(storage.get_details("files/chunked.txt").count());
+    TEST_ASSERT(storage.get_details("files/composite.txt").count());
+    // the least recently used entry is removed
+    TEST_ASSERT(metadata_cache.count() == 2);
+    TEST_ASSERT(metadata_cache.get("files/hello.txt").count() == 0);
+    storage.set_metadata_cache(nullptr);
+
+    // a host override does not change how the emulator routes requests
+    cloud.set_host("firestore.googleapis.com", "localhost:8080");
+    TEST_ASSERT(Store(cloud, "emulator").host() == "localhost:8080");
+    TEST_ASSERT(
+      Store(cloud, "emulator").get_document("projects/one").is_empty()
+      == false);
+
+    return true;
+  }
+
+  bool async_case() {
+    Printer::Object po(printer(), "async");
+
+    Emulator emulator;
+    Cloud cloud("emulator");
+    cloud.set_emulator(&emulator);
+    TEST_ASSERT(cloud.login("test@example.com", "password").is_success());
+
+    WorkerPool worker_pool(WorkerPool::Construct().set_thread_count(2));
+    Store store(cloud, "emulator");
+    store.set_worker_pool(&worker_pool);
+    Storage storage(cloud, "emulator");
+    storage.set_worker_pool(&worker_pool);
+
+    // callbacks run on a worker thread and see that thread's errors
+    thread::Mutex mutex;
+    String created_id;
+    u32 success_count = 0;
+    u32 error_count = 0;
+    store.create_document_async(
+      "projects",
+      JsonObject().insert("stars", JsonInteger(5)),
+      "async",
+      [&](StringView id) {
+        thread::Mutex::Scope mutex_scope(mutex);
+        created_id = String(id);
+      });
+    const auto source = fs::ViewFile(View(StringView("hello async")));
+    storage.create_object_async("files/async.txt", source, "", [&]() {
+      thread::Mutex::Scope mutex_scope(mutex);
+      success_count += is_success() ? 1 : 0;
+    });
+    worker_pool.wait();
+    TEST_ASSERT(created_id == "async" && success_count == 1);
+
+    fs::DataFile destination;
+    store
+      .get_document_async(
+        "projects/async",
+        [&](const JsonObject &document) {
+          thread::Mutex::Scope mutex_scope(mutex);
+          const auto stars = document.at("stars").to_integer();
+          success_count += is_success() && stars == 5 ? 1 : 0;
+        })
+      .get_document_async("projects/missing", [&](const JsonObject &) {
+        thread::Mutex::Scope mutex_scope(mutex);
+        error_count += is_error() ? 1 : 0;
+      });
+    storage.get_object_async("files/async.txt", destination, [&]() {
+      thread::Mutex::Scope mutex_scope(mutex);
+      success_count += is_success() ? 1 : 0;
+    });
+    worker_pool.wait();
+    TEST_ASSERT(success_count == 3 && error_count == 1);
+    TEST_ASSERT(View(destination.data()) == View(StringView("hello async")));
+    // the worker error is not passed to the caller
+    TEST_ASSERT(is_success());
+    return true;
+  }
+
+  bool document_schema_case() {
+    Printer::Object po(printer(), "documentSchema");
+
+    SchemaProject project;
+    project.name = String("demo");
+    project.version = 3;
+    project.is_public = true;
+    project.tags.push_back(String("a"));
+    project.tags.push_back(String("b"));
+    project.origin.x = 1.5;
+
+    const auto encoded = encode_document(project);
+    printer().key("encoded", encoded);
+    TEST_ASSERT(
+      CloudMapDecoder::decode(encoded).string_view()
+      == R"({"name":"demo","version":3,"is_public":true,"tags":["a","b"],)"
+         R"("origin":{"x":1.5,"y":0}})");
+
+    TEST_ASSERT(
+      get_document_update_mask<SchemaProject>().string_view()
+      == "updateMask.fieldPaths=name&updateMask.fieldPaths=version&"
+         "updateMask.fieldPaths=is_public&updateMask.fieldPaths=tags&"
+         "updateMask.fieldPaths=origin");
+
+    // decode straight into a struct, unknown fields are skipped
+    SchemaProject decoded;
+    DocumentSink<SchemaProject> sink(&decoded);
+    DocumentSinkHandler sink_handler(sink);
+    CloudMapDecoder decoder(sink_handler);
+    JsonStreamParser parser(decoder);
+    const StringView document
+      = R"({"name":"projects/p","fields":{"version":{"integerValue":"7"},)"
+        R"("extra":{"mapValue":{"fields":{"name":{"stringValue":"no"}}}},)"
+        R"("name":{"stringValue":"decoded"},)"
+        R"("origin":{"mapValue":{"fields":{"y":{"doubleValue":2.5}}}}}})";
+    TEST_ASSERT(parser.feed(View(document)) >= 0 && parser.finish() == 0);
+    TEST_ASSERT(decoded.name.string_view() == "decoded");
+    TEST_ASSERT(decoded.version == 7);
+    TEST_ASSERT(decoded.origin.y == 2.5);
+    TEST_ASSERT(decoded.tags.count() == 0);
+
+    // integers that do not fit the member fail instead of wrapping
+    for (const auto *version : {"-1", "4294967296", "7x", ""}) {
+      SchemaProject rejected;
+      DocumentSink<SchemaProject> rejected_sink(&rejected);
+      DocumentSinkHandler rejected_handler(rejected_sink);
+      CloudMapDecoder rejected_decoder(rejected_handler);
+      JsonStreamParser rejected_parser(rejected_decoder);
+      const auto input = String(R"({"fields":{"version":{"integerValue":")")
+                         + version + R"("}}})";
+      TEST_ASSERT(
+        rejected_parser.feed(View(input)) < 0
+        || rejected_parser.finish() < 0);
+      TEST_ASSERT(rejected.version == 0);
+      TEST_ASSERT(is_error());
+      API_RESET_ERROR();
+    }
+
+    return true;
+  }
+
   bool storage_case() {
     Printer::Object po(printer(), "storage");
 
@@ -301,6 +1245,45 @@ public:
     return true;
   }
 
+  bool connection_pool_case() {
+    Printer::Object po(printer(), "connectionPool");
+    constexpr auto host = "firestore.googleapis.com";
+    ConnectionPool pool;
+
+    // a connection that is checked in is leased again
+    const inet::HttpSecureClient *client = nullptr;
+    {
+      auto lease = pool.checkout(host);
+      TEST_ASSERT(is_success() && lease.is_valid());
+      TEST_ASSERT(lease.client().is_connected());
+      client = &lease.client();
+    }
+    TEST_ASSERT(pool.connection_count(host) == 1);
+    {
+      auto lease = pool.checkout(host);
+      TEST_ASSERT(&lease.client() == client);
+
+      // a lease held at the same time gets another connection
+      auto second_lease = pool.checkout(host);
+      TEST_ASSERT(is_success() && &second_lease.client() != client);
+      TEST_ASSERT(pool.connection_count(host) == 2);
+      second_lease.discard();
+    }
+    // the discarded connection is closed when it is checked in
+    TEST_ASSERT(pool.connection_count(host) == 1);
+    TEST_ASSERT(pool.clear().connection_count() == 0);
+
+    // a connection that failed is not returned to the pool
+    Cloud local_cloud("local");
+    local_cloud.set_host(host, "localhost");
+    Store local_store(local_cloud, database_project);
+    api::ignore = local_store.get_document("projects/missing");
+    TEST_ASSERT(is_error());
+    API_RESET_ERROR();
+    TEST_ASSERT(local_cloud.connection_pool().connection_count() == 0);
+    return true;
+  }
+
 private:
   Cloud cloud;
   Database database;